@@ -0,0 +1,213 @@
+/*
+ *  Microbenchmarks for the geometry, math and asset code paths
+ *  Results are written as JSON so runs can be compared between releases
+ *
+ *  Usage: benchmark [output.json]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "util.hpp"
+#include "matrix.hpp"
+#include "mesh.hpp"
+#include "primitives.hpp"
+#include "scene.hpp"
+#include "headless.hpp"
+#include "textures.hpp"
+
+struct Result
+{
+  std::string name;
+  long iterations;
+  double minNs, medianNs, meanNs;
+};
+
+static std::vector<Result> results;
+static volatile double sink; // Keeps the optimizer from dropping the work
+
+/*
+ *  Time fn in batches until at least minSeconds have passed
+ *  Each batch runs batchSize iterations and gives one ns/iteration sample
+ */
+template <typename Fn>
+static void measure(const char *name, long batchSize, Fn fn, double minSeconds = 0.5)
+{
+  // Warm up caches and lazily built tables
+  fn();
+
+  std::vector<double> samples;
+  long iterations = 0;
+  double start = Util::seconds();
+  while (Util::seconds() - start < minSeconds || samples.size() < 5)
+  {
+    double t0 = Util::seconds();
+    for (long i = 0; i < batchSize; i++)
+      fn();
+    double t1 = Util::seconds();
+    samples.push_back(1.0e9 * (t1 - t0) / batchSize);
+    iterations += batchSize;
+  }
+
+  std::sort(samples.begin(), samples.end());
+  double sum = 0.0;
+  for (size_t i = 0; i < samples.size(); i++)
+    sum += samples[i];
+
+  Result r;
+  r.name = name;
+  r.iterations = iterations;
+  r.minNs = samples.front();
+  r.medianNs = samples[samples.size() / 2];
+  r.meanNs = sum / samples.size();
+  results.push_back(r);
+  fprintf(stderr, "%-28s %12.1f ns (median of %zu batches)\n", name, r.medianNs, samples.size());
+}
+
+/*
+ *  Write a 24-bit BMP with a gradient so the reader has real work to do
+ */
+static void writeBMP(const char *file, int width, int height)
+{
+  int rowSize = (3 * width + 3) & ~3;
+  unsigned int dataSize = rowSize * height;
+  unsigned char header[54] = {'B', 'M'};
+  unsigned int fileSize = 54 + dataSize;
+  unsigned int fields[] = {fileSize, 0, 54, 40, (unsigned int)width, (unsigned int)height};
+  for (int i = 0; i < 6; i++)
+    for (int b = 0; b < 4; b++)
+      header[2 + 4 * i + b] = (fields[i] >> (8 * b)) & 0xFF;
+  header[26] = 1;  // Planes
+  header[28] = 24; // Bits per pixel
+
+  FILE *f = fopen(file, "wb");
+  if (!f)
+    Util::Fatal("Cannot write %s\n", file);
+  fwrite(header, 1, sizeof(header), f);
+  std::vector<unsigned char> row(rowSize, 0);
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      row[3 * x] = x & 0xFF;
+      row[3 * x + 1] = y & 0xFF;
+      row[3 * x + 2] = (x ^ y) & 0xFF;
+    }
+    fwrite(row.data(), 1, rowSize, f);
+  }
+  fclose(f);
+}
+
+static void writeJSON(FILE *out)
+{
+  fprintf(out, "{\n  \"benchmarks\": [\n");
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    const Result &r = results[i];
+    fprintf(out, "    {\"name\": \"%s\", \"iterations\": %ld, \"min_ns\": %.1f, \"median_ns\": %.1f, \"mean_ns\": %.1f}%s\n",
+            r.name.c_str(), r.iterations, r.minNs, r.medianNs, r.meanNs, i + 1 < results.size() ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char *argv[])
+{
+  // * Math
+  double start[3] = {-0.3, 10.2, 12.5};
+  double end[3] = {5.5, 15.0, 12.5};
+  measure("calculateRotation", 100000, [&]()
+          {
+            double angle, axis[3];
+            Util::calculateRotation(start, end, angle, axis);
+            start[0] += 1e-9; // Defeat hoisting out of the loop
+            sink = angle + axis[2]; });
+  measure("Matrix_segment", 100000, [&]()
+          {
+            double m[16];
+            Matrix::segment(m, start, end, 0.8);
+            start[0] += 1e-9;
+            sink = m[0] + m[5]; });
+
+  // * Animation - a convoy's drill arms aimed and solved, one frame a call
+  Rover rover;
+  Arms arms(2024, 4096);
+  double now = 0.0;
+  measure("Arms_update_4096", 10, [&]()
+          {
+            arms.update(rover, now += 1.0 / 60);
+            double tip[3];
+            arms.tip(0, tip);
+            sink = tip[1]; });
+
+  // * Asset parsing - Util::ReadBMP is LoadTexBMP without the GL upload,
+  //   summing a byte per page so the mapped pixels are actually read
+  const char *bmp = "benchmark_1024.bmp";
+  writeBMP(bmp, 1024, 1024);
+  measure("ReadBMP_1024x1024", 5, [&]()
+          {
+            Util::Image image;
+            Util::ReadBMP(bmp, image);
+            unsigned int sum = 0;
+            for (size_t k = 0; k < image.size(); k += 4096)
+              sum += image.data[k];
+            sink = sum; });
+  remove(bmp);
+
+  // * Tessellation - recorded into meshes without uploading
+  measure("buildSphere_inc10", 100, []()
+          {
+            Mesh mesh;
+            Primitives::buildSphere(mesh, 10.0);
+            sink = mesh.triangleCount(); });
+  measure("buildSphere_inc5", 20, []()
+          {
+            Mesh mesh;
+            Primitives::buildSphere(mesh, 5.0);
+            sink = mesh.triangleCount(); });
+  measure("buildCylinder_36", 200, []()
+          {
+            Mesh mesh;
+            Primitives::buildCylinder(mesh, 36);
+            sink = mesh.triangleCount(); });
+  measure("buildCone_36", 500, []()
+          {
+            Mesh mesh;
+            Primitives::buildCone(mesh, 36);
+            sink = mesh.triangleCount(); });
+
+  // * Per-frame scene traversal - needs an offscreen context and the scene textures
+#ifdef USEEGL
+  FILE *textures = fopen("textures/ground_texture.bmp", "rb");
+  if (textures)
+  {
+    fclose(textures);
+    Util::headless = true;
+    Headless::createContext(320, 240);
+    Scene scene(200, 1, 55, 1);
+    scene.loadTextures();
+    Textures::finish();
+    scene.reshape(320, 240);
+    measure("Scene_idle_draw_320x240", 10, [&]()
+            {
+              scene.idle();
+              scene.draw(); });
+    Headless::destroyContext();
+  }
+  else
+    fprintf(stderr, "Skipping scene traversal: run from the directory holding textures/\n");
+#else
+  fprintf(stderr, "Skipping scene traversal: the offscreen context needs a build with -DUSEEGL\n");
+#endif
+
+  writeJSON(stdout);
+  if (argc > 1)
+  {
+    FILE *out = fopen(argv[1], "w");
+    if (!out)
+      Util::Fatal("Cannot write %s\n", argv[1]);
+    writeJSON(out);
+    fclose(out);
+  }
+  return 0;
+}
@@ -0,0 +1,115 @@
+#ifndef ARMS_HPP
+#define ARMS_HPP
+
+#include <vector>
+
+class Mesh;
+class Rover;
+
+/*
+ *  Drill arms of a convoy, animated together
+ *  Every arm is the same chain of joints - the shoulder fixed to its rover,
+ *  the elbow, and the wrist the drill head hangs from - and reaches down to
+ *  a sample spot on the ground in front of the rover, drills, and stows
+ *  again. The joints of all the arms are kept in separate arrays and FABRIK
+ *  solves them in lock step, eight or four arms per SIMD kernel pass (AVX2 or
+ *  SSE when the CPU has them), in blocks over the worker pool. Only the
+ *  elbow and wrist of each drawn arm cross to the GPU beside its rover's
+ *  pose, and the vertex shader bends the unit bone meshes between them
+ */
+class Arms
+{
+public:
+  // Joints of the chain, each hanging from the one before
+  enum Joint
+  {
+    SHOULDER,
+    ELBOW,
+    WRIST,
+    JOINT_COUNT
+  };
+  // Bones drawn from the joints - the head hangs rigidly below the wrist
+  enum Bone
+  {
+    UPPER,
+    FORE,
+    HEAD,
+    BONE_COUNT
+  };
+
+  Arms(unsigned int seed, int count);
+
+  // Arms in the convoy, one per rover
+  void resize(int count);
+  int count() const;
+
+  // Aim every arm of rovers built like rover at its target at now (seconds)
+  // and solve them - main thread only
+  void update(const Rover &rover, double now);
+
+  // Keep count drawn arms
+  void setDrawn(int count);
+  // Draw arm in slot, its rover placed by pose - safe on the worker threads
+  void place(int slot, int arm, const double pose[16]);
+  // Copy the drawn arms into a GPU buffer
+  void upload();
+  // Draw bone of every drawn arm from its unit mesh - a bone mesh runs from
+  // the origin up +Y to 1, the head mesh is recorded around the wrist
+  void draw(const Mesh &mesh, int bone) const;
+
+  // Drill tip of arm, in its rover's coordinates
+  void tip(int arm, double p[3]) const;
+  int drawnCount() const;
+  // Center of the drawn arms' rovers at upload
+  void center(double c[3]) const;
+  // Milliseconds the last update took
+  double solveTime() const;
+  // SIMD instructions the solver uses
+  static const char *kernels();
+
+private:
+  // Arrays of the arms, each padded to a whole number of SIMD vectors
+  enum Field
+  {
+    ELBOW_X,
+    ELBOW_Y,
+    ELBOW_Z,
+    WRIST_X,
+    WRIST_Y,
+    WRIST_Z,
+    TARGET_X,
+    TARGET_Y,
+    TARGET_Z,
+    FIELD_COUNT
+  };
+
+  // What an arm is drawn from
+  struct Slot
+  {
+    float pose[16];
+    float elbow[3];
+    float wrist[3];
+  };
+
+  unsigned int seed;
+  int arms, stride;           // Arms and floats per field
+  std::vector<float> storage; // Every field, aligned for the kernels
+  std::vector<float> phase, rate;
+  // The chain at rest, rover coordinates, and where the drill can sample
+  double rest[3 * JOINT_COUNT];
+  double drop[3]; // Wrist to drill tip
+  double ground;
+  bool rigged;
+  double elapsed;
+
+  std::vector<Slot> slots;
+  unsigned int vbo;
+  float middle[3];
+
+  float *field(Field f);
+  const float *field(Field f) const;
+  void rig(const Rover &rover);
+  void aim(int first, int end, double now);
+};
+
+#endif
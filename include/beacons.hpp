@@ -0,0 +1,48 @@
+#ifndef BEACONS_HPP
+#define BEACONS_HPP
+
+#include <vector>
+#include "mesh.hpp"
+#include "instances.hpp"
+
+class Terrain;
+
+/*
+ *  Base-station lamps beside the rover's track
+ *  A fixed set of lamps is spread over a stretch of ground along +X. When
+ *  the rover has left a lamp behind it is placed again one stretch ahead,
+ *  seeded by the lap, so the same lamps always surround the rover. At night
+ *  every lamp is a point light, and the lamps are drawn as glowing balls
+ *  with one instanced call
+ */
+class Beacons
+{
+public:
+  Beacons(unsigned int seed, int count);
+
+  // Lamp count - every lamp is placed again at the next update
+  void resize(int count);
+  int count() const;
+
+  // Place the lamps the rover at distance has passed ahead of it - main thread only
+  void update(const Terrain &terrain, double distance);
+  // Add every lamp's light, relative to a rover at distance, see Lights::add
+  void addLights(double distance) const;
+
+  // Lamp ball and its instances, placed at world X
+  const Mesh &mesh() const;
+  const Instances &instances() const;
+
+private:
+  unsigned int seed;
+  std::vector<long> laps;        // Lap each lamp was placed in, NONE until placed
+  std::vector<float> x, y, z;    // World position of each lamp
+  std::vector<float> color;      // Three per lamp
+  Mesh ball;
+  Instances placed;
+  bool fresh; // Instances were never uploaded since the last resize
+
+  void place(const Terrain &terrain, int lamp, long lap);
+};
+
+#endif
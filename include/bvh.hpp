@@ -0,0 +1,60 @@
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include <vector>
+
+class Frustum;
+
+/*
+ *  Bounding volume hierarchy of world-space boxes
+ *  Objects are registered once with their box and get a handle. The tree is
+ *  built top-down by splitting at the median along the widest axis, moving
+ *  an object only refits the boxes above it, and culling walks the tree so a
+ *  subtree outside the frustum costs one test however many objects it holds
+ */
+class Bvh
+{
+public:
+  Bvh();
+
+  // Register an object and return its handle
+  int insert(const double lo[3], const double hi[3]);
+  // Give an object a new box
+  void move(int handle, const double lo[3], const double hi[3]);
+
+  // Mark the objects whose boxes reach into the frustum
+  void cull(const Frustum &frustum);
+  // Object was in the frustum at the last cull
+  bool visible(int handle) const;
+
+  // Counts from the last cull
+  int visibleCount() const;
+  int culledCount() const;
+
+private:
+  struct Box
+  {
+    double lo[3], hi[3];
+  };
+
+  struct Node
+  {
+    Box box;
+    int left, right;  // Children, -1 for a leaf
+    int first, count; // Objects of a leaf in order
+  };
+
+  static const int LEAF = 2; // Most objects in a leaf
+
+  std::vector<Box> boxes;     // Box of each object
+  std::vector<int> order;     // Objects grouped by leaf
+  std::vector<Node> nodes;    // Root first, children after their parent
+  std::vector<char> seen;     // Visibility of each object
+  bool rebuild, refit;        // Tree shape or boxes are out of date
+  int shown;
+
+  int build(int first, int count);
+  void walk(const Frustum &frustum, int node);
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef FLEET_HPP
+#define FLEET_HPP
+
+#include <vector>
+#include "arms.hpp"
+#include "instances.hpp"
+#include "renderqueue.hpp"
+
+class Terrain;
+class Rover;
+
+/*
+ *  Convoy of rovers driving alongside the one the camera follows
+ *  Every rover's pose, wheel roll and headlamp level is kept in separate
+ *  arrays, one entry per rover, and the worker pool steps them in blocks.
+ *  The rovers take slots in lanes across the track and rows ahead of and
+ *  behind the leader, drifting in their slot as they go. Only the rovers on
+ *  the streamed ground are drawn: their transforms are written into one
+ *  instance buffer per shared rover mesh, so the whole convoy takes the
+ *  same few draw calls however many rovers it has. Every rover's drill arm,
+ *  the leader's included, is animated and drawn by one set of arms
+ */
+class Fleet
+{
+public:
+  Fleet(unsigned int seed, int count);
+
+  // Rovers besides the leader - 0 for none
+  void resize(int count);
+  int count() const;
+
+  // Drive every rover to now (seconds) beside a leader at distance along X,
+  // lamps fading on at night, solve every drill arm and place the rovers on
+  // the ground - main thread only
+  void update(const Terrain &terrain, const Rover &rover, double now, double distance, bool isDay);
+  // Queue the rovers on the ground and the drill arms, the leader's too, the leader placed by model
+  void draw(RenderQueue &queue, const Rover &rover, bool isDay, const double model[16] = 0) const;
+  // Add the headlamp of every rover on the ground that has it on, see Lights::add
+  void addLights(const Rover &rover, const double model[16] = 0) const;
+
+  // Rovers drawn at the last update
+  int drawnCount() const;
+  // Drill arms of the leader (arm 0) and every other rover (arm i + 1)
+  const Arms &drillArms() const;
+  // Milliseconds the phases of the last update took - stepping every
+  // rover, writing the drawn ones' instances and uploading them
+  double stepTime() const;
+  double placeTime() const;
+  double uploadTime() const;
+
+private:
+  unsigned int seed;
+  // Fixed for each rover - its slot and how it drifts in it
+  std::vector<float> lane, row;          // Slot across and along the track
+  std::vector<float> phase, rate, sway;  // Drift along the track
+  std::vector<float> fade;               // Headlamp fade per second
+  // Stepped every update - the pose in the leader's coordinates, how far
+  // the wheels have rolled and how bright the headlamp is
+  std::vector<float> x, y, z;
+  std::vector<float> heading, pitch, roll;
+  std::vector<float> rolled;
+  std::vector<float> lamp;
+  std::vector<unsigned char> onGround;
+
+  std::vector<int> drawn, lit; // Rovers drawn and those with their beam on
+  Instances bodies, wheels, beams;
+  Arms arms;
+  double last; // Time of the last update, negative before the first
+  double steps, places, uploads;
+
+  void step(const Terrain &terrain, int first, int end, double now, double dt, double distance, bool isDay);
+  void pose(int rover, double m[16]) const;
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef FRUSTUM_HPP
+#define FRUSTUM_HPP
+
+/*
+ *  View frustum
+ *  The six clip planes come from projection * modelview, so the same test
+ *  works for gluPerspective and glOrtho cameras. It also knows where the eye
+ *  is and how many pixels a length covers, for picking levels of detail
+ */
+class Frustum
+{
+public:
+  // Frustum of the current GL projection, modelview and viewport
+  static Frustum current();
+  Frustum(const double projection[16], const double modelview[16], int viewportHeight);
+
+  // An axis-aligned box is inside or crosses the frustum
+  bool intersects(const double lo[3], const double hi[3]) const;
+  // Pixels a length covers at a distance from the eye - orthographic views ignore the distance
+  double pixels(double length, double distance) const;
+  bool orthographic() const;
+  // Eye position in the modelview's space
+  const double *eye() const;
+
+private:
+  double planes[6][4]; // a, b, c, d with the inside where ax + by + cz + d >= 0
+  double position[3];
+  double scale; // Pixels per unit length at distance 1, or anywhere when orthographic
+  bool ortho;
+};
+
+#endif
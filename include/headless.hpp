@@ -0,0 +1,23 @@
+#ifndef HEADLESS_HPP
+#define HEADLESS_HPP
+
+class Scene;
+
+/*
+ *  Offscreen rendering without a window
+ *  Renders into an EGL pbuffer (Mesa llvmpipe works) so the scene can be
+ *  benchmarked on machines without a display
+ */
+class Headless
+{
+public:
+  // Create and make current an offscreen context of width x height
+  static void createContext(int width, int height);
+  static void destroyContext();
+
+  // Drive Scene::idle and Scene::draw for a fixed number of frames and
+  // print the total time, mean FPS and frame time percentiles
+  static void run(Scene &scene, int frames);
+};
+
+#endif
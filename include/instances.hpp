@@ -0,0 +1,60 @@
+#ifndef INSTANCES_HPP
+#define INSTANCES_HPP
+
+#include <vector>
+
+class Mesh;
+
+/*
+ *  Per-instance transform buffer
+ *  One unit mesh is drawn once per instance in a single instanced call, each
+ *  instance carrying its model matrix, the matching normal matrix and the
+ *  texture region its coordinates map into
+ */
+class Instances
+{
+public:
+  Instances();
+
+  // Add an instance placed by m (column-major, like the fixed-function stack)
+  // textured from region of the bound texture (see Mesh::texRegion), or all of it
+  void add(const double m[16], const float region[4] = 0);
+  // Place instance i again
+  void set(int i, const double m[16], const float region[4] = 0);
+  // Keep count instances, the new ones placed at the origin
+  void resize(int count);
+  // Copy the instance transforms into a GPU buffer
+  void upload();
+  // Copy count instances from first into the buffer made by upload()
+  void upload(int first, int count);
+  // Draw mesh once per instance
+  void draw(const Mesh &mesh) const;
+  // Drop instances and the GPU buffer
+  void clear();
+
+  int count() const;
+  // Center of the bounding box of the instance origins at upload
+  void center(double c[3]) const;
+  // Bounding box of every instance of mesh
+  void bounds(const Mesh &mesh, double lo[3], double hi[3]) const;
+
+  // Instanced arrays and GLSL are available in this context
+  static bool supported();
+
+private:
+  struct Instance
+  {
+    float model[16];
+    float normal[9]; // Column-major like GLSL mat3
+    float region[4]; // s, t, width, height
+  };
+
+  static void fill(Instance &instance, const double m[16], const float region[4]);
+  void measure();
+
+  std::vector<Instance> instances;
+  unsigned int vbo;
+  float middle[3];
+};
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef LIGHTS_HPP
+#define LIGHTS_HPP
+
+#include <string>
+
+/*
+ *  Scene lights for the GLSL lighting path
+ *  Lights are plain data collected every frame, so a light costs a few
+ *  floats rather than a fixed-function light slot and its glLight calls.
+ *  Lighting is evaluated per pixel with clustered forward shading: the view
+ *  is cut into froxels (screen tiles by depth slices) and the worker pool
+ *  bins every light reaching a froxel into its list, so a fragment only
+ *  evaluates the lights near it. Directional and unattenuated lights reach
+ *  everything and stay in a small uniform buffer that every lit program
+ *  reads, the binned lights and the lists go to float textures. Without
+ *  float textures every light goes to the uniform buffer, and without
+ *  uniform buffers its data is copied into each program when it changes.
+ *  One global light can be shadowed by the cascaded depth maps of Shadows
+ */
+class Lights
+{
+public:
+  static const int MAX_LIGHTS = 4096;
+  static const int MAX_CASCADES = 4;
+  // Texture unit of the first cascade's depth map, the others follow
+  static const int SHADOW_UNIT = 5;
+
+  struct Light
+  {
+    float position[4];    // w = 0 for a direction towards the light
+    float ambient[3];
+    float diffuse[3];
+    float specular[3];
+    float attenuation[3]; // Constant, linear and quadratic
+    float direction[3];   // Spotlight axis
+    float cutoff;         // Spotlight half angle in degrees, 180 for none
+    float exponent;       // Spotlight falloff
+  };
+
+  // Start collecting a frame's lights for the current projection and
+  // viewport - like glLightfv, positions and directions are taken in the
+  // coordinates of the current modelview
+  static void begin();
+  // Add a light, false once there is no room for it - shadow it when it
+  // reaches everything and is the first such light added with shadow
+  static bool add(const Light &light, bool shadow = false);
+  // Cascades shadowing that light from the next upload on: the eye depth
+  // each ends at, the offset along the normal it is looked up from, its eye
+  // to depth map matrix (16 floats each) and the size of a depth map texel
+  static void shadow(int cascades, const float ends[], const float offsets[], const float matrices[], float texel);
+  // Ambient light on everything lit, whatever the lights
+  static void setAmbient(float r, float g, float b);
+  // Bin the collected lights and write them out - once per frame, before drawing
+  static void upload();
+
+  // Lights added this frame
+  static int count();
+  // Binned lights per froxel from the last upload - mean over the froxels any light reaches
+  static double clusterAverage();
+  static int clusterMaximum();
+  // Milliseconds the last binning took
+  static double binTime();
+
+  // Lighting on or off for the draws that follow
+  static void enable(bool on);
+  static bool enabled();
+
+  // GLSL source starting a fragment shader - version, light data and
+  // vec4 shade(vec3 eye, vec3 normal, vec4 color) with glColor as the
+  // ambient and diffuse material
+  static const std::string &source();
+  // Whole fragment shader for lit draws - source() and a main() shading the
+  // eye, normal and color varyings, with the texture behind the textured
+  // and replace uniforms modulating or replacing the result
+  static const std::string &fragmentSource();
+  // Connect a program using source() to the lights and set its lighting switch
+  static void apply(unsigned int program);
+};
+
+#endif
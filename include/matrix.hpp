@@ -0,0 +1,27 @@
+#ifndef MATRIX_HPP
+#define MATRIX_HPP
+
+// 4x4 matrices stored column-major, the same layout OpenGL uses
+class Matrix
+{
+public:
+  static void identity(double m[16]);
+  static void multiply(double out[16], const double a[16], const double b[16]);
+  // Inverse of m, false when m has none
+  static bool invert(double out[16], const double m[16]);
+
+  // Post-multiply like glTranslated/glRotated/glScaled
+  static void translate(double m[16], double x, double y, double z);
+  static void rotate(double m[16], double angle, double x, double y, double z);
+  static void scale(double m[16], double x, double y, double z);
+  // Place the unit segment along +Y from start to end, scaled by width across
+  // it - the shortest turn from +Y, built from the direction without trig
+  static void segment(double m[16], const double start[3], const double end[3], double width);
+
+  static void transformPoint(const double m[16], const double in[3], double out[3]);
+  // Normal matrix stored row by row
+  static void normalMatrix(const double m[16], double n[9]);
+  static void transformNormal(const double m[16], const double in[3], double out[3]);
+};
+
+#endif
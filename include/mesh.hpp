@@ -0,0 +1,91 @@
+#ifndef MESH_HPP
+#define MESH_HPP
+
+#include <cstddef>
+#include <vector>
+
+/*
+ *  Retained-mode triangle/line mesh
+ *  Geometry is recorded once through an immediate-mode style interface
+ *  (begin/vertex/end plus a matrix stack) and then uploaded to vertex and
+ *  index buffers so it can be drawn with a couple of glDrawElements calls
+ */
+class Mesh
+{
+public:
+  Mesh();
+
+  // Recording - mirrors glBegin/glEnd so build code reads the same
+  void begin(unsigned int mode);
+  void end();
+  void color(float r, float g, float b, float a = 1.0f);
+  void normal(double x, double y, double z);
+  void texCoord(double s, double t);
+  void vertex(double x, double y, double z);
+  void setLineWidth(float width);
+  // Rectangle of the bound texture that recorded and appended coordinates
+  // map into - s, t of its corner then width, height (see Textures::atlas)
+  void texRegion(const float region[4]);
+  // Record another mesh through the current transform and color
+  void append(const Mesh &other);
+
+  // Transform applied to recorded vertices - mirrors the fixed-function matrix stack
+  void pushMatrix();
+  void popMatrix();
+  void translate(double x, double y, double z);
+  void rotate(double angle, double x, double y, double z);
+  void scale(double x, double y, double z);
+  void multMatrix(const double m[16]);
+
+  // Copy recorded data into GPU buffers
+  void upload();
+  // Draw uploaded buffers
+  void draw() const;
+  // Draw uploaded buffers count times, see Instances
+  void drawInstanced(int count) const;
+  // Drop recorded data and GPU buffers
+  void clear();
+
+  bool empty() const;
+  int triangleCount() const;
+  // Per-vertex colors were recorded, so drawing replaces the current color
+  bool hasColors() const;
+  // Center of the bounding box of the uploaded vertices
+  void center(double c[3]) const;
+  // Bounding box of the uploaded vertices
+  void bounds(double lo[3], double hi[3]) const;
+
+private:
+  struct Vertex
+  {
+    float position[3];
+    float normal[3];
+    float texCoord[2];
+    unsigned char color[4];
+  };
+
+  struct Transform
+  {
+    double m[16];
+  };
+
+  void drawElements(unsigned int primitive, int indices, int offset, int count) const;
+
+  std::vector<Vertex> vertices;
+  std::vector<unsigned int> triangles;
+  std::vector<unsigned int> lines;
+  std::vector<Transform> stack;
+
+  Vertex current;     // Current normal, texture coordinate and color
+  float region[4];    // Texture rectangle coordinates are mapped into
+  unsigned int mode;  // Primitive being recorded
+  size_t first;       // First vertex of the primitive being recorded
+  float lineWidth;    // Width used for line primitives
+  bool colored;       // Per-vertex colors were recorded, otherwise the current GL color is used
+
+  unsigned int vbo, ibo;
+  int triangleIndices, lineIndices;
+  float lower[3], upper[3]; // Bounding box at upload
+};
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef PARTICLES_HPP
+#define PARTICLES_HPP
+
+#include <stdint.h>
+#include <vector>
+
+/*
+ *  Particle system for wheel dust and drill debris
+ *  Each emitter owns a stream of particles kept as separate arrays of
+ *  positions, velocities, lifetimes and sizes. Every frame the streams are
+ *  shared out over the worker pool: new particles are emitted, SIMD kernels
+ *  (AVX2 or SSE when the CPU has them) integrate the stream and drop the
+ *  expired particles, and the survivors are written straight into a
+ *  persistently mapped vertex buffer. Every stream is then drawn as point
+ *  sprites in one call
+ */
+class Particles
+{
+public:
+  enum Kind
+  {
+    DUST,  // Kicked up by a wheel, drifts and settles
+    DEBRIS // Thrown out by the drill, falls and bounces
+  };
+
+  static const int CAPACITY; // Particles one emitter can have alive
+
+  Particles();
+
+  // Emit kind from a point on the rover, in its coordinates - returns the emitter
+  int addEmitter(Kind kind, const double origin[3]);
+  // Emit from origin from now on, for a point that moves on the rover
+  void moveEmitter(int emitter, const double origin[3]);
+
+  // Advance to now (seconds) for a rover at distance along X and stream the
+  // particles into the buffer - main thread only
+  void update(double now, double distance);
+  // Draw the streamed particles, placed at world X, with the current modelview
+  void draw() const;
+
+  // Live particles
+  int count() const;
+  // Center of the emitters at the last update
+  void center(double c[3]) const;
+  // Milliseconds the last update took
+  double updateTime() const;
+  // SIMD instructions the kernels use
+  static const char *kernels();
+
+private:
+  // Arrays of a stream, each CAPACITY floats
+  enum Field
+  {
+    X,
+    Y,
+    Z,
+    VX,
+    VY,
+    VZ,
+    LIFE,
+    SIZE,
+    FIELD_COUNT
+  };
+
+  struct Stream
+  {
+    Kind kind;
+    float origin[3];
+    std::vector<float> storage; // Every field, aligned for the kernels
+    int count;
+    double owed;     // Particles due but not emitted yet
+    uint32_t random; // Emission random state
+    float *field(Field f);
+  };
+
+  // What a point sprite is drawn from
+  struct Vertex
+  {
+    float position[3];
+    float size;
+    unsigned char color[4];
+  };
+
+  static const int SECTIONS = 3; // Frames the GPU may still be reading
+
+  std::vector<Stream> streams;
+  double last;      // Time of the last update, negative before the first
+  double travelled; // Rover distance at the last update
+  double elapsed;   // Milliseconds the last update took
+  float middle[3];
+
+  unsigned int vbo;
+  Vertex *mapped;              // Persistently mapped buffer, 0 when copying
+  std::vector<Vertex> staging; // Copy uploaded when the buffer can't be mapped
+  int section;                 // Section of the buffer written last
+  mutable void *fences[SECTIONS];
+  std::vector<int> firsts, counts; // Ranges drawn, one per stream
+
+  void create();
+  void step(Stream &stream, float dt, double distance, double moved, Vertex *out);
+  void emit(Stream &stream, int n, double distance, double moved);
+};
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef PRIMITIVES_HPP
+#define PRIMITIVES_HPP
+
+#include <vector>
+
+class Mesh;
+
+/*
+ *  Shared unit primitives
+ *  Each shape is tessellated once per tessellation level, uploaded, and then
+ *  reused through transforms (glScaled for drawing, Mesh::append for baking)
+ */
+class Primitives
+{
+public:
+  // Radius 1 sphere at the origin, inc is the latitude/longitude step in degrees
+  static const Mesh &sphere(double inc = 10.0);
+  // Radius 1 open tube along +Y from y=0 to y=1
+  static const Mesh &tube(int segments = 36);
+  // Radius 1 disc at y=0 facing +Y (or -Y when down is set)
+  static const Mesh &cap(int segments = 36, bool down = false);
+  // Tube closed with a cap at each end
+  static const Mesh &cylinder(int segments = 36);
+  // Apex at the origin opening towards -Y with a radius 1 base at y=-1
+  static const Mesh &cone(int segments = 36);
+
+  // Record the same shapes into a mesh without caching or uploading
+  static void buildSphere(Mesh &mesh, double inc);
+  static void buildTube(Mesh &mesh, int segments);
+  static void buildCap(Mesh &mesh, int segments, bool down);
+  static void buildCylinder(Mesh &mesh, int segments);
+  static void buildCone(Mesh &mesh, int segments);
+
+  // Cosine/sine pairs for segments+1 points around the unit circle
+  static const std::vector<double> &circle(int segments);
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <stdio.h>
+
+/*
+ *  Per-pass CPU and GPU frame timing
+ *  CPU time comes from the monotonic clock, GPU time from a ring of
+ *  GL_TIME_ELAPSED queries read back a few frames late so nothing stalls
+ */
+class Profiler
+{
+public:
+  enum Pass
+  {
+    FLEET,
+    SHADOWS,
+    LIGHTING,
+    CULLING,
+    ENVIRONMENT,
+    ROVER,
+    PARTICLES,
+    RENDER,
+    HUD,
+    PASS_COUNT
+  };
+
+  Profiler();
+
+  void beginFrame();
+  void endFrame();
+  void begin(Pass pass);
+  void end(Pass pass);
+
+  // Draw the min/avg/max table from y pixels up on the left and the frame time graph
+  void draw(int width, int height, int y) const;
+  void toggle();
+  bool isVisible() const;
+
+  // Print the average of every pass
+  void report(FILE *out) const;
+
+private:
+  static const int HISTORY = 120; // Frames kept for the rolling statistics
+  static const int LATENCY = 4;   // Frames before a GPU query is read back
+
+  struct Stats
+  {
+    double samples[HISTORY];
+    int count, next;
+    void add(double ms);
+    void summary(double &min, double &avg, double &max) const;
+  };
+
+  Stats cpu[PASS_COUNT], gpu[PASS_COUNT];
+  Stats frameTimes; // CPU time of whole frames for the graph
+  unsigned int queries[LATENCY][PASS_COUNT];
+  bool issued[LATENCY][PASS_COUNT];
+  double passStart[PASS_COUNT];
+  double frameStart;
+  int frame;
+  bool gpuTimers;
+  bool visible;
+
+  void collect(int slot);
+};
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef RENDERQUEUE_HPP
+#define RENDERQUEUE_HPP
+
+#include <stdint.h>
+#include <vector>
+
+class Mesh;
+class Instances;
+class Terrain;
+class Particles;
+class Arms;
+
+/*
+ *  Sorted render queue
+ *  Draws are submitted with a material and sorted by a 64-bit key before
+ *  anything reaches OpenGL: opaque draws by shader, material and texture
+ *  then front to back, blended draws back to front. Flushing only issues
+ *  the state that differs from the previous draw
+ */
+class RenderQueue
+{
+public:
+  // Fixed-function state a draw needs
+  struct Material
+  {
+    int texture;        // Textures handle, -1 for untextured
+    bool lit;           // Lit while the scene has lighting on
+    bool blend;         // Alpha blended, drawn after the opaque draws
+    float color[4];     // Used by meshes without colors of their own
+    float shininess;
+    float specular[4];
+    float emission[4];
+  };
+
+  RenderQueue();
+
+  // Register a material and return its id - the same material gets the same id
+  int material(const Material &m);
+
+  // Queue a mesh placed by model (as recorded when 0), with its texture
+  // coordinates shifted by texOffset (none when 0)
+  void submit(int material, const Mesh &mesh, const double model[16] = 0, const float texOffset[2] = 0);
+  // Queue an instanced draw of a unit mesh, every instance placed by model as well
+  void submit(int material, const Mesh &mesh, const Instances &instances, const double model[16] = 0);
+  // Queue the terrain nodes selected for this view
+  void submit(int material, const Terrain &terrain);
+  // Queue the live particles placed by model - they color themselves
+  void submit(int material, const Particles &particles, const double model[16] = 0);
+  // Queue one bone of every drawn arm from its unit mesh, every arm placed by model as well
+  void submit(int material, const Mesh &mesh, const Arms &arms, int bone, const double model[16] = 0);
+
+  // Sort and draw everything queued since the last flush with the current
+  // modelview as the camera - lit materials are drawn unlit without lighting
+  void flush(bool lighting);
+  // Draw the opaque geometry queued since the last flush into the depth
+  // buffer only, in submission order with the current modelview, and drop everything queued
+  void flushDepth();
+
+  // Counts from the last flush
+  int drawCalls() const;
+  int stateChanges() const;
+
+private:
+  struct Draw
+  {
+    uint64_t key;
+    int material;
+    const Mesh *mesh;
+    const Instances *instances;
+    const Terrain *terrain;
+    const Particles *particles;
+    const Arms *arms;
+    int bone;
+    int transform; // Index into transforms, -1 for none
+    float texOffset[2];
+    bool shifted;
+  };
+
+  std::vector<Material> materials;
+  std::vector<Draw> draws;
+  std::vector<double> transforms;
+  int calls, changes;
+
+  void add(int material, const Mesh *mesh, const Instances *instances, const double model[16], const float texOffset[2]);
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef ROCKFIELD_HPP
+#define ROCKFIELD_HPP
+
+#include <vector>
+#include "mesh.hpp"
+#include "instances.hpp"
+
+class Terrain;
+
+/*
+ *  Field of rocks scattered beside the rover's track
+ *  Rocks live in a fixed pool stored as arrays of positions, sizes and
+ *  rotations. The pool is cut into strips across the track that form a
+ *  ring along +X like the terrain columns: when the rover has left a strip
+ *  behind, its rocks are placed again in the strip coming into range ahead
+ *  and only their instances are uploaded. Rocks are chained into a spatial
+ *  hash of ground cells for neighbor queries, and each rock mesh variant is
+ *  drawn with one instanced call whatever the number of rocks
+ */
+class RockField
+{
+public:
+  static const int VARIANTS = 3; // Rock meshes
+
+  RockField(unsigned int seed, int capacity);
+
+  // Pool size, rounded to whole strips - every rock is placed again at the next update
+  void resize(int capacity);
+  int count() const;
+
+  // Move the ring to the rover's distance along X and place the rocks of
+  // the strips that came into range on the terrain - main thread only
+  void update(const Terrain &terrain, double distance);
+
+  // Rock meshes and their instances, placed at world X
+  const Mesh &mesh(int variant) const;
+  const Instances &instances(int variant) const;
+  // Box around every rock, relative to a rover at distance
+  void bounds(double distance, double lo[3], double hi[3]) const;
+
+  // Rocks within radius of world x, z on the ground, their indices added to found
+  int query(double x, double z, double radius, std::vector<int> *found = 0) const;
+  // World position of a rock's center on the ground
+  void position(int rock, double p[3]) const;
+  // Rocks placed again at the last update
+  int recycled() const;
+
+private:
+  static const int STRIPS = 29; // Ring length along X
+
+  unsigned int seed;
+  int perStrip;        // Rocks in a strip, a multiple of VARIANTS
+  long first;          // First strip column in range
+  long columns[STRIPS]; // Column each strip holds, NONE until placed
+  float low[STRIPS], high[STRIPS]; // Height range of each strip's rocks
+  int moved;
+
+  // One entry per rock - strip by strip, the variants taking turns
+  std::vector<float> x, z, y, size, yaw;
+
+  // Spatial hash - the first rock of each bucket and the next one in its chain
+  std::vector<int> heads, next;
+  unsigned int mask;
+
+  Mesh meshes[VARIANTS];
+  Instances placed[VARIANTS];
+  bool fresh; // Instances were never uploaded since the last resize
+
+  int bucket(double x, double z) const;
+  void link(int rock);
+  void unlink(int rock);
+  bool crowded(double x, double z, double radius) const;
+  void place(const Terrain &terrain, int strip, long column);
+};
+
+#endif
@@ -1,31 +1,116 @@
 #ifndef ROVER_HPP
 #define ROVER_HPP
 
+#include <vector>
+#include "mesh.hpp"
+#include "instances.hpp"
+#include "renderqueue.hpp"
+#include "lights.hpp"
+
+class Arms;
+
 class Rover
 {
 public:
   Rover();
-  void draw(bool isDay);
+  // Add the headlamp of the rover placed by model to the frame's lights - it
+  // lights the ground even when the rover is out of view
+  void setupHeadlamp(bool isDay, const double model[16] = 0);
+  // Queue every part but the drill arm (see drawArms), placed by model
+  void draw(RenderQueue &queue, bool isDay, const double model[16] = 0);
+  // Queue a fleet of rovers - every fixed part placed by bodies in one
+  // mesh, the wheels by wheels and at night the beams by beams, all placed by model
+  void drawFleet(RenderQueue &queue, const Instances &bodies, const Instances &wheels, const Instances &beams, bool isDay,
+                 const double model[16] = 0) const;
+  // Queue the drill arms of a fleet, every drawn arm placed by model
+  void drawArms(RenderQueue &queue, const Arms &arms, const double model[16] = 0) const;
+  // Write the instances of a fleet rover in slot - placed by pose with its
+  // wheels rolled forward by rolled units - safe on the worker threads
+  void place(int slot, const double pose[16], double rolled, Instances &bodies, Instances &wheels) const;
+  // Headlamp of a rover placed by pose, in the coordinates pose maps into
+  Lights::Light headlamp(const double pose[16]) const;
+  // Bounding box of every part, beam and the arm's reach included
+  void bounds(double lo[3], double hi[3]) const;
 
-  // Load textures
-  void loadTextures();
+  // Where each wheel touches the ground and the drill bit ends at rest, in
+  // rover coordinates - known once the meshes are built
+  int wheelCount() const;
+  void wheelContact(int wheel, double p[3]) const;
+  void drillTip(double p[3]) const;
+  // Drill arm at rest - shoulder, elbow and wrist, see Arms - and the drill
+  // tip, and the height of the ground under the wheels, in rover coordinates
+  void armRest(double joints[9], double tip[3]) const;
+  double groundHeight() const;
+
+  // Load textures and register the rover's materials
+  void loadTextures(RenderQueue &queue);
 
 private:
   double size;
   double bodyPlacementHeight;
 
-  int bodyTexture, supportTexture, wheelTexture, drillTexture, drillBitTexture;
+  // Every material is a region of one atlas texture
+  enum Material
+  {
+    BODY,
+    SUPPORT,
+    WHEEL,
+    DRILL,
+    DRILL_BIT,
+    MATERIAL_COUNT
+  };
+  int atlas;
+  float regions[MATERIAL_COUNT][4];
+  int partMaterial, lensMaterial, beamMaterial; // Render queue materials
+
+  // Cached geometry - one mesh for the whole body plus the lens and night beam
+  Mesh bodyMesh, lensMesh, beamMesh;
+  // Every part but the wheels and the drill arm in one mesh, for drawing many rovers at once
+  Mesh fleetMesh;
+  // The drill arm's bone and the drill head hung from its wrist, bent into place by Arms
+  Mesh armMesh, drillHeadMesh;
+  double lensPosition[3];
+  double drillBitEnd[3];
+  std::vector<double> wheelCenters; // x, y, z of every wheel
+
+  // Strut table - the shared unit cylinder stretched between two points in
+  // rover coordinates, with the transform computed once when the meshes are
+  // built, in the order of the cylinder's instances
+  struct Strut
+  {
+    double start[3], end[3];
+    double radius;
+    Material material;
+    double transform[16];
+  };
+  std::vector<Strut> struts;
+
+  // Repeated parts - a shared unit mesh drawn once with per-instance transforms and regions
+  struct Part
+  {
+    const Mesh *mesh;
+    Instances instances;
+  };
+  std::vector<Part> parts;
+  Mesh wheelMesh;
+
+  void buildMeshes();
+  Mesh &batch(Material material);
+  Instances &part(const Mesh &mesh);
+  void placeStruts();
 
   void buildBody();
   void buildSupports();
   void buildWheels();
-  void buildCamera(bool isDay);
+  void buildCamera();
   void buildArmDrill();
   void buildRearPowerSource();
 
-  // Drawing methods
-  void drawSupport(double radius, const double start[3], const double end[3], int texture);
-  void drawWheel(double radius, double height);
+  // Recording methods
+  void drawSupport(double radius, const double start[3], const double end[3], Material material);
+  void drawHeadPart(double radius, const double start[3], const double end[3], Material material);
+  void drawWheel(Mesh &m, double radius, double height);
+  void placeWheel(double x, double y, double z);
 };
 
 #endif
\ No newline at end of file
@@ -1,6 +1,21 @@
 #ifndef SCENE_HPP
 #define SCENE_HPP
 
+#include "profiler.hpp"
+#include "simulation.hpp"
+#include "mesh.hpp"
+#include "renderqueue.hpp"
+#include "terrain.hpp"
+#include "rockfield.hpp"
+#include "beacons.hpp"
+#include "fleet.hpp"
+#include "rover.hpp"
+#include "scenegraph.hpp"
+#include "particles.hpp"
+#include "shadows.hpp"
+#include "frustum.hpp"
+#include "bvh.hpp"
+
 class Scene
 {
 public:
@@ -11,15 +26,67 @@ public:
   void special(int key, int x, int y);
   void reshape(int width, int height);
   void loadTextures();
+  // Rocks in the field, set before loadTextures
+  void setRockCount(int count);
+  // Base-station lamps lit at night, set before loadTextures
+  void setLightCount(int count);
+  // Rovers driving in the convoy, the one the camera follows included
+  void setRoverCount(int count);
+
+  // Step the world on its own thread instead of from idle()
+  void startSimulationThread();
+
+  // Per-pass frame timings
+  const Profiler &timings() const;
+  // Draw call and state change counts of the last frame
+  const RenderQueue &renderQueue() const;
+  // Visible and culled object counts of the last frame
+  const Bvh &objects() const;
+  // Wheel dust and drill debris of the last frame
+  const Particles &particleSystem() const;
+  // Sun shadow cascades of the last frame
+  const Shadows &shadowMaps() const;
+  // The convoy's other rovers at the last frame
+  const Fleet &rovers() const;
+  // Transforms of everything placed in the world, updated once per frame
+  const SceneGraph &transforms() const;
 
 private:
   double dim; //  Size of world
   int res;    //  Resolution
   int fov;    //  Field of view (for perspective)
   double asp; //  Aspect ratio
+  int width, height; // Window size in pixels
 
   int groundTexture, mountainTexture; // Ground texture
 
+  // Everything in the world is drawn through the queue
+  RenderQueue queue;
+  Rover rover; // The rover the camera follows
+  Mesh mountainMesh;
+  Terrain terrain; // Ground chunks streamed in around the rover
+  RockField rocks; // Rocks recycled from behind the rover to ahead of it
+  Beacons beacons; // Lamps beside the track, recycled like the rocks
+  Fleet fleet;     // Rovers driving alongside the one the camera follows
+  Particles particles; // Dust behind the wheels and debris around the drill
+  int debrisEmitter;   // Moved to the leader's drill tip every frame
+  Shadows shadows;     // The sun's cascaded depth maps
+  int sunMaterial, groundMaterial, mountainMaterial, rockMaterial, beaconMaterial, particleMaterial;
+
+  // Where everything is placed - the rover and its convoy, the ground
+  // sliding back under it, the sun and the first person camera. Nodes are
+  // only recomputed when they or their parents move
+  SceneGraph graph;
+  int roverNode, groundNode, sunNode, sunBallNode, cameraNode;
+  int zh;         // Sun azimuth in degrees
+  double eye[3];  // First person camera position
+  double angle;   // First person heading in radians, 0 looks along -Z
+
+  // Everything but the terrain is culled through the hierarchy
+  Bvh bvh;
+  int sunObject, mountainObject, rockObject, roverObject;
+  float sun[4]; // Light position the sun ball is drawn at
+
   bool isDay;       // Day or night
   int th, ph;       //  Azimuth, elevation angle
   bool showAxes;    //  Toggle for axis display
@@ -31,9 +98,20 @@ private:
   bool light; // Lighting
   bool spin;  // Spin light
 
+  Profiler profiler; // Timing overlay
+
+  Simulation simulation; // Fixed-timestep world state
+
   void drawAxes();
-  void drawInfo();
-  void drawEnviroment();
+  void drawInfo(const Simulation::State &world);
+  void buildEnvironment();
+  void registerObjects();
+  void cull(const Frustum &frustum, const Simulation::State &world);
+  void drawEnviroment(const Simulation::State &world, const Frustum &frustum);
+  void drawShadows(const Simulation::State &world);
+
+  void placeCamera();
+  void placeWorld(const Simulation::State &world);
 
   void resetAngles();
   void adjustAngles(int th, int ph);
@@ -45,8 +123,6 @@ private:
   void toggleLightSpin();
 
   void project();
-
-  void resetRock();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,47 @@
+#ifndef SCENEGRAPH_HPP
+#define SCENEGRAPH_HPP
+
+#include <vector>
+
+/*
+ *  Transform hierarchy kept as flat arrays in hierarchy order
+ *  A node is always added after its parent, so one pass from the front
+ *  finds every parent's world matrix ready before its children need it.
+ *  Placing a node marks it dirty and the pass only recomputes the world
+ *  matrices of dirty nodes and the nodes below them - a subtree that did
+ *  not move costs a flag test per node
+ */
+class SceneGraph
+{
+public:
+  // Node everything else hangs from, placed at the origin
+  static const int ROOT = 0;
+
+  SceneGraph();
+
+  // Add a node under parent, placed in it by local or at its origin - returns the node
+  int add(int parent, const double local[16] = 0);
+  // Place a node in its parent - placing it where it already is leaves it clean
+  void place(int node, const double local[16]);
+  void place(int node, double x, double y, double z);
+
+  // Recompute the world matrices of the nodes that moved and of everything below them
+  void update();
+
+  int count() const;
+  int parent(int node) const;
+  const double *local(int node) const;
+  // Node to world, as of the last update
+  const double *world(int node) const;
+  // World matrices the last update recomputed
+  int updatedCount() const;
+
+private:
+  std::vector<int> parents;
+  std::vector<double> locals, worlds; // 16 per node, column-major
+  std::vector<unsigned char> dirty;
+  bool moved; // Some node was placed since the last update
+  int updated;
+};
+
+#endif
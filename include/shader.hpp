@@ -0,0 +1,21 @@
+#ifndef SHADER_HPP
+#define SHADER_HPP
+
+/*
+ *  GLSL program helpers
+ *  Programs run in the compatibility profile so they read the same
+ *  fixed-function matrices and materials as the rest of the scene, lights
+ *  come from Lights
+ */
+class Shader
+{
+public:
+  // Compile and link a program, attributes[i] is bound to locations[i]
+  static unsigned int program(const char *name, const char *vert, const char *frag,
+                              int attributeCount = 0, const char *const attributes[] = 0, const int locations[] = 0);
+
+  // Connect a program to the lights and copy the texture mode into its uniforms
+  static void setFixedState(unsigned int program);
+};
+
+#endif
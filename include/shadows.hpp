@@ -0,0 +1,79 @@
+#ifndef SHADOWS_HPP
+#define SHADOWS_HPP
+
+/*
+ *  Cascaded shadow maps for the sun
+ *  The view's depth over the shadowed ground is cut into CASCADES ranges,
+ *  each covered by an orthographic depth map seen from the sun. A cascade's
+ *  box is fixed in world coordinates and snapped to a coarse grid, and the
+ *  sun's direction only moves in steps, so while both stay put the depth of
+ *  the static geometry is kept in a cache and only the dynamic casters are
+ *  drawn over a copy of it. Stale caches are redrawn one per frame, oldest
+ *  first, and the farther cascades take their dynamic casters every second
+ *  and fourth frame
+ */
+class Shadows
+{
+public:
+  static const int CASCADES = 3;
+  static const int SIZE = 1024; // Depth map texels across
+
+  Shadows();
+
+  // Fit the cascades to the current projection and modelview for a sun in
+  // direction (towards it) and a rover at distance along X, shadowing the
+  // box lo, hi in the rover's coordinates
+  void fit(const double direction[3], double distance, const double lo[3], const double hi[3]);
+  // The static geometry changed - every cache is redrawn in turn, the old ones are used until then
+  void invalidate();
+
+  // Cascade whose static cache is redrawn this frame, and whose dynamic casters are
+  bool cacheDue(int cascade) const;
+  bool castersDue(int cascade) const;
+  // Draw into a cascade's cache, or its casters over a copy of the cache,
+  // with a projection and modelview placing the rover's coordinates in its map
+  void begin(int cascade, bool cache);
+  void end();
+
+  // Hand the cascades of the last fit to the lights, none without one - before Lights::upload
+  void apply();
+
+  // Cascades in use and the maps drawn at the last fit
+  int cascadeCount() const;
+  int cachesDrawn() const;
+  int castersDrawn() const;
+
+  // Depth textures and framebuffer objects are available in this context
+  static bool supported();
+
+private:
+  struct Cascade
+  {
+    double light[16];  // World to light clip coordinates the maps were drawn with
+    double wanted[16]; // The same for this frame's view
+    long key[6];       // Sun step, box size and grid cell the maps were drawn for
+    long wantedKey[6];
+    bool drawn;    // The cache holds something
+    int staleSince; // Frame the cache stopped matching the view, -1 while it matches
+    bool cacheDue, castersDue;
+    float end;    // Eye depth the cascade ends at
+    float offset; // Lookup offset along the normal
+    unsigned int map, cache;
+    unsigned int mapFbo, cacheFbo;
+  };
+
+  Cascade cascades[CASCADES];
+  int count;    // Cascades fitted this frame, 0 when there is nothing to shadow
+  bool fitted;  // fit() was called since the last apply()
+  int frame;
+  double sun[3]; // Direction the maps are drawn from
+  long step;     // Bumped whenever the sun's direction moves a step
+  double view[16];
+  double distance;
+  int caches, casters;
+  int saved; // Framebuffer bound before begin()
+
+  void create();
+};
+
+#endif
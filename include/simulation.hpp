@@ -0,0 +1,65 @@
+#ifndef SIMULATION_HPP
+#define SIMULATION_HPP
+
+#include <atomic>
+#include <thread>
+
+/*
+ *  Fixed-timestep world simulation
+ *  The world advances in constant steps whatever the frame rate, and the
+ *  renderer interpolates between the last two steps. Steps either run from
+ *  advance() on the render thread or on their own thread, handing states to
+ *  the renderer through a lock-free triple buffer
+ */
+class Simulation
+{
+public:
+  // World state advanced by each step
+  struct State
+  {
+    double travelled; // Distance the rover has driven along X
+  };
+
+  static const double STEP;  // Seconds per step
+  static const double SPEED; // World units the rover drives per step
+
+  Simulation();
+  ~Simulation();
+
+  // Run the steps due by now (seconds) on the calling thread
+  void advance(double now);
+  // Run the steps on a separate thread until stop() or destruction
+  void start();
+  void stop();
+  bool threaded() const;
+
+  // State at now (seconds) interpolated between the last two steps
+  State sample(double now);
+
+private:
+  struct Snapshot
+  {
+    State previous, current;
+    double stamp; // Real time current was reached
+  };
+
+  State state;        // Owned by whichever thread steps
+  double accumulator; // Real time not yet simulated
+  double lastTime;    // Time of the last advance
+
+  // Triple buffer - the writer fills back, then swaps it with middle
+  // flagged as fresh, the reader swaps front with middle when it is fresh
+  static const int FRESH = 4;
+  Snapshot buffers[3];
+  std::atomic<int> middle;
+  int back, front;
+
+  std::thread worker;
+  std::atomic<bool> running;
+
+  void step();
+  void publish(const State &previous, double stamp);
+  void run();
+};
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef TERRAIN_HPP
+#define TERRAIN_HPP
+
+#include <atomic>
+#include <vector>
+#include "mesh.hpp"
+
+class Frustum;
+
+/*
+ *  Endless procedural ground
+ *  The world is cut into fixed-size square chunks whose heights come from
+ *  seeded value noise, so any chunk can be rebuilt at any time. A ring of
+ *  chunk columns follows the rover along +X: columns coming into range are
+ *  generated on the worker pool, copied once into a ring heightmap texture
+ *  when they are ready, and their slot is reused for the next column ahead
+ *  once the rover has left them behind. Memory stays the same however far
+ *  the rover drives.
+ *
+ *  Each chunk is the root of a quadtree (CDLOD). Every frame the nodes are
+ *  picked by screen-space error and culled against the view frustum, then
+ *  drawn as instances of one small grid that a vertex shader lifts from the
+ *  heightmap. Vertices morph into the coarser level as they near the
+ *  distance where it takes over, so levels change without popping
+ */
+class Terrain
+{
+public:
+  static const double SIZE; // Chunk edge in world units
+  static const int DEPTH;   // Quadtree levels below a chunk
+  static const int CELLS;   // Grid quads along a node edge
+
+  explicit Terrain(unsigned int seed);
+
+  // Ground height at world x, z - flat along the rover's track
+  double height(double x, double z) const;
+
+  // Move the ring to the rover's distance along X, start the chunks that
+  // came into range and upload the finished ones - main thread only
+  void update(double distance);
+  // Block until every chunk in range is uploaded
+  void finish();
+
+  // Pick the quadtree nodes to draw in this view of a rover at distance
+  void select(const Frustum &frustum, double distance);
+  // Draw the selected nodes with the current color, material and texture
+  void draw() const;
+  // Center of the selected nodes on the ground plane
+  void center(double c[3]) const;
+
+  // Chunks in range that are uploaded
+  int residentChunks() const;
+  // Selected nodes and their triangles
+  int nodeCount() const;
+  int triangleCount() const;
+
+private:
+  static const int COLUMNS = 8; // Ring length along X - the columns at both ends only feed their neighbors
+  static const int ROWS = 6;    // Chunks across Z, centered on the track
+
+  enum State
+  {
+    EMPTY,    // Nothing generated
+    BUILDING, // A worker is generating the heights
+    BUILT,    // Generated, waiting for upload
+    UPLOADED  // In the heightmap and drawable
+  };
+
+  struct Chunk
+  {
+    long column;                         // World column held, valid unless EMPTY
+    std::atomic<int> state;              // Handed between the main thread and a worker
+    std::vector<unsigned short> heights; // Quantized samples, the far edges shared with the neighbors
+    std::vector<float> bounds;           // Lowest and highest height under each quadtree node
+  };
+
+  // One grid instance - where it goes and where its heights are
+  struct Node
+  {
+    float place[4]; // x, z of the corner, edge length, texels per grid step
+    float morph[4]; // s, t of the corner texel, distance where morphing starts and ends
+  };
+
+  unsigned int seed;
+  double travelled; // Rover distance at the last update
+  long first;       // First column in range
+  Chunk chunks[COLUMNS][ROWS];
+
+  unsigned int heightmap; // Ring of every chunk's heights
+  Mesh grid;              // Unit node grid
+  unsigned int vbo;       // Selected nodes
+  std::vector<Node> nodes;
+  float eye[3];    // Eye at the last select, for the morph distances
+  float middle[3]; // Center of the selected nodes
+
+  static int slot(long column);
+  double noise(double x, double z) const;
+  void build(Chunk &chunk, long column, int row) const;
+  void upload(Chunk &chunk, long column, int row);
+  void visit(const Frustum &frustum, const Chunk &chunk, int row, double x, double z, int depth, int i, int j);
+  void drawFallback() const;
+};
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef TEXCACHE_HPP
+#define TEXCACHE_HPP
+
+#include <cstddef>
+#include <stdint.h>
+
+/*
+ *  Baked texture cache
+ *  The first run reads each BMP's compressed mip chain back from the
+ *  driver and packs them all into one file. Later runs map that file and
+ *  hand the levels straight to glCompressedTexImage2D, skipping the BMP
+ *  read, mip generation and compression. An entry is only used while its
+ *  BMP has the same size and modification time (an atlas is keyed by its
+ *  files separated by '|' and checked against all of them)
+ */
+class TextureCache
+{
+public:
+  // Hash of a cached image that is still current, false if it needs the BMP
+  static bool lookup(const char *file, uint64_t &hash);
+  // Upload the cached mip chain into a texture and return its size in bytes,
+  // 0 if the driver refused it and the BMP has to be read instead
+  static size_t upload(const char *file, unsigned int texture);
+  // Read back the mip chain of an uploaded texture for the next save, returns its size in bytes
+  static size_t bake(const char *file, unsigned int texture, uint64_t hash);
+  // Write the cache file if anything was baked since the last save
+  static void save();
+};
+
+#endif
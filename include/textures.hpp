@@ -0,0 +1,43 @@
+#ifndef TEXTURES_HPP
+#define TEXTURES_HPP
+
+#include <cstddef>
+
+/*
+ *  Asynchronous, shared texture cache
+ *  Files are read and converted on the worker pool while the main thread
+ *  keeps drawing, showing a white placeholder until update() uploads the
+ *  image. Textures are keyed by path and by a hash of their pixels, so the
+ *  same file or the same image under another name shares one GL texture.
+ *  Handles are reference counted. An atlas packs several files into one
+ *  texture so parts using different images can share a binding
+ */
+class Textures
+{
+public:
+  // Start loading a BMP (or share an earlier load) and return its handle
+  static int load(const char *file);
+  // Pack several BMPs into one texture and return its handle - regions[i]
+  // gets the s, t, width, height of files[i] within it for Mesh::texRegion
+  static int atlas(const char *const files[], int count, float regions[][4]);
+  // Give up a reference, the GL texture goes once nothing uses it
+  static void release(int handle);
+  // Bind the texture for a handle
+  static void bind(int handle);
+  // GL texture name currently behind a handle
+  static unsigned int name(int handle);
+
+  // Upload the images decoded since the last call - main thread only
+  static void update();
+  // Block until every texture is uploaded
+  static void finish();
+  // Textures still waiting for their image
+  static int pending();
+
+  // Bytes of texture memory held by distinct GL textures
+  static size_t residentBytes();
+  // Distinct GL textures
+  static int residentCount();
+};
+
+#endif
@@ -1,21 +1,99 @@
 #ifndef UTIL_HPP
 #define UTIL_HPP
 
+#include <vector>
+#include <stdint.h>
+
+//  SIMD kernels are compiled for SSE and AVX2 whatever the build flags and
+//  picked by what the CPU supports when the program runs
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_KERNELS
+#include <immintrin.h>
+#endif
+
+class Mesh;
+
 class Util
 {
 public:
+  // 24-bit BGR image with rows from the bottom up, padded to 4 bytes like
+  // the file (and GL_UNPACK_ALIGNMENT) - data points into the memory-mapped
+  // file, or into pixels when the file could not be mapped
+  struct Image
+  {
+    unsigned int width, height;
+    unsigned int rowBytes;
+    const unsigned char *data;
+    std::vector<unsigned char> pixels;
+
+    Image();
+    ~Image();
+    size_t size() const;
+
+  private:
+    friend class Util;
+    void *mapping;
+    size_t mappingSize;
+    Image(const Image &);
+    Image &operator=(const Image &);
+  };
+
   // Constants
   static const double PI;
+  // No GLUT window - raster text is skipped and frames are not swapped
+  static bool headless;
 
   static void ErrCheck(const char *where);
   static void Fatal(const char *format, ...);
   static void Print(const char *format, ...);
   static void Vertex(double th, double ph);
   static int LoadTexBMP(const char *file);
+  // Map a whole file read-only (read into memory where there is no mmap)
+  static void *MapFile(const char *file, size_t &length);
+  static void UnmapFile(void *data, size_t length);
+  // Map a BMP and validate its header without touching OpenGL
+  static void ReadBMP(const char *file, Image &image);
+  // Copy a decoded image into an existing texture name
+  static void UploadTexture(unsigned int texture, const char *file, const Image &image);
+  // The driver block compresses RGB textures to DXT1 (GL_EXT_texture_compression_s3tc)
+  static bool CompressTextures();
+  // Monotonic time in seconds since the program started
+  static double seconds();
+
+  // Widest SIMD kernels this CPU runs, checked once - always SCALAR
+  // without SIMD_KERNELS, so it can index a table of kernels
+  enum Simd
+  {
+    SCALAR,
+    SSE,
+    AVX2
+  };
+  static Simd simd();
+
+  // Integer hash that spreads every input bit over the result
+  static uint32_t mix(uint32_t h)
+  {
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+  }
+  // Next pseudo-random value in [0,1) from an xorshift state
+  static double uniform(uint32_t &state)
+  {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state / 4294967296.0;
+  }
 
   static double degToRad(double degrees);
   static void calculateRotation(const double start[3], const double end[3], double &angle, double rotationAxis[3]);
 
+  static void material(double shiny, double emissionFactor);
+  static void sphere(Mesh &mesh, double x, double y, double z, double r, double inc = 10.0);
   static void ball(double x, double y, double z, double r, double inc = 10.0, double shiny = 50.0, double emissionFactor = 1.0);
 };
 
@@ -0,0 +1,42 @@
+#ifndef WORKERS_HPP
+#define WORKERS_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ *  Shared pool of worker threads, one per core
+ *  Jobs must not touch OpenGL - only the main thread owns the context
+ */
+class Workers
+{
+public:
+  // Pool shared by the whole program, started on first use
+  static Workers &pool();
+
+  explicit Workers(int threads);
+  ~Workers();
+
+  // Run job on some worker
+  void submit(const std::function<void()> &job);
+  // Run job(i) for every i in [0,n) on the pool's workers and this thread
+  // and return once all are done - indices are claimed one at a time, so
+  // the caller never waits on a worker busy with something else
+  static void parallelFor(int n, const std::function<void(int)> &job);
+  int size() const;
+
+private:
+  std::vector<std::thread> threads;
+  std::deque<std::function<void()>> jobs;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping;
+
+  void run();
+};
+
+#endif
@@ -0,0 +1,544 @@
+#include <cmath>
+#include <cstddef> // For offsetof
+#include <stdint.h>
+#include "arms.hpp"
+#include "rover.hpp"
+#include "instances.hpp"
+#include "lights.hpp"
+#include "matrix.hpp"
+#include "mesh.hpp"
+#include "shader.hpp"
+#include "workers.hpp"
+#include "util.hpp"
+#ifdef USEGLEW
+#include <GL/glew.h>
+#endif
+//  OpenGL with prototypes for glext
+#define GL_GLEXT_PROTOTYPES
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+// Tell Xcode IDE to not gripe about OpenGL deprecation
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+// Legacy contexts only have the ARB entry point
+#define glVertexAttribDivisor glVertexAttribDivisorARB
+#else
+#include <GL/glut.h>
+#endif
+
+//  Arms aimed and solved by a thread at a time - a multiple of the widest SIMD vector
+static const int BLOCK = 256;
+//  FABRIK passes per update - the joints start from where they were last
+//  frame, so a few passes keep up with a target that moves smoothly
+static const int ITERATIONS = 4;
+//  Share of a cycle spent lowering the drill, drilling and raising it, the
+//  rest is spent stowed
+static const double LOWER = 0.25;
+static const double DRILL = 0.6;
+static const double RAISE = 0.85;
+//  Seconds a cycle takes, picked per arm between the two
+static const double CYCLE[2] = {7.0, 12.0};
+//  Where the drill samples, from its tip at rest, and how far into the ground
+static const double SAMPLE_X[2] = {-8.0, 0.0};
+static const double SAMPLE_Z[2] = {-12.0, -2.0};
+static const double DIG = 1.0;
+
+//  Generic attribute locations clear of the ones NVIDIA aliases to
+//  gl_Vertex (0), gl_Normal (2), gl_Color (3) and gl_MultiTexCoord0 (8)
+static const int POSE_LOCATION = 9; // mat4 - 9 to 12
+static const int ELBOW_LOCATION = 13;
+static const int WRIST_LOCATION = 14;
+
+//  Slow in and out of the ends of a move
+static double ease(double t)
+{
+  return t * t * (3 - 2 * t);
+}
+
+//  The chain every arm shares - the shoulder and the bone lengths
+struct Chain
+{
+  float shoulder[3];
+  float upper, fore;
+};
+
+//  Range of arms as the kernels see it, first and end on whole vectors
+struct Reach
+{
+  float *ex, *ey, *ez, *wx, *wy, *wz;
+  const float *tx, *ty, *tz;
+  int first, end;
+};
+
+/*
+ *  Move (x,y,z) along the line from (fx,fy,fz) through it until it is
+ *  length from (fx,fy,fz)
+ */
+static void toward(float &x, float &y, float &z, float fx, float fy, float fz, float length)
+{
+  float dx = x - fx, dy = y - fy, dz = z - fz;
+  float s = length / fmaxf(sqrtf(dx * dx + dy * dy + dz * dz), 1e-6f);
+  x = fx + dx * s;
+  y = fy + dy * s;
+  z = fz + dz * s;
+}
+
+/*
+ *  FABRIK - each pass puts the wrist on the target and pulls the elbow
+ *  after it, then puts the elbow back in reach of the shoulder and pulls
+ *  the wrist after that. A target out of reach leaves the arm stretched
+ *  straight at it
+ */
+static void solveScalar(const Chain &c, Reach &r)
+{
+  for (int i = r.first; i < r.end; i++)
+  {
+    float ex = r.ex[i], ey = r.ey[i], ez = r.ez[i];
+    float wx = r.wx[i], wy = r.wy[i], wz = r.wz[i];
+    for (int pass = 0; pass < ITERATIONS; pass++)
+    {
+      wx = r.tx[i];
+      wy = r.ty[i];
+      wz = r.tz[i];
+      toward(ex, ey, ez, wx, wy, wz, c.fore);
+      toward(ex, ey, ez, c.shoulder[0], c.shoulder[1], c.shoulder[2], c.upper);
+      toward(wx, wy, wz, ex, ey, ez, c.fore);
+    }
+    r.ex[i] = ex;
+    r.ey[i] = ey;
+    r.ez[i] = ez;
+    r.wx[i] = wx;
+    r.wy[i] = wy;
+    r.wz[i] = wz;
+  }
+}
+
+#ifdef SIMD_KERNELS
+__attribute__((target("sse2"))) static inline void towardSSE(__m128 &x, __m128 &y, __m128 &z, __m128 fx, __m128 fy, __m128 fz,
+                                                             __m128 length)
+{
+  __m128 dx = _mm_sub_ps(x, fx), dy = _mm_sub_ps(y, fy), dz = _mm_sub_ps(z, fz);
+  __m128 d = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+  __m128 s = _mm_div_ps(length, _mm_max_ps(d, _mm_set1_ps(1e-6f)));
+  x = _mm_add_ps(fx, _mm_mul_ps(dx, s));
+  y = _mm_add_ps(fy, _mm_mul_ps(dy, s));
+  z = _mm_add_ps(fz, _mm_mul_ps(dz, s));
+}
+
+__attribute__((target("sse2"))) static void solveSSE(const Chain &c, Reach &r)
+{
+  const __m128 sx = _mm_set1_ps(c.shoulder[0]), sy = _mm_set1_ps(c.shoulder[1]), sz = _mm_set1_ps(c.shoulder[2]);
+  const __m128 upper = _mm_set1_ps(c.upper), fore = _mm_set1_ps(c.fore);
+  for (int i = r.first; i < r.end; i += 4)
+  {
+    __m128 ex = _mm_load_ps(r.ex + i), ey = _mm_load_ps(r.ey + i), ez = _mm_load_ps(r.ez + i);
+    __m128 wx = _mm_load_ps(r.tx + i), wy = _mm_load_ps(r.ty + i), wz = _mm_load_ps(r.tz + i);
+    for (int pass = 0; pass < ITERATIONS; pass++)
+    {
+      __m128 tx = _mm_load_ps(r.tx + i), ty = _mm_load_ps(r.ty + i), tz = _mm_load_ps(r.tz + i);
+      towardSSE(ex, ey, ez, tx, ty, tz, fore);
+      towardSSE(ex, ey, ez, sx, sy, sz, upper);
+      wx = tx;
+      wy = ty;
+      wz = tz;
+      towardSSE(wx, wy, wz, ex, ey, ez, fore);
+    }
+    _mm_store_ps(r.ex + i, ex);
+    _mm_store_ps(r.ey + i, ey);
+    _mm_store_ps(r.ez + i, ez);
+    _mm_store_ps(r.wx + i, wx);
+    _mm_store_ps(r.wy + i, wy);
+    _mm_store_ps(r.wz + i, wz);
+  }
+}
+
+__attribute__((target("avx2,fma"))) static inline void towardAVX2(__m256 &x, __m256 &y, __m256 &z, __m256 fx, __m256 fy,
+                                                                  __m256 fz, __m256 length)
+{
+  __m256 dx = _mm256_sub_ps(x, fx), dy = _mm256_sub_ps(y, fy), dz = _mm256_sub_ps(z, fz);
+  __m256 d = _mm256_sqrt_ps(_mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx))));
+  __m256 s = _mm256_div_ps(length, _mm256_max_ps(d, _mm256_set1_ps(1e-6f)));
+  x = _mm256_fmadd_ps(dx, s, fx);
+  y = _mm256_fmadd_ps(dy, s, fy);
+  z = _mm256_fmadd_ps(dz, s, fz);
+}
+
+__attribute__((target("avx2,fma"))) static void solveAVX2(const Chain &c, Reach &r)
+{
+  const __m256 sx = _mm256_set1_ps(c.shoulder[0]), sy = _mm256_set1_ps(c.shoulder[1]), sz = _mm256_set1_ps(c.shoulder[2]);
+  const __m256 upper = _mm256_set1_ps(c.upper), fore = _mm256_set1_ps(c.fore);
+  for (int i = r.first; i < r.end; i += 8)
+  {
+    __m256 ex = _mm256_load_ps(r.ex + i), ey = _mm256_load_ps(r.ey + i), ez = _mm256_load_ps(r.ez + i);
+    __m256 wx = _mm256_load_ps(r.tx + i), wy = _mm256_load_ps(r.ty + i), wz = _mm256_load_ps(r.tz + i);
+    for (int pass = 0; pass < ITERATIONS; pass++)
+    {
+      __m256 tx = _mm256_load_ps(r.tx + i), ty = _mm256_load_ps(r.ty + i), tz = _mm256_load_ps(r.tz + i);
+      towardAVX2(ex, ey, ez, tx, ty, tz, fore);
+      towardAVX2(ex, ey, ez, sx, sy, sz, upper);
+      wx = tx;
+      wy = ty;
+      wz = tz;
+      towardAVX2(wx, wy, wz, ex, ey, ez, fore);
+    }
+    _mm256_store_ps(r.ex + i, ex);
+    _mm256_store_ps(r.ey + i, ey);
+    _mm256_store_ps(r.ez + i, ez);
+    _mm256_store_ps(r.wx + i, wx);
+    _mm256_store_ps(r.wy + i, wy);
+    _mm256_store_ps(r.wz + i, wz);
+  }
+}
+#endif
+
+//  The solver this CPU runs
+struct Solvers
+{
+  void (*solve)(const Chain &c, Reach &r);
+  const char *name;
+};
+
+//  Indexed by Util::simd()
+static const Solvers choices[] = {
+    {solveScalar, "scalar"},
+#ifdef SIMD_KERNELS
+    {solveSSE, "SSE"},
+    {solveAVX2, "AVX2"},
+#endif
+};
+
+static const Solvers &pick()
+{
+  return choices[Util::simd()];
+}
+
+static const char *vertexSource =
+    "#version 120\n"
+    "uniform int bone;\n"
+    "uniform vec3 shoulder;\n"
+    "attribute mat4 armPose;\n"
+    "attribute vec3 armElbow;\n"
+    "attribute vec3 armWrist;\n"
+    "varying vec4 color;\n"
+    "varying vec3 eye;\n"
+    "varying vec3 normal;\n"
+    //  The turn taking +Y onto u, as Matrix::segment builds it
+    "mat3 turn(vec3 u)\n"
+    "{\n"
+    "  float c = u.y;\n"
+    "  if (1.0 + c < 1e-6)\n"
+    "    return mat3(1.0, 0.0, 0.0, 0.0, -1.0, 0.0, 0.0, 0.0, -1.0);\n"
+    "  float vx = u.z, vz = -u.x, k = 1.0 / (1.0 + c);\n"
+    "  return mat3(c + k * vx * vx, vz, k * vx * vz, -vz, c, vx, k * vx * vz, -vx, c + k * vz * vz);\n"
+    "}\n"
+    "void main()\n"
+    "{\n"
+    "  vec3 p = gl_Vertex.xyz;\n"
+    "  vec3 n = gl_Normal;\n"
+    //  The head hangs from the wrist as it is, a bone is stretched
+    //  between its joints - only along its length, so its normals just turn
+    "  if (bone == 2)\n"
+    "    p += armWrist;\n"
+    "  else\n"
+    "  {\n"
+    "    vec3 start = bone == 0 ? shoulder : armElbow;\n"
+    "    vec3 d = (bone == 0 ? armElbow : armWrist) - start;\n"
+    "    float len = length(d);\n"
+    "    mat3 r = turn(d / max(len, 1e-6));\n"
+    "    p = start + r * vec3(p.x, p.y * len, p.z);\n"
+    "    n = r * n;\n"
+    "  }\n"
+    //  Rover poses only turn and move, so they place normals as they are
+    "  vec4 world = armPose * vec4(p, 1.0);\n"
+    "  eye = (gl_ModelViewMatrix * world).xyz;\n"
+    "  normal = gl_NormalMatrix * (mat3(armPose) * n);\n"
+    "  color = gl_Color;\n"
+    "  gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+    "  gl_Position = gl_ModelViewProjectionMatrix * world;\n"
+    "}\n";
+
+static unsigned int program = 0;
+
+/*
+ *  Build the arm program the first time it is needed
+ */
+static unsigned int armProgram()
+{
+  if (!program)
+  {
+    const char *attributes[] = {"armPose", "armElbow", "armWrist"};
+    const int locations[] = {POSE_LOCATION, ELBOW_LOCATION, WRIST_LOCATION};
+    program = Shader::program("Arms", vertexSource, Lights::fragmentSource().c_str(), 3, attributes, locations);
+  }
+  return program;
+}
+
+Arms::Arms(unsigned int seed, int count) : seed(seed), arms(0), stride(0), ground(0.0), rigged(false), elapsed(0.0), vbo(0)
+{
+  for (int k = 0; k < 3 * JOINT_COUNT; k++)
+    rest[k] = 0.0;
+  drop[0] = drop[1] = drop[2] = 0.0;
+  middle[0] = middle[1] = middle[2] = 0.0f;
+  resize(count);
+}
+
+void Arms::resize(int count)
+{
+  arms = count < 0 ? 0 : count;
+  stride = (arms + 7) & ~7;
+  storage.assign(FIELD_COUNT * stride + 8, 0.0f);
+  phase.resize(arms);
+  rate.resize(arms);
+  for (int i = 0; i < arms; i++)
+  {
+    uint32_t h = Util::mix(seed ^ ((uint32_t)i * 0x9e3779b9u));
+    phase[i] = (float)((h & 0xffff) / 65536.0);
+    rate[i] = (float)(1.0 / (CYCLE[0] + (CYCLE[1] - CYCLE[0]) * (h >> 16) / 65536.0));
+  }
+  // The joints start at rest once the chain is known
+  rigged = false;
+}
+
+int Arms::count() const
+{
+  return arms;
+}
+
+float *Arms::field(Field f)
+{
+  uintptr_t p = (uintptr_t)storage.data();
+  return (float *)((p + 31) & ~(uintptr_t)31) + f * stride;
+}
+
+const float *Arms::field(Field f) const
+{
+  uintptr_t p = (uintptr_t)storage.data();
+  return (const float *)((p + 31) & ~(uintptr_t)31) + f * stride;
+}
+
+/*
+ *  Take the chain from the rover and put every arm at rest
+ */
+void Arms::rig(const Rover &rover)
+{
+  double tip[3];
+  rover.armRest(rest, tip);
+  ground = rover.groundHeight();
+  for (int k = 0; k < 3; k++)
+    drop[k] = tip[k] - rest[3 * WRIST + k];
+
+  for (int k = 0; k < 3; k++)
+  {
+    float *elbow = field((Field)(ELBOW_X + k));
+    float *wrist = field((Field)(WRIST_X + k));
+    for (int i = 0; i < stride; i++)
+    {
+      elbow[i] = (float)rest[3 * ELBOW + k];
+      wrist[i] = (float)rest[3 * WRIST + k];
+    }
+  }
+  rigged = true;
+}
+
+/*
+ *  Targets of arms first to end - the wrist goes where the drill tip should
+ *  be, less the head's drop. A cycle moves the tip from rest down to a spot
+ *  of its own, drills and brings it back up
+ */
+void Arms::aim(int first, int end, double now)
+{
+  float *tx = field(TARGET_X), *ty = field(TARGET_Y), *tz = field(TARGET_Z);
+  double home[3], spot[3];
+  for (int k = 0; k < 3; k++)
+    home[k] = rest[3 * WRIST + k] + drop[k];
+
+  for (int i = first; i < end; i++)
+  {
+    double reach = 0.0;
+    spot[0] = home[0];
+    spot[2] = home[2];
+    spot[1] = ground - DIG;
+    //  The padding past the last arm stays at rest
+    if (i < arms)
+    {
+      double u = now * rate[i] + phase[i];
+      double cycle = floor(u), f = u - cycle;
+      reach = f < LOWER ? ease(f / LOWER) : f < DRILL ? 1.0 : f < RAISE ? 1.0 - ease((f - DRILL) / (RAISE - DRILL)) : 0.0;
+      uint32_t h = Util::mix(seed ^ ((uint32_t)i * 0x9e3779b9u) ^ ((uint32_t)(int64_t)cycle * 0x85ebca6bu));
+      spot[0] += SAMPLE_X[0] + (SAMPLE_X[1] - SAMPLE_X[0]) * (h & 0xffff) / 65536.0;
+      spot[2] += SAMPLE_Z[0] + (SAMPLE_Z[1] - SAMPLE_Z[0]) * (h >> 16) / 65536.0;
+    }
+    tx[i] = (float)(home[0] + reach * (spot[0] - home[0]) - drop[0]);
+    ty[i] = (float)(home[1] + reach * (spot[1] - home[1]) - drop[1]);
+    tz[i] = (float)(home[2] + reach * (spot[2] - home[2]) - drop[2]);
+  }
+}
+
+void Arms::update(const Rover &rover, double now)
+{
+  double start = Util::seconds();
+  if (!rigged)
+    rig(rover);
+
+  Chain chain;
+  double upper = 0, fore = 0;
+  for (int k = 0; k < 3; k++)
+  {
+    chain.shoulder[k] = (float)rest[3 * SHOULDER + k];
+    upper += (rest[3 * ELBOW + k] - rest[3 * SHOULDER + k]) * (rest[3 * ELBOW + k] - rest[3 * SHOULDER + k]);
+    fore += (rest[3 * WRIST + k] - rest[3 * ELBOW + k]) * (rest[3 * WRIST + k] - rest[3 * ELBOW + k]);
+  }
+  chain.upper = (float)sqrt(upper);
+  chain.fore = (float)sqrt(fore);
+
+  //  A block aims its arms and solves them whole vectors at a time - the
+  //  padding is solved along with the last arms
+  Reach reach = {field(ELBOW_X), field(ELBOW_Y), field(ELBOW_Z), field(WRIST_X), field(WRIST_Y), field(WRIST_Z),
+                 field(TARGET_X), field(TARGET_Y), field(TARGET_Z), 0, 0};
+  int n = stride;
+  auto job = [this, chain, reach, n, now](int b)
+  {
+    Reach r = reach;
+    r.first = b * BLOCK;
+    r.end = r.first + BLOCK < n ? r.first + BLOCK : n;
+    aim(r.first, r.end, now);
+    pick().solve(chain, r);
+  };
+
+  Workers::parallelFor((n + BLOCK - 1) / BLOCK, job);
+  elapsed = 1000.0 * (Util::seconds() - start);
+}
+
+void Arms::setDrawn(int count)
+{
+  Slot slot = {};
+  slots.resize(count < 0 ? 0 : count, slot);
+}
+
+void Arms::place(int slot, int arm, const double pose[16])
+{
+  Slot &s = slots[slot];
+  for (int k = 0; k < 16; k++)
+    s.pose[k] = (float)pose[k];
+  for (int k = 0; k < 3; k++)
+  {
+    s.elbow[k] = field((Field)(ELBOW_X + k))[arm];
+    s.wrist[k] = field((Field)(WRIST_X + k))[arm];
+  }
+}
+
+void Arms::upload()
+{
+  float lo[3] = {0, 0, 0}, hi[3] = {0, 0, 0};
+  for (size_t i = 0; i < slots.size(); i++)
+    for (int k = 0; k < 3; k++)
+    {
+      float p = slots[i].pose[12 + k];
+      lo[k] = i == 0 || p < lo[k] ? p : lo[k];
+      hi[k] = i == 0 || p > hi[k] ? p : hi[k];
+    }
+  for (int k = 0; k < 3; k++)
+    middle[k] = 0.5f * (lo[k] + hi[k]);
+
+  if (slots.empty() || !Instances::supported())
+    return;
+  if (!vbo)
+    glGenBuffers(1, &vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferData(GL_ARRAY_BUFFER, slots.size() * sizeof(Slot), slots.data(), GL_STREAM_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  Util::ErrCheck("Arms::upload");
+}
+
+void Arms::draw(const Mesh &mesh, int bone) const
+{
+  if (slots.empty())
+    return;
+
+  //  Without instancing the bones are placed here, one draw per arm
+  if (!Instances::supported())
+  {
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+      const Slot &s = slots[i];
+      double start[3], end[3], m[16];
+      for (int k = 0; k < 3; k++)
+      {
+        start[k] = bone == UPPER ? rest[3 * SHOULDER + k] : s.elbow[k];
+        end[k] = bone == UPPER ? s.elbow[k] : s.wrist[k];
+      }
+      if (bone == HEAD)
+      {
+        Matrix::identity(m);
+        Matrix::translate(m, s.wrist[0], s.wrist[1], s.wrist[2]);
+      }
+      else
+        Matrix::segment(m, start, end, 1.0);
+      glPushMatrix();
+      glMultMatrixf(s.pose);
+      glMultMatrixd(m);
+      mesh.draw();
+      glPopMatrix();
+    }
+    return;
+  }
+
+  unsigned int prog = armProgram();
+  glUseProgram(prog);
+  Shader::setFixedState(prog);
+  glUniform1i(glGetUniformLocation(prog, "bone"), bone);
+  glUniform3f(glGetUniformLocation(prog, "shoulder"), (float)rest[3 * SHOULDER], (float)rest[3 * SHOULDER + 1],
+              (float)rest[3 * SHOULDER + 2]);
+
+  //  One pose column per attribute location and the two joints, advanced once per arm
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  for (int col = 0; col < 4; col++)
+  {
+    glEnableVertexAttribArray(POSE_LOCATION + col);
+    glVertexAttribPointer(POSE_LOCATION + col, 4, GL_FLOAT, GL_FALSE, sizeof(Slot),
+                          (void *)(offsetof(Slot, pose) + 4 * col * sizeof(float)));
+    glVertexAttribDivisor(POSE_LOCATION + col, 1);
+  }
+  glEnableVertexAttribArray(ELBOW_LOCATION);
+  glVertexAttribPointer(ELBOW_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(Slot), (void *)offsetof(Slot, elbow));
+  glVertexAttribDivisor(ELBOW_LOCATION, 1);
+  glEnableVertexAttribArray(WRIST_LOCATION);
+  glVertexAttribPointer(WRIST_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(Slot), (void *)offsetof(Slot, wrist));
+  glVertexAttribDivisor(WRIST_LOCATION, 1);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  mesh.drawInstanced((int)slots.size());
+
+  for (int loc = POSE_LOCATION; loc <= WRIST_LOCATION; loc++)
+  {
+    glVertexAttribDivisor(loc, 0);
+    glDisableVertexAttribArray(loc);
+  }
+  glUseProgram(0);
+}
+
+void Arms::tip(int arm, double p[3]) const
+{
+  for (int k = 0; k < 3; k++)
+    p[k] = field((Field)(WRIST_X + k))[arm] + drop[k];
+}
+
+int Arms::drawnCount() const
+{
+  return (int)slots.size();
+}
+
+void Arms::center(double c[3]) const
+{
+  for (int k = 0; k < 3; k++)
+    c[k] = middle[k];
+}
+
+double Arms::solveTime() const
+{
+  return elapsed;
+}
+
+const char *Arms::kernels()
+{
+  return pick().name;
+}
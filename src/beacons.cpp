@@ -0,0 +1,149 @@
+#include <climits>
+#include <cmath>
+#include <stdint.h>
+#include "beacons.hpp"
+#include "terrain.hpp"
+#include "matrix.hpp"
+#include "primitives.hpp"
+#include "lights.hpp"
+#include "util.hpp"
+#ifdef USEGLEW
+#include <GL/glew.h>
+#endif
+//  OpenGL with prototypes for glext
+#define GL_GLEXT_PROTOTYPES
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+// Tell Xcode IDE to not gripe about OpenGL deprecation
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#else
+#include <GL/glut.h>
+#endif
+
+//  Stretch of ground the lamps cover along X and how far it reaches behind
+//  the rover - like the rock field, inside the ground the terrain always draws
+static const double STRETCH = 290.0;
+static const double BEHIND = 140.0;
+//  Half width of the rover's lane kept clear and of the lamps across Z
+static const double CLEAR = 16.0;
+static const double REACH = 160.0;
+//  Lamp height above the ground and ball size
+static const double POST = 5.0;
+static const double BALL = 0.8;
+//  Falloff of a lamp - it reaches about 70 units
+static const float ATTENUATION[3] = {1.0f, 0.1f, 0.08f};
+//  Sodium, white and red lamps
+static const float COLORS[3][3] = {{1.0f, 0.7f, 0.4f}, {0.8f, 0.9f, 1.0f}, {1.0f, 0.35f, 0.25f}};
+//  Lap of a lamp that was never placed
+static const long NONE = LONG_MIN;
+
+Beacons::Beacons(unsigned int seed, int count) : seed(seed), fresh(true)
+{
+  resize(count);
+}
+
+void Beacons::resize(int count)
+{
+  if (count < 0)
+    count = 0;
+  laps.assign(count, NONE);
+  x.assign(count, 0.0f);
+  y.assign(count, 0.0f);
+  z.assign(count, 0.0f);
+  color.assign(3 * count, 0.0f);
+
+  //  Every instance exists from the start, placing a lamp only overwrites it
+  double m[16];
+  Matrix::identity(m);
+  placed.clear();
+  for (int i = 0; i < count; i++)
+    placed.add(m);
+  fresh = true;
+}
+
+int Beacons::count() const
+{
+  return (int)laps.size();
+}
+
+/*
+ *  Put a lamp in its spot of a lap, seeded by both
+ */
+void Beacons::place(const Terrain &terrain, int lamp, long lap)
+{
+  laps[lamp] = lap;
+
+  //  A lamp keeps its place along the stretch, its side and distance from the track change every lap
+  uint32_t state = Util::mix(seed ^ ((uint32_t)lamp * 0x9e3779b9u) ^ Util::mix((uint32_t)lap)) | 1;
+  double px = lap * STRETCH + STRETCH * (Util::mix(seed + lamp) / 4294967296.0);
+  double side = Util::uniform(state) < 0.5 ? -1.0 : 1.0;
+  double pz = side * (CLEAR + Util::uniform(state) * (REACH - CLEAR));
+  const float *c = COLORS[(int)(3 * Util::uniform(state))];
+
+  x[lamp] = (float)px;
+  y[lamp] = (float)(terrain.height(px, pz) + POST);
+  z[lamp] = (float)pz;
+  for (int k = 0; k < 3; k++)
+    color[3 * lamp + k] = c[k];
+
+  double m[16];
+  Matrix::identity(m);
+  Matrix::translate(m, x[lamp], y[lamp], z[lamp]);
+  Matrix::scale(m, BALL, BALL, BALL);
+  placed.set(lamp, m);
+  if (!fresh)
+    placed.upload(lamp, 1);
+}
+
+void Beacons::update(const Terrain &terrain, double distance)
+{
+  //  The ball is made once, with the first context
+  if (ball.empty())
+  {
+    ball.append(Primitives::sphere(20));
+    ball.upload();
+  }
+
+  for (int i = 0; i < count(); i++)
+  {
+    //  The lap that puts this lamp inside the stretch around the rover
+    double offset = STRETCH * (Util::mix(seed + i) / 4294967296.0);
+    long lap = (long)ceil((distance - BEHIND - offset) / STRETCH);
+    if (laps[i] != lap)
+      place(terrain, i, lap);
+  }
+
+  if (fresh && count() > 0)
+  {
+    placed.upload();
+    fresh = false;
+  }
+}
+
+void Beacons::addLights(double distance) const
+{
+  for (int i = 0; i < count(); i++)
+  {
+    const float *c = &color[3 * i];
+    Lights::Light lamp = {{(float)(x[i] - distance), y[i], z[i], 1},
+                          {0, 0, 0},
+                          {c[0], c[1], c[2]},
+                          {0.5f * c[0], 0.5f * c[1], 0.5f * c[2]},
+                          {ATTENUATION[0], ATTENUATION[1], ATTENUATION[2]},
+                          {0, -1, 0},
+                          180,
+                          0};
+    if (!Lights::add(lamp))
+      break;
+  }
+}
+
+const Mesh &Beacons::mesh() const
+{
+  return ball;
+}
+
+const Instances &Beacons::instances() const
+{
+  return placed;
+}
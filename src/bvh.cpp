@@ -0,0 +1,162 @@
+#include <algorithm>
+#include "bvh.hpp"
+#include "frustum.hpp"
+
+Bvh::Bvh() : rebuild(false), refit(false), shown(0)
+{
+}
+
+int Bvh::insert(const double lo[3], const double hi[3])
+{
+  Box box;
+  for (int k = 0; k < 3; k++)
+  {
+    box.lo[k] = lo[k];
+    box.hi[k] = hi[k];
+  }
+  boxes.push_back(box);
+  seen.push_back(0);
+  rebuild = true;
+  return (int)boxes.size() - 1;
+}
+
+void Bvh::move(int handle, const double lo[3], const double hi[3])
+{
+  Box &box = boxes[handle];
+  for (int k = 0; k < 3; k++)
+  {
+    box.lo[k] = lo[k];
+    box.hi[k] = hi[k];
+  }
+  refit = true;
+}
+
+static void grow(double lo[3], double hi[3], const double a[3], const double b[3])
+{
+  for (int k = 0; k < 3; k++)
+  {
+    lo[k] = a[k] < lo[k] ? a[k] : lo[k];
+    hi[k] = b[k] > hi[k] ? b[k] : hi[k];
+  }
+}
+
+/*
+ *  Node for order[first, first + count) - splits at the median center
+ *  along the axis the centers spread furthest
+ */
+int Bvh::build(int first, int count)
+{
+  int index = (int)nodes.size();
+  nodes.push_back(Node());
+  nodes[index].left = nodes[index].right = -1;
+  nodes[index].first = first;
+  nodes[index].count = count;
+  if (count <= LEAF)
+    return index;
+
+  double lo[3], hi[3];
+  for (int k = 0; k < 3; k++)
+  {
+    lo[k] = 1e30;
+    hi[k] = -1e30;
+  }
+  for (int i = first; i < first + count; i++)
+  {
+    const Box &b = boxes[order[i]];
+    double c[3] = {b.lo[0] + b.hi[0], b.lo[1] + b.hi[1], b.lo[2] + b.hi[2]};
+    grow(lo, hi, c, c);
+  }
+  int axis = 0;
+  for (int k = 1; k < 3; k++)
+    if (hi[k] - lo[k] > hi[axis] - lo[axis])
+      axis = k;
+
+  int half = count / 2;
+  std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+                   [this, axis](int a, int b)
+                   { return boxes[a].lo[axis] + boxes[a].hi[axis] < boxes[b].lo[axis] + boxes[b].hi[axis]; });
+  int left = build(first, half);
+  int right = build(first + half, count - half);
+  nodes[index].left = left;
+  nodes[index].right = right;
+  return index;
+}
+
+void Bvh::cull(const Frustum &frustum)
+{
+  if (rebuild)
+  {
+    order.resize(boxes.size());
+    for (size_t i = 0; i < order.size(); i++)
+      order[i] = (int)i;
+    nodes.clear();
+    if (!boxes.empty())
+      build(0, (int)boxes.size());
+    rebuild = false;
+    refit = true;
+  }
+  //  Children come after their parent, so going backwards fits them first
+  if (refit)
+  {
+    for (int n = (int)nodes.size() - 1; n >= 0; n--)
+    {
+      Node &node = nodes[n];
+      for (int k = 0; k < 3; k++)
+      {
+        node.box.lo[k] = 1e30;
+        node.box.hi[k] = -1e30;
+      }
+      if (node.left < 0)
+        for (int i = node.first; i < node.first + node.count; i++)
+          grow(node.box.lo, node.box.hi, boxes[order[i]].lo, boxes[order[i]].hi);
+      else
+      {
+        grow(node.box.lo, node.box.hi, nodes[node.left].box.lo, nodes[node.left].box.hi);
+        grow(node.box.lo, node.box.hi, nodes[node.right].box.lo, nodes[node.right].box.hi);
+      }
+    }
+    refit = false;
+  }
+
+  std::fill(seen.begin(), seen.end(), 0);
+  shown = 0;
+  if (!nodes.empty())
+    walk(frustum, 0);
+}
+
+void Bvh::walk(const Frustum &frustum, int n)
+{
+  const Node &node = nodes[n];
+  if (!frustum.intersects(node.box.lo, node.box.hi))
+    return;
+  if (node.left >= 0)
+  {
+    walk(frustum, node.left);
+    walk(frustum, node.right);
+    return;
+  }
+  for (int i = node.first; i < node.first + node.count; i++)
+  {
+    const Box &box = boxes[order[i]];
+    if (node.count == 1 || frustum.intersects(box.lo, box.hi))
+    {
+      seen[order[i]] = 1;
+      shown++;
+    }
+  }
+}
+
+bool Bvh::visible(int handle) const
+{
+  return seen[handle] != 0;
+}
+
+int Bvh::visibleCount() const
+{
+  return shown;
+}
+
+int Bvh::culledCount() const
+{
+  return (int)boxes.size() - shown;
+}
@@ -0,0 +1,270 @@
+#include <cmath>
+#include <functional>
+#include <stdint.h>
+#include "fleet.hpp"
+#include "rover.hpp"
+#include "terrain.hpp"
+#include "matrix.hpp"
+#include "lights.hpp"
+#include "workers.hpp"
+#include "util.hpp"
+#ifdef USEGLEW
+#include <GL/glew.h>
+#endif
+//  OpenGL with prototypes for glext
+#define GL_GLEXT_PROTOTYPES
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+// Tell Xcode IDE to not gripe about OpenGL deprecation
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#else
+#include <GL/glut.h>
+#endif
+
+//  Lanes in the order they fill, the leader's first, and their spacing across Z
+static const int LANES[7] = {0, -1, 1, -2, 2, -3, 3};
+static const double LANE = 45.0;
+//  Spacing of the rows along X - the rows fill behind, ahead, behind...
+static const double GAP = 70.0;
+//  A rover drifts up to this far in its row, and weaves across its lane
+//  this far once every WAVELENGTH of ground
+static const double DRIFT = 6.0;
+static const double WEAVE = 3.0;
+static const double WAVELENGTH = 160.0;
+//  Where the ground is drawn around the leader, less a rover's length
+static const double BEHIND = 110.0;
+static const double AHEAD = 120.0;
+//  Half the wheelbase and track the ground is sampled over for the tilt
+static const double HALF_LENGTH = 19.0;
+static const double HALF_WIDTH = 15.0;
+//  Rovers stepped by a thread at a time
+static const int BLOCK = 256;
+
+static const double PI = 3.14159265;
+
+/*
+ *  Run job over [0,n) in blocks spread over the workers and this thread -
+ *  a single block runs right here
+ */
+static void forBlocks(int n, const std::function<void(int, int)> &job)
+{
+  Workers::parallelFor((n + BLOCK - 1) / BLOCK, [n, &job](int b)
+                       { job(b * BLOCK, (b + 1) * BLOCK < n ? (b + 1) * BLOCK : n); });
+}
+
+Fleet::Fleet(unsigned int seed, int count) : seed(seed), arms(seed, 0), last(-1.0), steps(0.0), places(0.0), uploads(0.0)
+{
+  resize(count);
+}
+
+void Fleet::resize(int count)
+{
+  if (count < 0)
+    count = 0;
+  lane.resize(count);
+  row.resize(count);
+  phase.resize(count);
+  rate.resize(count);
+  sway.resize(count);
+  fade.resize(count);
+  x.assign(count, 0.0f);
+  y.assign(count, 0.0f);
+  z.assign(count, 0.0f);
+  heading.assign(count, 0.0f);
+  pitch.assign(count, 0.0f);
+  roll.assign(count, 0.0f);
+  rolled.assign(count, 0.0f);
+  lamp.assign(count, 0.0f);
+  onGround.assign(count, 0);
+  arms.resize(count + 1);
+
+  for (int i = 0; i < count; i++)
+  {
+    //  Slot 0 is the leader's
+    int slot = i + 1;
+    int r = slot / 7;
+    lane[i] = (float)(LANES[slot % 7] * LANE);
+    row[i] = (float)(GAP * (r & 1 ? -(r + 1) / 2 : r / 2));
+
+    uint32_t h = Util::mix(seed ^ ((uint32_t)i * 0x9e3779b9u));
+    phase[i] = (float)(2 * PI * (h & 0xffff) / 65536.0);
+    rate[i] = (float)(0.2 + 0.6 * (h >> 16) / 65536.0);
+    h = Util::mix(h);
+    sway[i] = (float)(DRIFT * (0.5 + 0.5 * (h & 0xffff) / 65536.0));
+    fade[i] = (float)(0.3 + 1.2 * (h >> 16) / 65536.0);
+  }
+  last = -1.0;
+}
+
+int Fleet::count() const
+{
+  return (int)lane.size();
+}
+
+/*
+ *  Step rovers first to end - each only writes its own entries
+ */
+void Fleet::step(const Terrain &terrain, int first, int end, double now, double dt, double distance, bool isDay)
+{
+  const double wave = 2 * PI / WAVELENGTH;
+  for (int i = first; i < end; i++)
+  {
+    //  Drift in the row and weave across the lane, heading along the weave
+    double px = row[i] + sway[i] * sin(rate[i] * now + phase[i]);
+    double wx = distance + px;
+    double pz = lane[i] + WEAVE * sin(wave * wx + phase[i]);
+    double dz = WEAVE * wave * cos(wave * wx + phase[i]);
+
+    x[i] = (float)px;
+    z[i] = (float)pz;
+    heading[i] = (float)(-atan(dz) * 180 / PI);
+    rolled[i] = (float)wx;
+
+    //  Sit on the ground under the wheels, tilted along its slope - only
+    //  the rovers drawn need it, the others keep their last tilt
+    onGround[i] = px > -BEHIND && px < AHEAD;
+    if (onGround[i])
+    {
+      double front = terrain.height(wx + HALF_LENGTH, pz);
+      double back = terrain.height(wx - HALF_LENGTH, pz);
+      double left = terrain.height(wx, pz - HALF_WIDTH);
+      double right = terrain.height(wx, pz + HALF_WIDTH);
+      y[i] = (float)(0.25 * (front + back + left + right));
+      pitch[i] = (float)(atan((front - back) / (2 * HALF_LENGTH)) * 180 / PI);
+      roll[i] = (float)(-atan((right - left) / (2 * HALF_WIDTH)) * 180 / PI);
+    }
+
+    //  Each headlamp fades in at dusk and out at dawn at its own pace
+    float target = isDay ? 0.0f : 1.0f;
+    float change = (float)(fade[i] * dt);
+    lamp[i] = lamp[i] < target ? fminf(lamp[i] + change, target) : fmaxf(lamp[i] - change, target);
+  }
+}
+
+/*
+ *  Rover coordinates to the leader's
+ */
+void Fleet::pose(int rover, double m[16]) const
+{
+  Matrix::identity(m);
+  Matrix::translate(m, x[rover], y[rover], z[rover]);
+  Matrix::rotate(m, heading[rover], 0, 1, 0);
+  Matrix::rotate(m, pitch[rover], 0, 0, 1);
+  Matrix::rotate(m, roll[rover], 1, 0, 0);
+}
+
+void Fleet::update(const Terrain &terrain, const Rover &rover, double now, double distance, bool isDay)
+{
+  //  Steps are short, a stall isn't worth catching up on
+  double dt = last < 0 ? 0.0 : now - last;
+  dt = dt < 0 ? 0 : dt > 0.25 ? 0.25 : dt;
+  last = now;
+
+  //  Every rover, in blocks over the pool
+  double start = Util::seconds();
+  forBlocks(count(), [this, &terrain, now, dt, distance, isDay](int first, int end)
+            { step(terrain, first, end, now, dt, distance, isDay); });
+  steps = 1000.0 * (Util::seconds() - start);
+
+  //  Every drill arm, timed on its own
+  arms.update(rover, now);
+  double placed = Util::seconds();
+
+  //  The rovers on the ground, and the ones among them with a beam
+  drawn.clear();
+  lit.clear();
+  for (int i = 0; i < count(); i++)
+    if (onGround[i])
+    {
+      drawn.push_back(i);
+      if (lamp[i] > 0.5f)
+        lit.push_back(i);
+    }
+
+  bodies.resize((int)drawn.size());
+  wheels.resize((int)drawn.size() * rover.wheelCount());
+  beams.resize((int)lit.size());
+  //  The leader's arm goes first, in its own coordinates
+  double identity[16];
+  Matrix::identity(identity);
+  arms.setDrawn((int)drawn.size() + 1);
+  arms.place(0, 0, identity);
+  forBlocks((int)drawn.size(), [this, &rover](int first, int end)
+            {
+              double m[16];
+              for (int j = first; j < end; j++)
+              {
+                pose(drawn[j], m);
+                rover.place(j, m, rolled[drawn[j]], bodies, wheels);
+                arms.place(j + 1, drawn[j] + 1, m);
+              }
+            });
+  for (size_t j = 0; j < lit.size(); j++)
+  {
+    double m[16];
+    pose(lit[j], m);
+    beams.set((int)j, m);
+  }
+  double uploaded = Util::seconds();
+  places = 1000.0 * (uploaded - placed);
+
+  bodies.upload();
+  wheels.upload();
+  beams.upload();
+  arms.upload();
+  uploads = 1000.0 * (Util::seconds() - uploaded);
+}
+
+void Fleet::draw(RenderQueue &queue, const Rover &rover, bool isDay, const double model[16]) const
+{
+  rover.drawFleet(queue, bodies, wheels, beams, isDay, model);
+  rover.drawArms(queue, arms, model);
+}
+
+void Fleet::addLights(const Rover &rover, const double model[16]) const
+{
+  double m[16], placed[16];
+  for (size_t j = 0; j < drawn.size(); j++)
+  {
+    int i = drawn[j];
+    if (lamp[i] <= 0.0f)
+      continue;
+    pose(i, m);
+    if (model)
+      Matrix::multiply(placed, model, m);
+    Lights::Light light = rover.headlamp(model ? placed : m);
+    for (int k = 0; k < 3; k++)
+    {
+      light.ambient[k] *= lamp[i];
+      light.diffuse[k] *= lamp[i];
+      light.specular[k] *= lamp[i];
+    }
+    if (!Lights::add(light))
+      break;
+  }
+}
+
+int Fleet::drawnCount() const
+{
+  return (int)drawn.size();
+}
+
+const Arms &Fleet::drillArms() const
+{
+  return arms;
+}
+
+double Fleet::stepTime() const
+{
+  return steps;
+}
+
+double Fleet::placeTime() const
+{
+  return places;
+}
+
+double Fleet::uploadTime() const
+{
+  return uploads;
+}
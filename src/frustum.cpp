@@ -0,0 +1,83 @@
+#include "frustum.hpp"
+#include "matrix.hpp"
+#ifdef USEGLEW
+#include <GL/glew.h>
+#endif
+//  OpenGL with prototypes for glext
+#define GL_GLEXT_PROTOTYPES
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+// Tell Xcode IDE to not gripe about OpenGL deprecation
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#else
+#include <GL/glut.h>
+#endif
+
+Frustum Frustum::current()
+{
+  double projection[16], modelview[16];
+  int viewport[4];
+  glGetDoublev(GL_PROJECTION_MATRIX, projection);
+  glGetDoublev(GL_MODELVIEW_MATRIX, modelview);
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  return Frustum(projection, modelview, viewport[3]);
+}
+
+/*
+ *  Each plane is the last row of the clip matrix plus or minus one of the
+ *  others (Gribb and Hartmann)
+ */
+Frustum::Frustum(const double projection[16], const double modelview[16], int viewportHeight)
+{
+  double clip[16];
+  Matrix::multiply(clip, projection, modelview);
+  for (int k = 0; k < 3; k++)
+    for (int side = 0; side < 2; side++)
+    {
+      double sign = side ? -1.0 : 1.0;
+      for (int col = 0; col < 4; col++)
+        planes[2 * k + side][col] = clip[col * 4 + 3] + sign * clip[col * 4 + k];
+    }
+
+  //  The modelview is a rotation and translation, so the eye is -R^T t
+  for (int k = 0; k < 3; k++)
+    position[k] = -(modelview[k * 4 + 0] * modelview[12] + modelview[k * 4 + 1] * modelview[13] + modelview[k * 4 + 2] * modelview[14]);
+
+  //  Perspective matrices have w = -z, orthographic ones w = 1
+  ortho = projection[15] != 0.0;
+  scale = 0.5 * projection[5] * viewportHeight;
+}
+
+/*
+ *  Outside when the corner furthest along some plane's normal is behind it
+ */
+bool Frustum::intersects(const double lo[3], const double hi[3]) const
+{
+  for (int i = 0; i < 6; i++)
+  {
+    const double *p = planes[i];
+    double x = p[0] > 0 ? hi[0] : lo[0];
+    double y = p[1] > 0 ? hi[1] : lo[1];
+    double z = p[2] > 0 ? hi[2] : lo[2];
+    if (p[0] * x + p[1] * y + p[2] * z + p[3] < 0)
+      return false;
+  }
+  return true;
+}
+
+double Frustum::pixels(double length, double distance) const
+{
+  if (ortho)
+    return length * scale;
+  return distance > 0 ? length * scale / distance : 1e30;
+}
+
+bool Frustum::orthographic() const
+{
+  return ortho;
+}
+
+const double *Frustum::eye() const
+{
+  return position;
+}
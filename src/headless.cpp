@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include "headless.hpp"
+#include "scene.hpp"
+#include "util.hpp"
+#include "textures.hpp"
+#include "lights.hpp"
+#ifdef USEEGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#ifdef USEEGL
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLSurface surface = EGL_NO_SURFACE;
+static EGLContext context = EGL_NO_CONTEXT;
+
+/*
+ *  Prefer Mesa's surfaceless platform so no X server or GPU device is needed
+ */
+static EGLDisplay openDisplay()
+{
+  const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+  if (clientExtensions && strstr(clientExtensions, "EGL_MESA_platform_surfaceless"))
+  {
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+    {
+      EGLDisplay dpy = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, 0);
+      if (dpy != EGL_NO_DISPLAY && eglInitialize(dpy, 0, 0))
+        return dpy;
+    }
+  }
+  EGLDisplay dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  if (dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, 0, 0))
+    Util::Fatal("Cannot initialize EGL display (error 0x%x)\n", eglGetError());
+  return dpy;
+}
+#endif
+
+void Headless::createContext(int width, int height)
+{
+#ifdef USEEGL
+  display = openDisplay();
+
+  //  True color with Z buffering, same as the GLUT window
+  const EGLint configAttributes[] = {
+      EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+      EGL_RED_SIZE, 8,
+      EGL_GREEN_SIZE, 8,
+      EGL_BLUE_SIZE, 8,
+      EGL_DEPTH_SIZE, 24,
+      EGL_NONE};
+  EGLConfig config;
+  EGLint count = 0;
+  if (!eglChooseConfig(display, configAttributes, &config, 1, &count) || count < 1)
+    Util::Fatal("No EGL pbuffer config with depth buffer\n");
+
+  const EGLint surfaceAttributes[] = {EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE};
+  surface = eglCreatePbufferSurface(display, config, surfaceAttributes);
+  if (surface == EGL_NO_SURFACE)
+    Util::Fatal("Cannot create %dx%d EGL pbuffer (error 0x%x)\n", width, height, eglGetError());
+
+  //  Desktop OpenGL compatibility context for the fixed-function pipeline
+  eglBindAPI(EGL_OPENGL_API);
+  context = eglCreateContext(display, config, EGL_NO_CONTEXT, 0);
+  if (context == EGL_NO_CONTEXT)
+    Util::Fatal("Cannot create EGL OpenGL context (error 0x%x)\n", eglGetError());
+  if (!eglMakeCurrent(display, surface, surface, context))
+    Util::Fatal("Cannot make EGL context current (error 0x%x)\n", eglGetError());
+#else
+  Util::Fatal("Headless mode needs EGL - build on Linux with -DUSEEGL\n");
+#endif
+}
+
+void Headless::destroyContext()
+{
+#ifdef USEEGL
+  if (display == EGL_NO_DISPLAY)
+    return;
+  eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  eglDestroyContext(display, context);
+  eglDestroySurface(display, surface);
+  eglTerminate(display);
+  display = EGL_NO_DISPLAY;
+#endif
+}
+
+/*
+ *  Frame time at percentile p of sorted times
+ */
+static double percentile(const std::vector<double> &sorted, double p)
+{
+  size_t k = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+  return sorted[std::min(k, sorted.size() - 1)];
+}
+
+void Headless::run(Scene &scene, int frames)
+{
+  std::vector<double> times;
+  times.reserve(frames);
+
+  double start = Util::seconds();
+  for (int i = 0; i < frames; i++)
+  {
+    double t0 = Util::seconds();
+    scene.idle();
+    scene.draw(); // Finishes the frame since there is no swap to wait on
+    times.push_back(1000.0 * (Util::seconds() - t0));
+  }
+  double total = Util::seconds() - start;
+
+  if (times.empty())
+    return;
+  std::vector<double> sorted(times);
+  std::sort(sorted.begin(), sorted.end());
+  printf("Frames: %d\n", frames);
+  printf("Total time: %.3f s\n", total);
+  printf("Mean FPS: %.2f\n", frames / total);
+  printf("Frame time (ms): min %.3f p50 %.3f p90 %.3f p95 %.3f p99 %.3f max %.3f\n",
+         sorted.front(), percentile(sorted, 50), percentile(sorted, 90),
+         percentile(sorted, 95), percentile(sorted, 99), sorted.back());
+  printf("Resident textures: %d (%.1f MB)\n", Textures::residentCount(), Textures::residentBytes() / 1048576.0);
+  printf("Draw calls: %d  State changes: %d (last frame)\n", scene.renderQueue().drawCalls(), scene.renderQueue().stateChanges());
+  printf("Objects: %d visible %d culled (last frame)\n", scene.objects().visibleCount(), scene.objects().culledCount());
+  printf("Scene graph: %d nodes, %d moved (last frame)\n", scene.transforms().count(), scene.transforms().updatedCount());
+  printf("Particles: %d live, %s kernels (last frame)\n", scene.particleSystem().count(), Particles::kernels());
+  printf("Lights: %d, %.1f per cluster, %d at most, binned in %.2f ms (last frame)\n", Lights::count(),
+         Lights::clusterAverage(), Lights::clusterMaximum(), Lights::binTime());
+  printf("Shadows: %d cascades, %d caches and %d caster maps drawn (last frame)\n", scene.shadowMaps().cascadeCount(),
+         scene.shadowMaps().cachesDrawn(), scene.shadowMaps().castersDrawn());
+  printf("Rovers: %d, %d drawn, step %.2f ms place %.2f ms upload %.2f ms (last frame)\n", scene.rovers().count() + 1,
+         scene.rovers().drawnCount() + 1, scene.rovers().stepTime(), scene.rovers().placeTime(), scene.rovers().uploadTime());
+  printf("Arms: %d solved, %d drawn, %s kernels, solve %.2f ms (last frame)\n", scene.rovers().drillArms().count(),
+         scene.rovers().drillArms().drawnCount(), Arms::kernels(), scene.rovers().drillArms().solveTime());
+  scene.timings().report(stdout);
+}
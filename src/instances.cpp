@@ -0,0 +1,274 @@
+#include <cstddef> // For offsetof
+#include <cstring>
+#include "instances.hpp"
+#include "lights.hpp"
+#include "matrix.hpp"
+#include "mesh.hpp"
+#include "shader.hpp"
+#include "util.hpp"
+#ifdef USEGLEW
+#include <GL/glew.h>
+#endif
+//  OpenGL with prototypes for glext
+#define GL_GLEXT_PROTOTYPES
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+// Tell Xcode IDE to not gripe about OpenGL deprecation
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+// Legacy contexts only have the ARB entry point
+#define glVertexAttribDivisor glVertexAttribDivisorARB
+#else
+#include <GL/glut.h>
+#endif
+
+// Generic attribute locations clear of the ones NVIDIA aliases to
+// gl_Vertex (0), gl_Normal (2), gl_Color (3) and gl_MultiTexCoord0 (8)
+static const int REGION_LOCATION = 7;  // vec4
+static const int MODEL_LOCATION = 9;   // mat4 - 9 to 12
+static const int NORMAL_LOCATION = 13; // mat3 - 13 to 15
+
+static const char *vertexSource =
+    "#version 120\n"
+    "attribute mat4 instanceModel;\n"
+    "attribute mat3 instanceNormal;\n"
+    "attribute vec4 instanceRegion;\n"
+    "varying vec4 color;\n"
+    "varying vec3 eye;\n"
+    "varying vec3 normal;\n"
+    "void main()\n"
+    "{\n"
+    "  vec4 world = instanceModel * gl_Vertex;\n"
+    "  eye = (gl_ModelViewMatrix * world).xyz;\n"
+    "  normal = gl_NormalMatrix * (instanceNormal * gl_Normal);\n"
+    "  color = gl_Color;\n"
+    "  gl_TexCoord[0] = vec4(instanceRegion.xy + instanceRegion.zw * gl_MultiTexCoord0.st, 0.0, 1.0);\n"
+    "  gl_Position = gl_ModelViewProjectionMatrix * world;\n"
+    "}\n";
+
+static unsigned int program = 0;
+
+/*
+ *  Build the instancing program the first time it is needed
+ */
+static unsigned int instancingProgram()
+{
+  if (!program)
+  {
+    const char *attributes[] = {"instanceModel", "instanceNormal", "instanceRegion"};
+    const int locations[] = {MODEL_LOCATION, NORMAL_LOCATION, REGION_LOCATION};
+    program = Shader::program("Instances", vertexSource, Lights::fragmentSource().c_str(), 3, attributes, locations);
+  }
+  return program;
+}
+
+Instances::Instances() : vbo(0)
+{
+  middle[0] = middle[1] = middle[2] = 0.0f;
+}
+
+bool Instances::supported()
+{
+  static int available = -1;
+  if (available < 0)
+  {
+    const char *version = (const char *)glGetString(GL_VERSION);
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+    int major = version ? version[0] - '0' : 0;
+    int minor = version && version[1] == '.' ? version[2] - '0' : 0;
+    available = (major > 3 || (major == 3 && minor >= 3)) ||
+                (major >= 2 && extensions && strstr(extensions, "GL_ARB_instanced_arrays") && strstr(extensions, "GL_ARB_draw_instanced"));
+  }
+  return available;
+}
+
+/*
+ *  Instance placed by m, with the normal matrix GLSL expects
+ */
+void Instances::fill(Instance &instance, const double m[16], const float region[4])
+{
+  const float whole[4] = {0.0f, 0.0f, 1.0f, 1.0f};
+  double n[9];
+  Matrix::normalMatrix(m, n);
+  for (int k = 0; k < 16; k++)
+    instance.model[k] = (float)m[k];
+  // Rows of the normal matrix become the columns of the transposed GLSL mat3
+  for (int row = 0; row < 3; row++)
+    for (int col = 0; col < 3; col++)
+      instance.normal[col * 3 + row] = (float)n[row * 3 + col];
+  for (int k = 0; k < 4; k++)
+    instance.region[k] = region ? region[k] : whole[k];
+}
+
+void Instances::add(const double m[16], const float region[4])
+{
+  Instance instance;
+  fill(instance, m, region);
+  instances.push_back(instance);
+}
+
+void Instances::set(int i, const double m[16], const float region[4])
+{
+  fill(instances[i], m, region);
+}
+
+void Instances::resize(int count)
+{
+  double m[16];
+  Matrix::identity(m);
+  Instance instance;
+  fill(instance, m, 0);
+  instances.resize(count < 0 ? 0 : count, instance);
+}
+
+/*
+ *  Center of the instance origins
+ */
+void Instances::measure()
+{
+  float lo[3] = {0, 0, 0}, hi[3] = {0, 0, 0};
+  for (size_t i = 0; i < instances.size(); i++)
+    for (int k = 0; k < 3; k++)
+    {
+      float p = instances[i].model[12 + k];
+      lo[k] = i == 0 || p < lo[k] ? p : lo[k];
+      hi[k] = i == 0 || p > hi[k] ? p : hi[k];
+    }
+  for (int k = 0; k < 3; k++)
+    middle[k] = 0.5f * (lo[k] + hi[k]);
+}
+
+void Instances::upload()
+{
+  measure();
+  if (!supported())
+    return;
+  if (!vbo)
+    glGenBuffers(1, &vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(Instance), instances.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  Util::ErrCheck("Instances::upload");
+}
+
+/*
+ *  Replace a range in place - the buffer keeps its size, so only the
+ *  changed instances cross the bus
+ */
+void Instances::upload(int first, int count)
+{
+  measure();
+  if (!supported() || !vbo || count <= 0)
+    return;
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(Instance), count * sizeof(Instance), &instances[first]);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  Util::ErrCheck("Instances::upload");
+}
+
+void Instances::draw(const Mesh &mesh) const
+{
+  if (instances.empty())
+    return;
+
+  // Without instancing fall back to one draw per instance
+  if (!supported())
+  {
+    for (size_t i = 0; i < instances.size(); i++)
+    {
+      const float *region = instances[i].region;
+      glMatrixMode(GL_TEXTURE);
+      glLoadIdentity();
+      glTranslatef(region[0], region[1], 0.0f);
+      glScalef(region[2], region[3], 1.0f);
+      glMatrixMode(GL_MODELVIEW);
+      glPushMatrix();
+      glMultMatrixf(instances[i].model);
+      mesh.draw();
+      glPopMatrix();
+    }
+    glMatrixMode(GL_TEXTURE);
+    glLoadIdentity();
+    glMatrixMode(GL_MODELVIEW);
+    return;
+  }
+
+  unsigned int prog = instancingProgram();
+  glUseProgram(prog);
+  Shader::setFixedState(prog);
+
+  // One matrix column per attribute location, advanced once per instance
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  for (int col = 0; col < 4; col++)
+  {
+    glEnableVertexAttribArray(MODEL_LOCATION + col);
+    glVertexAttribPointer(MODEL_LOCATION + col, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                          (void *)(offsetof(Instance, model) + 4 * col * sizeof(float)));
+    glVertexAttribDivisor(MODEL_LOCATION + col, 1);
+  }
+  for (int col = 0; col < 3; col++)
+  {
+    glEnableVertexAttribArray(NORMAL_LOCATION + col);
+    glVertexAttribPointer(NORMAL_LOCATION + col, 3, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                          (void *)(offsetof(Instance, normal) + 3 * col * sizeof(float)));
+    glVertexAttribDivisor(NORMAL_LOCATION + col, 1);
+  }
+  glEnableVertexAttribArray(REGION_LOCATION);
+  glVertexAttribPointer(REGION_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void *)offsetof(Instance, region));
+  glVertexAttribDivisor(REGION_LOCATION, 1);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  mesh.drawInstanced((int)instances.size());
+
+  for (int loc = MODEL_LOCATION; loc < NORMAL_LOCATION + 3; loc++)
+  {
+    glVertexAttribDivisor(loc, 0);
+    glDisableVertexAttribArray(loc);
+  }
+  glVertexAttribDivisor(REGION_LOCATION, 0);
+  glDisableVertexAttribArray(REGION_LOCATION);
+  glUseProgram(0);
+}
+
+void Instances::clear()
+{
+  instances.clear();
+  if (vbo)
+    glDeleteBuffers(1, &vbo);
+  vbo = 0;
+}
+
+int Instances::count() const
+{
+  return (int)instances.size();
+}
+
+void Instances::center(double c[3]) const
+{
+  for (int k = 0; k < 3; k++)
+    c[k] = middle[k];
+}
+
+/*
+ *  Union of the mesh's box corners placed by each instance
+ */
+void Instances::bounds(const Mesh &mesh, double lo[3], double hi[3]) const
+{
+  double box[2][3];
+  mesh.bounds(box[0], box[1]);
+  for (int k = 0; k < 3; k++)
+    lo[k] = hi[k] = 0.0;
+  for (size_t i = 0; i < instances.size(); i++)
+  {
+    const float *m = instances[i].model;
+    for (int corner = 0; corner < 8; corner++)
+    {
+      double p[3] = {box[corner & 1][0], box[(corner >> 1) & 1][1], box[corner >> 2][2]};
+      for (int k = 0; k < 3; k++)
+      {
+        double v = m[k] * p[0] + m[4 + k] * p[1] + m[8 + k] * p[2] + m[12 + k];
+        lo[k] = (i == 0 && corner == 0) || v < lo[k] ? v : lo[k];
+        hi[k] = (i == 0 && corner == 0) || v > hi[k] ? v : hi[k];
+      }
+    }
+  }
+}
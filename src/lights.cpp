@@ -0,0 +1,712 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "lights.hpp"
+#include "workers.hpp"
+#include "util.hpp"
+#ifdef USEGLEW
+#include <GL/glew.h>
+#endif
+//  OpenGL with prototypes for glext
+#define GL_GLEXT_PROTOTYPES
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+// Tell Xcode IDE to not gripe about OpenGL deprecation
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#else
+#include <GL/glut.h>
+#endif
+
+/*
+ *  Layout of the uniform data, in vec4s
+ *    0:   scene ambient rgb | global light count
+ *    1:   tile width, tile height in pixels | viewport x, y
+ *    2:   tiles across, tiles up, depth slices | binned light count
+ *    3:   slice scale, slice bias | perspective | 0
+ *    4:   rows of the light texture, rows of the index texture | 0 | 0
+ *    5:   shadow cascades, shadowed global light or -1, texel size | 0
+ *    6:   eye depth where each cascade ends
+ *    7:   offset along the normal each cascade looks up from
+ *    8+:  eye to shadow map matrix of each cascade, by columns
+ *    24+: global lights, PER_LIGHT vec4s each
+ *  A light, here or as a row of the light texture, is
+ *    position | ambient rgb, spot exponent | diffuse rgb, spot cosine cutoff
+ *    (below -1 for none) | specular rgb | attenuation | spot direction
+ */
+static const int PER_LIGHT = 6;
+static const int CLUSTER_ROWS = 4;
+static const int SHADOW = 1 + CLUSTER_ROWS;
+static const int HEADER = SHADOW + 3 + 4 * Lights::MAX_CASCADES;
+static const int MAX_GLOBAL = 8;
+static const int VEC4S = HEADER + PER_LIGHT * MAX_GLOBAL;
+//  Uniform buffer binding point the light block is read from
+static const int BINDING = 0;
+
+//  Froxel grid - screen tiles by depth slices, the slices thinner near the eye
+static const int TILES_X = 16;
+static const int TILES_Y = 9;
+static const int SLICES = 24;
+static const int TILES = TILES_X * TILES_Y;
+//  Texels across the index texture, each holding four light indices
+static const int INDEX_WIDTH = 1024;
+//  Texture units the binned data is read from - 0 has the material, 1 the terrain heights
+static const int LIGHT_UNIT = 2;
+static const int CLUSTER_UNIT = 3;
+static const int INDEX_UNIT = 4;
+//  A light is binned as far as it adds more than this to a color channel
+static const double THRESHOLD = 1.0 / 256.0;
+
+static float data[4 * VEC4S];
+static int globals = 0;
+static int shadowed = -1; // Global shadowed by the cascades
+static double view[16], projection[16];
+static int viewport[4];
+static bool lit = false;
+
+//  Binned lights packed like the globals, with their reach and froxel ranges
+struct Range
+{
+  int x0, x1, y0, y1, z0, z1;
+};
+static std::vector<float> binned;
+static std::vector<double> reach;
+static std::vector<Range> ranges;
+
+//  Lights of each froxel of a slice, froxel by froxel
+struct Slice
+{
+  std::vector<float> indices;
+  int first[TILES], count[TILES];
+};
+static Slice slices[SLICES];
+static std::vector<float> clusterData, indexData;
+static double average = 0.0, binning = 0.0;
+static int maximum = 0;
+
+static unsigned int ubo = 0;
+static unsigned int lightTexture = 0, clusterTexture = 0, indexTexture = 0;
+static int lightRows = 0, indexRows = 0; // Texture heights allocated
+static int generation = 0;               // Bumped on every upload
+//  Programs seen by apply and the generation they last copied
+static std::vector<std::pair<unsigned int, int>> programs;
+
+/*
+ *  Uniform buffers can be read from GLSL 1.20 shaders
+ */
+static bool buffered()
+{
+  static int available = -1;
+  if (available < 0)
+  {
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+    available = 0;
+#ifdef GL_UNIFORM_BUFFER
+    available = extensions && strstr(extensions, "GL_ARB_uniform_buffer_object") != 0;
+#endif
+  }
+  return available;
+}
+
+/*
+ *  Float textures hold the binned lights and their lists
+ */
+static bool clustered()
+{
+  static int available = -1;
+  if (available < 0)
+  {
+    const char *version = (const char *)glGetString(GL_VERSION);
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+    available = 0;
+#ifdef GL_RGBA32F_ARB
+    available = (version && version[0] >= '3') || (extensions && strstr(extensions, "GL_ARB_texture_float"));
+#endif
+  }
+  return available;
+}
+
+/*
+ *  Light in the uniform layout, in eye coordinates
+ */
+static void pack(const Lights::Light &light, float out[4 * PER_LIGHT])
+{
+  const float *p = light.position;
+  for (int k = 0; k < 4; k++)
+    out[k] = (float)(view[k] * p[0] + view[4 + k] * p[1] + view[8 + k] * p[2] + view[12 + k] * p[3]);
+  double d[3], len = 0.0;
+  for (int k = 0; k < 3; k++)
+  {
+    d[k] = view[k] * light.direction[0] + view[4 + k] * light.direction[1] + view[8 + k] * light.direction[2];
+    len += d[k] * d[k];
+  }
+  len = len > 0.0 ? sqrt(len) : 1.0;
+
+  for (int k = 0; k < 3; k++)
+  {
+    out[4 + k] = light.ambient[k];
+    out[8 + k] = light.diffuse[k];
+    out[12 + k] = light.specular[k];
+    out[16 + k] = light.attenuation[k];
+    out[20 + k] = (float)(d[k] / len);
+  }
+  out[7] = light.exponent;
+  out[11] = light.cutoff >= 180.0f ? -2.0f : (float)cos(light.cutoff * 3.14159265 / 180.0);
+  out[15] = out[19] = out[23] = 0.0f;
+}
+
+/*
+ *  Distance where the light falls below the threshold, negative when it never does
+ */
+static double lightReach(const Lights::Light &light)
+{
+  double brightest = 0.0;
+  for (int k = 0; k < 3; k++)
+  {
+    double sum = light.ambient[k] + light.diffuse[k] + light.specular[k];
+    brightest = sum > brightest ? sum : brightest;
+  }
+  //  Solve c + l d + q d^2 = brightest / THRESHOLD
+  double c = light.attenuation[0] - brightest / THRESHOLD, l = light.attenuation[1], q = light.attenuation[2];
+  if (c >= 0.0)
+    return 0.0;
+  if (q > 0.0)
+    return (-l + sqrt(l * l - 4.0 * q * c)) / (2.0 * q);
+  if (l > 0.0)
+    return -c / l;
+  return -1.0;
+}
+
+void Lights::begin()
+{
+  glGetDoublev(GL_MODELVIEW_MATRIX, view);
+  glGetDoublev(GL_PROJECTION_MATRIX, projection);
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  globals = 0;
+  shadowed = -1;
+  binned.clear();
+  reach.clear();
+  data[0] = data[1] = data[2] = 0.2f;
+}
+
+bool Lights::add(const Light &light, bool shadow)
+{
+  double r = light.position[3] == 0.0f ? -1.0 : lightReach(light);
+  if (r == 0.0)
+    return true;
+  //  Lights that reach everything are evaluated by every fragment
+  if (r < 0.0 || !clustered())
+  {
+    if (globals >= MAX_GLOBAL)
+      return false;
+    pack(light, data + 4 * (HEADER + PER_LIGHT * globals));
+    if (shadow && shadowed < 0)
+      shadowed = globals;
+    globals++;
+    return true;
+  }
+  if ((int)reach.size() >= MAX_LIGHTS)
+    return false;
+  binned.resize(binned.size() + 4 * PER_LIGHT);
+  pack(light, &binned[binned.size() - 4 * PER_LIGHT]);
+  reach.push_back(r);
+  return true;
+}
+
+void Lights::shadow(int cascades, const float ends[], const float offsets[], const float matrices[], float texel)
+{
+  float *row = data + 4 * SHADOW;
+  int n = cascades < MAX_CASCADES ? cascades : MAX_CASCADES;
+  memset(row, 0, 4 * (HEADER - SHADOW) * sizeof(float));
+  row[0] = (float)n;
+  row[2] = texel;
+  for (int c = 0; c < n; c++)
+  {
+    row[4 + c] = ends[c];
+    row[8 + c] = offsets[c];
+    memcpy(row + 12 + 16 * c, matrices + 16 * c, 16 * sizeof(float));
+  }
+}
+
+void Lights::setAmbient(float r, float g, float b)
+{
+  data[0] = r;
+  data[1] = g;
+  data[2] = b;
+}
+
+static bool perspective()
+{
+  return projection[15] == 0.0;
+}
+
+/*
+ *  Depth slice of a distance in front of the eye
+ */
+static int sliceOf(double depth, double scale, double bias)
+{
+  double s = (perspective() ? log(depth) : depth) * scale + bias;
+  return s < 0.0 ? 0 : s >= SLICES ? SLICES - 1 : (int)s;
+}
+
+/*
+ *  Froxels each light's sphere touches - false when it is out of view
+ */
+static bool bound(int light, double nearPlane, double farPlane, double scale, double bias, Range &range)
+{
+  const float *c = &binned[4 * PER_LIGHT * light];
+  double r = reach[light];
+  double nearest = -c[2] - r, farthest = -c[2] + r;
+  if (farthest < nearPlane || nearest > farPlane)
+    return false;
+  range.z0 = sliceOf(nearest > nearPlane ? nearest : nearPlane, scale, bias);
+  range.z1 = sliceOf(farthest < farPlane ? farthest : farPlane, scale, bias);
+
+  //  Spheres around the eye cover the whole screen, others are bounded by
+  //  the corners of their box on screen
+  double lo[2] = {-1.0, -1.0}, hi[2] = {1.0, 1.0};
+  if (!perspective() || nearest > nearPlane)
+  {
+    for (int corner = 0; corner < 8; corner++)
+    {
+      double p[3] = {c[0] + (corner & 1 ? r : -r), c[1] + (corner & 2 ? r : -r), c[2] + (corner & 4 ? r : -r)};
+      double clip[4];
+      for (int k = 0; k < 4; k++)
+        clip[k] = projection[k] * p[0] + projection[4 + k] * p[1] + projection[8 + k] * p[2] + projection[12 + k];
+      for (int k = 0; k < 2; k++)
+      {
+        double ndc = clip[k] / clip[3];
+        lo[k] = corner == 0 || ndc < lo[k] ? ndc : lo[k];
+        hi[k] = corner == 0 || ndc > hi[k] ? ndc : hi[k];
+      }
+    }
+    if (hi[0] < -1.0 || lo[0] > 1.0 || hi[1] < -1.0 || lo[1] > 1.0)
+      return false;
+  }
+  int tiles[2] = {TILES_X, TILES_Y}, first[2], last[2];
+  for (int k = 0; k < 2; k++)
+  {
+    first[k] = (int)floor((0.5 * lo[k] + 0.5) * tiles[k]);
+    last[k] = (int)floor((0.5 * hi[k] + 0.5) * tiles[k]);
+    first[k] = first[k] < 0 ? 0 : first[k];
+    last[k] = last[k] >= tiles[k] ? tiles[k] - 1 : last[k];
+  }
+  range.x0 = first[0];
+  range.x1 = last[0];
+  range.y0 = first[1];
+  range.y1 = last[1];
+  return true;
+}
+
+/*
+ *  Lists of the froxels in one slice - slices share nothing, so any thread can take one
+ */
+static void binSlice(int z)
+{
+  Slice &slice = slices[z];
+  memset(slice.count, 0, sizeof(slice.count));
+  for (size_t i = 0; i < ranges.size(); i++)
+  {
+    const Range &r = ranges[i];
+    if (z < r.z0 || z > r.z1)
+      continue;
+    for (int y = r.y0; y <= r.y1; y++)
+      for (int x = r.x0; x <= r.x1; x++)
+        slice.count[y * TILES_X + x]++;
+  }
+  int total = 0;
+  for (int t = 0; t < TILES; t++)
+  {
+    slice.first[t] = total;
+    total += slice.count[t];
+  }
+  slice.indices.resize(total);
+
+  int at[TILES];
+  memcpy(at, slice.first, sizeof(at));
+  for (size_t i = 0; i < ranges.size(); i++)
+  {
+    const Range &r = ranges[i];
+    if (z < r.z0 || z > r.z1)
+      continue;
+    for (int y = r.y0; y <= r.y1; y++)
+      for (int x = r.x0; x <= r.x1; x++)
+        slice.indices[at[y * TILES_X + x]++] = (float)i;
+  }
+}
+
+/*
+ *  Float texture of the given size with exact texel reads
+ */
+static void allocate(unsigned int &texture, int width, int height)
+{
+#ifdef GL_RGBA32F_ARB
+  if (!texture)
+    glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F_ARB, width, height, 0, GL_RGBA, GL_FLOAT, 0);
+#endif
+}
+
+/*
+ *  Bin the lights into the froxels of this view and upload the lists
+ */
+static void bin()
+{
+  double start = Util::seconds();
+  int n = (int)reach.size();
+
+  //  Eye distances the projection keeps and the slice of a distance
+  double nearPlane, farPlane, scale, bias;
+  if (perspective())
+  {
+    nearPlane = projection[14] / (projection[10] - 1.0);
+    farPlane = projection[14] / (projection[10] + 1.0);
+    scale = SLICES / log(farPlane / nearPlane);
+    bias = -log(nearPlane) * scale;
+  }
+  else
+  {
+    nearPlane = (projection[14] + 1.0) / projection[10];
+    farPlane = (projection[14] - 1.0) / projection[10];
+    scale = SLICES / (farPlane - nearPlane);
+    bias = -nearPlane * scale;
+  }
+
+  ranges.resize(n);
+  int visible = 0;
+  std::vector<int> kept;
+  for (int i = 0; i < n; i++)
+    if (bound(i, nearPlane, farPlane, scale, bias, ranges[visible]))
+    {
+      kept.push_back(i);
+      visible++;
+    }
+  ranges.resize(visible);
+  binning = 1000.0 * (Util::seconds() - start);
+  //  Nothing to bin leaves the froxels off in the header
+  if (visible == 0)
+    return;
+  //  Only lights in view go to the texture, in the order of their ranges
+  for (int i = 0; i < visible; i++)
+    if (kept[i] != i)
+      memcpy(&binned[4 * PER_LIGHT * i], &binned[4 * PER_LIGHT * kept[i]], 4 * PER_LIGHT * sizeof(float));
+
+  //  Slices are binned on the workers and this thread
+  Workers::parallelFor(SLICES, binSlice);
+
+  //  Offsets into one index list, slice after slice
+  clusterData.assign(4 * TILES * SLICES, 0.0f);
+  int total = 0, reached = 0;
+  maximum = 0;
+  for (int z = 0; z < SLICES; z++)
+  {
+    const Slice &slice = slices[z];
+    for (int t = 0; t < TILES; t++)
+    {
+      float *cell = &clusterData[4 * (z * TILES + t)];
+      cell[0] = (float)(total + slice.first[t]);
+      cell[1] = (float)slice.count[t];
+      reached += slice.count[t] > 0;
+      maximum = slice.count[t] > maximum ? slice.count[t] : maximum;
+    }
+    total += (int)slice.indices.size();
+  }
+  average = reached ? (double)total / reached : 0.0;
+
+  int rows = (total + 4 * INDEX_WIDTH - 1) / (4 * INDEX_WIDTH);
+  rows = rows < 1 ? 1 : rows;
+  indexData.resize(4 * INDEX_WIDTH * rows);
+  for (int z = 0, at = 0; z < SLICES; z++)
+  {
+    const std::vector<float> &indices = slices[z].indices;
+    if (!indices.empty())
+      memcpy(&indexData[at], indices.data(), indices.size() * sizeof(float));
+    at += (int)indices.size();
+  }
+
+  //  Textures only grow, by doubling
+  if (!clusterTexture)
+    allocate(clusterTexture, TILES, SLICES);
+  if (lightRows < visible)
+  {
+    lightRows = lightRows ? lightRows : 64;
+    while (lightRows < visible)
+      lightRows *= 2;
+    allocate(lightTexture, PER_LIGHT, lightRows);
+  }
+  if (indexRows < rows)
+  {
+    indexRows = indexRows ? indexRows : 1;
+    while (indexRows < rows)
+      indexRows *= 2;
+    allocate(indexTexture, INDEX_WIDTH, indexRows);
+  }
+
+  glActiveTexture(GL_TEXTURE0 + CLUSTER_UNIT);
+  glBindTexture(GL_TEXTURE_2D, clusterTexture);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, TILES, SLICES, GL_RGBA, GL_FLOAT, clusterData.data());
+  glActiveTexture(GL_TEXTURE0 + LIGHT_UNIT);
+  glBindTexture(GL_TEXTURE_2D, lightTexture);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, PER_LIGHT, visible, GL_RGBA, GL_FLOAT, binned.data());
+  glActiveTexture(GL_TEXTURE0 + INDEX_UNIT);
+  glBindTexture(GL_TEXTURE_2D, indexTexture);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, INDEX_WIDTH, rows, GL_RGBA, GL_FLOAT, indexData.data());
+  glActiveTexture(GL_TEXTURE0);
+
+  float header[4 * CLUSTER_ROWS] = {
+      (float)viewport[2] / TILES_X, (float)viewport[3] / TILES_Y, (float)viewport[0], (float)viewport[1],
+      (float)TILES_X, (float)TILES_Y, (float)SLICES, (float)visible,
+      (float)scale, (float)bias, perspective() ? 1.0f : 0.0f, 0.0f,
+      (float)lightRows, (float)indexRows, 0.0f, 0.0f};
+  memcpy(data + 4, header, sizeof(header));
+  binning = 1000.0 * (Util::seconds() - start);
+}
+
+void Lights::upload()
+{
+  data[3] = (float)globals;
+  data[4 * SHADOW + 1] = (float)shadowed;
+  memset(data + 4, 0, 4 * CLUSTER_ROWS * sizeof(float));
+  average = binning = 0.0;
+  maximum = 0;
+  if (clustered())
+    bin();
+
+  generation++;
+#ifdef GL_UNIFORM_BUFFER
+  if (buffered())
+  {
+    if (!ubo)
+    {
+      glGenBuffers(1, &ubo);
+      glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+      glBufferData(GL_UNIFORM_BUFFER, sizeof(data), 0, GL_DYNAMIC_DRAW);
+      glBindBufferBase(GL_UNIFORM_BUFFER, BINDING, ubo);
+    }
+    //  Only the global lights in use
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, 4 * (HEADER + PER_LIGHT * globals) * sizeof(float), data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  }
+#endif
+  Util::ErrCheck("Lights::upload");
+}
+
+int Lights::count()
+{
+  return globals + (int)reach.size();
+}
+
+double Lights::clusterAverage()
+{
+  return average;
+}
+
+int Lights::clusterMaximum()
+{
+  return maximum;
+}
+
+double Lights::binTime()
+{
+  return binning;
+}
+
+void Lights::enable(bool on)
+{
+  lit = on;
+}
+
+bool Lights::enabled()
+{
+  return lit;
+}
+
+/*
+ *  Emission + scene ambient + per light ambient, diffuse and specular with
+ *  attenuation and spotlight falloff, the viewer far away along +Z. The
+ *  global lights come first, then the lights binned to the fragment's froxel.
+ *  The shadowed global light only adds its ambient where the cascade
+ *  covering the fragment has something nearer the light - looked up a little
+ *  along the normal against acne and softened over four filtered taps
+ */
+static const char *shadeSource =
+    "uniform bool lighting;\n"
+    "uniform sampler2D lightTexels;\n"
+    "uniform sampler2D clusterTexels;\n"
+    "uniform sampler2D indexTexels;\n"
+    "uniform sampler2DShadow shadow0, shadow1, shadow2, shadow3;\n"
+    "vec3 contribution(vec4 position, vec4 ambient, vec4 diffuse, vec4 specular, vec4 attenuation, vec4 direction,\n"
+    "                  vec3 eye, vec3 normal, vec3 color, float visible)\n"
+    "{\n"
+    "  vec3 L = position.xyz - eye * position.w;\n"
+    "  float d = length(L);\n"
+    "  L /= d;\n"
+    "  float factor = 1.0;\n"
+    "  if (position.w != 0.0)\n"
+    "  {\n"
+    "    factor = 1.0 / (attenuation.x + d * (attenuation.y + d * attenuation.z));\n"
+    "    if (diffuse.w > -1.5)\n"
+    "    {\n"
+    "      float spot = dot(-L, direction.xyz);\n"
+    "      factor *= spot < diffuse.w ? 0.0 : pow(spot, ambient.w);\n"
+    "    }\n"
+    "  }\n"
+    "  float NdotL = max(dot(normal, L), 0.0);\n"
+    "  vec3 light = (ambient.rgb + visible * NdotL * diffuse.rgb) * color;\n"
+    "  if (NdotL > 0.0)\n"
+    "  {\n"
+    "    float NdotH = max(dot(normal, normalize(L + vec3(0.0, 0.0, 1.0))), 0.0);\n"
+    "    light += visible * pow(NdotH, gl_FrontMaterial.shininess) * specular.rgb * gl_FrontMaterial.specular.rgb;\n"
+    "  }\n"
+    "  return factor * light;\n"
+    "}\n"
+    "float filtered(sampler2DShadow map, vec3 p, float texel)\n"
+    "{\n"
+    "  float h = 0.5 * texel;\n"
+    "  return 0.25 * (shadow2D(map, p + vec3(-h, -h, 0.0)).r + shadow2D(map, p + vec3(h, -h, 0.0)).r +\n"
+    "                 shadow2D(map, p + vec3(-h, h, 0.0)).r + shadow2D(map, p + vec3(h, h, 0.0)).r);\n"
+    "}\n"
+    "float shadow(vec3 eye, vec3 normal)\n"
+    "{\n"
+    "  vec4 cascades = lightData[5], ends = lightData[6], offsets = lightData[7];\n"
+    "  float depth = -eye.z;\n"
+    "  int c = depth < ends.x ? 0 : depth < ends.y ? 1 : depth < ends.z ? 2 : depth < ends.w ? 3 : 4;\n"
+    "  if (c >= int(cascades.x))\n"
+    "    return 1.0;\n"
+    "  float offset = c == 0 ? offsets.x : c == 1 ? offsets.y : c == 2 ? offsets.z : offsets.w;\n"
+    "  int at = 8 + 4 * c;\n"
+    "  vec4 p = mat4(lightData[at], lightData[at + 1], lightData[at + 2], lightData[at + 3]) *\n"
+    "           vec4(eye + offset * normal, 1.0);\n"
+    "  if (any(lessThan(p.xyz, vec3(0.0))) || any(greaterThan(p.xyz, vec3(1.0))))\n"
+    "    return 1.0;\n"
+    "  return c == 0 ? filtered(shadow0, p.xyz, cascades.z) : c == 1 ? filtered(shadow1, p.xyz, cascades.z) :\n"
+    "         c == 2 ? filtered(shadow2, p.xyz, cascades.z) : filtered(shadow3, p.xyz, cascades.z);\n"
+    "}\n"
+    "vec4 texel(sampler2D t, float x, float y, vec2 size)\n"
+    "{\n"
+    "  return texture2D(t, (vec2(x, y) + 0.5) / size);\n"
+    "}\n"
+    "vec4 shade(vec3 eye, vec3 normal, vec4 color)\n"
+    "{\n"
+    "  if (!lighting)\n"
+    "    return color;\n"
+    "  vec3 result = gl_FrontMaterial.emission.rgb + lightData[0].rgb * color.rgb;\n"
+    "  int count = int(lightData[0].w), shadowed = int(lightData[5].y);\n"
+    "  for (int i = 0; i < count; i++)\n"
+    "  {\n"
+    "    int at = LIGHT_HEADER + 6 * i;\n"
+    "    result += contribution(lightData[at], lightData[at + 1], lightData[at + 2], lightData[at + 3],\n"
+    "                           lightData[at + 4], lightData[at + 5], eye, normal, color.rgb,\n"
+    "                           i == shadowed ? shadow(eye, normal) : 1.0);\n"
+    "  }\n"
+    "  vec4 tiles = lightData[1], grid = lightData[2], slicing = lightData[3], rows = lightData[4];\n"
+    "  if (grid.w > 0.0)\n"
+    "  {\n"
+    "    vec2 tile = min(floor((gl_FragCoord.xy - tiles.zw) / tiles.xy), grid.xy - 1.0);\n"
+    "    float depth = slicing.z > 0.5 ? log(max(-eye.z, 1e-4)) : -eye.z;\n"
+    "    float slice = clamp(floor(depth * slicing.x + slicing.y), 0.0, grid.z - 1.0);\n"
+    "    vec4 froxel = texel(clusterTexels, tile.x + tile.y * grid.x, slice, vec2(grid.x * grid.y, grid.z));\n"
+    "    for (float k = 0.0; k < froxel.y; k += 1.0)\n"
+    "    {\n"
+    //     Four indices per texel
+    "      float i = froxel.x + k;\n"
+    "      float t = floor(i / 4.0);\n"
+    "      vec4 four = texel(indexTexels, mod(t, 1024.0), floor(t / 1024.0), vec2(1024.0, rows.y));\n"
+    "      float lane = i - 4.0 * t;\n"
+    "      float light = lane < 0.5 ? four.x : lane < 1.5 ? four.y : lane < 2.5 ? four.z : four.w;\n"
+    "      vec2 size = vec2(6.0, rows.x);\n"
+    "      result += contribution(texel(lightTexels, 0.0, light, size), texel(lightTexels, 1.0, light, size),\n"
+    "                             texel(lightTexels, 2.0, light, size), texel(lightTexels, 3.0, light, size),\n"
+    "                             texel(lightTexels, 4.0, light, size), texel(lightTexels, 5.0, light, size),\n"
+    "                             eye, normal, color.rgb, 1.0);\n"
+    "    }\n"
+    "  }\n"
+    "  return vec4(result, color.a);\n"
+    "}\n";
+
+//  Lit fragment shader - shaded vertex color, optionally modulated or
+//  replaced by the bound texture
+static const char *litSource =
+    "uniform bool textured;\n"
+    "uniform bool replace;\n"
+    "uniform sampler2D tex;\n"
+    "varying vec4 color;\n"
+    "varying vec3 eye;\n"
+    "varying vec3 normal;\n"
+    "void main()\n"
+    "{\n"
+    "  vec4 texel = textured ? texture2D(tex, gl_TexCoord[0].st) : vec4(1.0);\n"
+    "  gl_FragColor = textured && replace ? texel : shade(eye, normalize(normal), color) * texel;\n"
+    "}\n";
+
+const std::string &Lights::source()
+{
+  static std::string glsl;
+  if (glsl.empty())
+  {
+    char declaration[256];
+    if (buffered())
+      snprintf(declaration, sizeof(declaration),
+               "#version 120\n"
+               "#extension GL_ARB_uniform_buffer_object : require\n"
+               "#define LIGHT_HEADER %d\n"
+               "layout(std140) uniform LightBlock\n"
+               "{\n"
+               "  vec4 lightData[%d];\n"
+               "};\n",
+               HEADER, VEC4S);
+    else
+      snprintf(declaration, sizeof(declaration), "#version 120\n#define LIGHT_HEADER %d\nuniform vec4 lightData[%d];\n",
+               HEADER, VEC4S);
+    glsl = std::string(declaration) + shadeSource;
+  }
+  return glsl;
+}
+
+const std::string &Lights::fragmentSource()
+{
+  static std::string glsl;
+  if (glsl.empty())
+    glsl = source() + litSource;
+  return glsl;
+}
+
+void Lights::apply(unsigned int program)
+{
+  glUniform1i(glGetUniformLocation(program, "lighting"), lit);
+
+  size_t i = 0;
+  while (i < programs.size() && programs[i].first != program)
+    i++;
+  if (i == programs.size())
+  {
+    programs.push_back(std::make_pair(program, -1));
+    glUniform1i(glGetUniformLocation(program, "lightTexels"), LIGHT_UNIT);
+    glUniform1i(glGetUniformLocation(program, "clusterTexels"), CLUSTER_UNIT);
+    glUniform1i(glGetUniformLocation(program, "indexTexels"), INDEX_UNIT);
+    const char *maps[MAX_CASCADES] = {"shadow0", "shadow1", "shadow2", "shadow3"};
+    for (int c = 0; c < MAX_CASCADES; c++)
+      glUniform1i(glGetUniformLocation(program, maps[c]), SHADOW_UNIT + c);
+  }
+  if (programs[i].second == generation)
+    return;
+
+  //  A buffer only needs connecting once, a copy is made after every upload
+#ifdef GL_UNIFORM_BUFFER
+  if (buffered())
+  {
+    if (programs[i].second < 0)
+      glUniformBlockBinding(program, glGetUniformBlockIndex(program, "LightBlock"), BINDING);
+    programs[i].second = generation;
+    return;
+  }
+#endif
+  glUniform4fv(glGetUniformLocation(program, "lightData"), HEADER + PER_LIGHT * globals, data);
+  programs[i].second = generation;
+}
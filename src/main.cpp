@@ -1,4 +1,10 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "scene.hpp"
+#include "util.hpp"
+#include "headless.hpp"
+#include "textures.hpp"
 #ifdef USEGLEW
 #include <GL/glew.h>
 #endif
@@ -57,15 +63,70 @@ void idle()
   scene.idle();
 }
 
+/*
+ *  Render a fixed number of frames offscreen and print timings
+ */
+static int runHeadless(int frames, int width, int height, bool simThread)
+{
+  Util::headless = true;
+  if (simThread)
+    scene.startSimulationThread();
+  Headless::createContext(width, height);
+  scene.loadTextures();
+  //  Measure steady state frames rather than placeholders
+  Textures::finish();
+  scene.reshape(width, height);
+  Headless::run(scene, frames);
+  Headless::destroyContext();
+  return 0;
+}
+
 /*
  *  Start up GLUT and tell it what to do
+ *  --headless [--frames N] [--size WxH] renders offscreen instead
+ *  --sim-thread steps the world on its own thread
+ *  --rocks N scatters N rocks instead of the default field
+ *  --lights N puts N lamps beside the track instead of the default
+ *  --rovers N drives N rovers in a convoy instead of one
  */
 int main(int argc, char *argv[])
 {
+  //  Offscreen benchmark options
+  bool headless = false;
+  bool simThread = false;
+  int frames = 300;
+  int width = 800, height = 800;
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--headless"))
+      headless = true;
+    else if (!strcmp(argv[i], "--sim-thread"))
+      simThread = true;
+    else if (!strcmp(argv[i], "--rocks") && i + 1 < argc)
+      scene.setRockCount(atoi(argv[++i]));
+    else if (!strcmp(argv[i], "--lights") && i + 1 < argc)
+      scene.setLightCount(atoi(argv[++i]));
+    else if (!strcmp(argv[i], "--rovers") && i + 1 < argc)
+      scene.setRoverCount(atoi(argv[++i]));
+    else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+    {
+      frames = atoi(argv[++i]);
+      if (frames < 1)
+        Util::Fatal("Frames must be at least 1, got %s\n", argv[i]);
+    }
+    else if (!strcmp(argv[i], "--size") && i + 1 < argc)
+    {
+      if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width < 1 || height < 1)
+        Util::Fatal("Size must be WxH, got %s\n", argv[i]);
+    }
+  }
+  if (headless)
+    return runHeadless(frames, width, height, simThread);
+
   //  Initialize GLUT and process user parameters
   glutInit(&argc, argv);
   //  Request double buffered, true color window with Z buffering at 600x600
-  glutInitWindowSize(800, 800);
+  glutInitWindowSize(width, height);
   glutInitDisplayMode(GLUT_RGB | GLUT_DEPTH | GLUT_DOUBLE);
   //  Create the window
   glutCreateWindow("Perserverance Turner Naef");
@@ -86,6 +147,8 @@ int main(int argc, char *argv[])
   glutIdleFunc(idle);
 
   scene.loadTextures();
+  if (simThread)
+    scene.startSimulationThread();
 
   glutMainLoop();
   return 0;
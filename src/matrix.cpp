@@ -0,0 +1,197 @@
+#include <cmath>
+#include <cstring>
+#include "matrix.hpp"
+#include "util.hpp"
+
+void Matrix::identity(double m[16])
+{
+  memset(m, 0, 16 * sizeof(double));
+  m[0] = m[5] = m[10] = m[15] = 1.0;
+}
+
+void Matrix::multiply(double out[16], const double a[16], const double b[16])
+{
+  double r[16];
+  for (int col = 0; col < 4; col++)
+    for (int row = 0; row < 4; row++)
+      r[col * 4 + row] = a[0 * 4 + row] * b[col * 4 + 0] +
+                         a[1 * 4 + row] * b[col * 4 + 1] +
+                         a[2 * 4 + row] * b[col * 4 + 2] +
+                         a[3 * 4 + row] * b[col * 4 + 3];
+  // Copy last so out may alias a or b
+  memcpy(out, r, sizeof(r));
+}
+
+/*
+ *  Inverse by cofactors - the adjugate over the determinant
+ */
+bool Matrix::invert(double out[16], const double m[16])
+{
+  double r[16];
+  r[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] + m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+  r[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15] - m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+  r[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] + m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+  r[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14] - m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+  r[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15] - m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+  r[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] + m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+  r[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15] - m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+  r[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] + m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+  r[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15] + m[5] * m[3] * m[14] + m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+  r[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15] - m[4] * m[3] * m[14] - m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+  r[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15] + m[4] * m[3] * m[13] + m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+  r[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14] - m[4] * m[2] * m[13] - m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+  r[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11] - m[5] * m[3] * m[10] - m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+  r[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11] + m[4] * m[3] * m[10] + m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+  r[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11] - m[4] * m[3] * m[9] - m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+  r[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10] + m[4] * m[2] * m[9] + m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+
+  double det = m[0] * r[0] + m[1] * r[4] + m[2] * r[8] + m[3] * r[12];
+  if (det == 0.0)
+    return false;
+  for (int k = 0; k < 16; k++)
+    out[k] = r[k] / det;
+  return true;
+}
+
+void Matrix::translate(double m[16], double x, double y, double z)
+{
+  double t[16];
+  identity(t);
+  t[12] = x;
+  t[13] = y;
+  t[14] = z;
+  multiply(m, m, t);
+}
+
+/*
+ *  Rotate by angle (degrees) about the axis (x,y,z) - same formula as glRotate
+ */
+void Matrix::rotate(double m[16], double angle, double x, double y, double z)
+{
+  double len = sqrt(x * x + y * y + z * z);
+  if (len == 0.0)
+    return;
+  x /= len;
+  y /= len;
+  z /= len;
+
+  double c = cos(Util::degToRad(angle));
+  double s = sin(Util::degToRad(angle));
+  double r[16];
+  identity(r);
+  r[0] = x * x * (1 - c) + c;
+  r[1] = y * x * (1 - c) + z * s;
+  r[2] = x * z * (1 - c) - y * s;
+  r[4] = x * y * (1 - c) - z * s;
+  r[5] = y * y * (1 - c) + c;
+  r[6] = y * z * (1 - c) + x * s;
+  r[8] = x * z * (1 - c) + y * s;
+  r[9] = y * z * (1 - c) - x * s;
+  r[10] = z * z * (1 - c) + c;
+  multiply(m, m, r);
+}
+
+void Matrix::scale(double m[16], double x, double y, double z)
+{
+  double s[16];
+  identity(s);
+  s[0] = x;
+  s[5] = y;
+  s[10] = z;
+  multiply(m, m, s);
+}
+
+/*
+ *  The turn taking +Y onto the unit direction u is c I + [v]x + v v^T / (1 + c)
+ *  with v = Y x u and c = u.y - the rotation about v by acos(c), without the
+ *  acos, sin and cos
+ */
+void Matrix::segment(double m[16], const double start[3], const double end[3], double width)
+{
+  double d[3] = {end[0] - start[0], end[1] - start[1], end[2] - start[2]};
+  double length = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+  double u[3] = {0.0, 1.0, 0.0};
+  if (length > 0.0)
+    for (int k = 0; k < 3; k++)
+      u[k] = d[k] / length;
+
+  // Columns of the turn - straight down it is half of one about X
+  double r[9] = {1.0, 0.0, 0.0, 0.0, -1.0, 0.0, 0.0, 0.0, -1.0};
+  double c = u[1];
+  if (1.0 + c > 1e-12)
+  {
+    double vx = u[2], vz = -u[0], k = 1.0 / (1.0 + c);
+    r[0] = c + k * vx * vx;
+    r[1] = vz;
+    r[2] = k * vx * vz;
+    r[3] = -vz;
+    r[4] = c;
+    r[5] = vx;
+    r[6] = k * vx * vz;
+    r[7] = -vx;
+    r[8] = c + k * vz * vz;
+  }
+
+  double scale[3] = {width, length, width};
+  for (int col = 0; col < 3; col++)
+  {
+    for (int row = 0; row < 3; row++)
+      m[4 * col + row] = r[3 * col + row] * scale[col];
+    m[4 * col + 3] = 0.0;
+  }
+  for (int k = 0; k < 3; k++)
+    m[12 + k] = start[k];
+  m[15] = 1.0;
+}
+
+void Matrix::transformPoint(const double m[16], const double in[3], double out[3])
+{
+  double x = m[0] * in[0] + m[4] * in[1] + m[8] * in[2] + m[12];
+  double y = m[1] * in[0] + m[5] * in[1] + m[9] * in[2] + m[13];
+  double z = m[2] * in[0] + m[6] * in[1] + m[10] * in[2] + m[14];
+  out[0] = x;
+  out[1] = y;
+  out[2] = z;
+}
+
+/*
+ *  Matrix for normals - the cofactor matrix of the upper 3x3 (the inverse
+ *  transpose up to scale), flipped for mirroring transforms so normals stay outward
+ */
+void Matrix::normalMatrix(const double m[16], double n[9])
+{
+  n[0] = m[5] * m[10] - m[9] * m[6];
+  n[1] = m[9] * m[2] - m[1] * m[10];
+  n[2] = m[1] * m[6] - m[5] * m[2];
+  n[3] = m[8] * m[6] - m[4] * m[10];
+  n[4] = m[0] * m[10] - m[8] * m[2];
+  n[5] = m[4] * m[2] - m[0] * m[6];
+  n[6] = m[4] * m[9] - m[8] * m[5];
+  n[7] = m[8] * m[1] - m[0] * m[9];
+  n[8] = m[0] * m[5] - m[4] * m[1];
+
+  double det = m[0] * n[0] + m[4] * n[1] + m[8] * n[2];
+  if (det < 0.0)
+    for (int k = 0; k < 9; k++)
+      n[k] = -n[k];
+}
+
+/*
+ *  Transform a normal by the normal matrix and renormalize
+ *  The normal matrix is stored row by row, n[0..2] gives the new x
+ */
+void Matrix::transformNormal(const double m[16], const double in[3], double out[3])
+{
+  double n[9];
+  normalMatrix(m, n);
+
+  double x = n[0] * in[0] + n[1] * in[1] + n[2] * in[2];
+  double y = n[3] * in[0] + n[4] * in[1] + n[5] * in[2];
+  double z = n[6] * in[0] + n[7] * in[1] + n[8] * in[2];
+  double len = sqrt(x * x + y * y + z * z);
+  if (len == 0.0)
+    len = 1.0;
+  out[0] = x / len;
+  out[1] = y / len;
+  out[2] = z / len;
+}
@@ -0,0 +1,385 @@
+#include "mesh.hpp"
+#include "matrix.hpp"
+#include "lights.hpp"
+#include "shader.hpp"
+#include "util.hpp"
+#ifdef USEGLEW
+#include <GL/glew.h>
+#endif
+//  OpenGL with prototypes for glext
+#define GL_GLEXT_PROTOTYPES
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+// Tell Xcode IDE to not gripe about OpenGL deprecation
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+// Legacy contexts only have the ARB entry point
+#define glDrawElementsInstanced glDrawElementsInstancedARB
+#else
+#include <GL/glut.h>
+#endif
+
+#include <cstddef> // For offsetof
+#include <cstring> // For memcpy
+
+static const char *vertexSource =
+    "#version 120\n"
+    "varying vec4 color;\n"
+    "varying vec3 eye;\n"
+    "varying vec3 normal;\n"
+    "void main()\n"
+    "{\n"
+    "  eye = (gl_ModelViewMatrix * gl_Vertex).xyz;\n"
+    "  normal = gl_NormalMatrix * gl_Normal;\n"
+    "  color = gl_Color;\n"
+    "  gl_TexCoord[0] = gl_TextureMatrix[0] * gl_MultiTexCoord0;\n"
+    "  gl_Position = ftransform();\n"
+    "}\n";
+
+static unsigned int program = 0;
+
+/*
+ *  Build the lighting program the first time a lit mesh is drawn
+ */
+static unsigned int litProgram()
+{
+  if (!program)
+  {
+    program = Shader::program("Mesh", vertexSource, Lights::fragmentSource().c_str());
+  }
+  return program;
+}
+
+Mesh::Mesh() : mode(GL_TRIANGLES), first(0), lineWidth(1.0f), colored(false), vbo(0), ibo(0), triangleIndices(0), lineIndices(0)
+{
+  lower[0] = lower[1] = lower[2] = 0.0f;
+  upper[0] = upper[1] = upper[2] = 0.0f;
+  Transform t;
+  Matrix::identity(t.m);
+  stack.push_back(t);
+
+  current.normal[0] = current.normal[1] = 0.0f;
+  current.normal[2] = 1.0f;
+  current.texCoord[0] = current.texCoord[1] = 0.0f;
+  region[0] = region[1] = 0.0f;
+  region[2] = region[3] = 1.0f;
+  current.color[0] = current.color[1] = current.color[2] = current.color[3] = 255;
+}
+
+void Mesh::begin(unsigned int primitive)
+{
+  mode = primitive;
+  first = vertices.size();
+}
+
+/*
+ *  Turn the vertices recorded since begin() into indexed triangles or lines
+ */
+void Mesh::end()
+{
+  unsigned int base = (unsigned int)first;
+  unsigned int count = (unsigned int)(vertices.size() - first);
+
+  switch (mode)
+  {
+  case GL_TRIANGLES:
+    for (unsigned int i = 0; i + 2 < count; i += 3)
+      triangles.insert(triangles.end(), {base + i, base + i + 1, base + i + 2});
+    break;
+  case GL_QUADS:
+    for (unsigned int i = 0; i + 3 < count; i += 4)
+      triangles.insert(triangles.end(), {base + i, base + i + 1, base + i + 2,
+                                         base + i, base + i + 2, base + i + 3});
+    break;
+  case GL_QUAD_STRIP:
+    for (unsigned int i = 0; i + 3 < count; i += 2)
+      triangles.insert(triangles.end(), {base + i, base + i + 1, base + i + 3,
+                                         base + i, base + i + 3, base + i + 2});
+    break;
+  case GL_TRIANGLE_STRIP:
+    for (unsigned int i = 0; i + 2 < count; i++)
+    {
+      // Every other triangle is flipped to keep a consistent winding
+      if (i % 2 == 0)
+        triangles.insert(triangles.end(), {base + i, base + i + 1, base + i + 2});
+      else
+        triangles.insert(triangles.end(), {base + i + 1, base + i, base + i + 2});
+    }
+    break;
+  case GL_TRIANGLE_FAN:
+    for (unsigned int i = 1; i + 1 < count; i++)
+      triangles.insert(triangles.end(), {base, base + i, base + i + 1});
+    break;
+  case GL_LINES:
+    for (unsigned int i = 0; i + 1 < count; i += 2)
+      lines.insert(lines.end(), {base + i, base + i + 1});
+    break;
+  default:
+    Util::Fatal("Mesh primitive %u not supported\n", mode);
+  }
+}
+
+void Mesh::color(float r, float g, float b, float a)
+{
+  colored = true;
+  current.color[0] = (unsigned char)(r * 255.0f + 0.5f);
+  current.color[1] = (unsigned char)(g * 255.0f + 0.5f);
+  current.color[2] = (unsigned char)(b * 255.0f + 0.5f);
+  current.color[3] = (unsigned char)(a * 255.0f + 0.5f);
+}
+
+void Mesh::normal(double x, double y, double z)
+{
+  double in[3] = {x, y, z};
+  double out[3];
+  Matrix::transformNormal(stack.back().m, in, out);
+  current.normal[0] = (float)out[0];
+  current.normal[1] = (float)out[1];
+  current.normal[2] = (float)out[2];
+}
+
+void Mesh::texCoord(double s, double t)
+{
+  current.texCoord[0] = region[0] + region[2] * (float)s;
+  current.texCoord[1] = region[1] + region[3] * (float)t;
+}
+
+void Mesh::vertex(double x, double y, double z)
+{
+  double in[3] = {x, y, z};
+  double out[3];
+  Matrix::transformPoint(stack.back().m, in, out);
+  Vertex v = current;
+  v.position[0] = (float)out[0];
+  v.position[1] = (float)out[1];
+  v.position[2] = (float)out[2];
+  vertices.push_back(v);
+}
+
+void Mesh::setLineWidth(float width)
+{
+  lineWidth = width;
+}
+
+void Mesh::texRegion(const float r[4])
+{
+  for (int k = 0; k < 4; k++)
+    region[k] = r[k];
+}
+
+/*
+ *  Copy the triangles and lines of another mesh, transformed by the current
+ *  matrix and texture region - vertices take the current color unless the
+ *  other mesh has its own
+ */
+void Mesh::append(const Mesh &other)
+{
+  unsigned int base = (unsigned int)vertices.size();
+  const double *m = stack.back().m;
+  for (size_t i = 0; i < other.vertices.size(); i++)
+  {
+    const Vertex &src = other.vertices[i];
+    double p[3] = {src.position[0], src.position[1], src.position[2]};
+    double n[3] = {src.normal[0], src.normal[1], src.normal[2]};
+    Matrix::transformPoint(m, p, p);
+    Matrix::transformNormal(m, n, n);
+
+    Vertex v = src;
+    for (int k = 0; k < 3; k++)
+    {
+      v.position[k] = (float)p[k];
+      v.normal[k] = (float)n[k];
+    }
+    for (int k = 0; k < 2; k++)
+      v.texCoord[k] = region[k] + region[k + 2] * src.texCoord[k];
+    if (!other.colored)
+      memcpy(v.color, current.color, sizeof(v.color));
+    vertices.push_back(v);
+  }
+  for (size_t i = 0; i < other.triangles.size(); i++)
+    triangles.push_back(base + other.triangles[i]);
+  for (size_t i = 0; i < other.lines.size(); i++)
+    lines.push_back(base + other.lines[i]);
+  if (!other.lines.empty())
+    lineWidth = other.lineWidth;
+}
+
+void Mesh::pushMatrix()
+{
+  stack.push_back(stack.back());
+}
+
+void Mesh::popMatrix()
+{
+  if (stack.size() > 1)
+    stack.pop_back();
+}
+
+void Mesh::translate(double x, double y, double z)
+{
+  Matrix::translate(stack.back().m, x, y, z);
+}
+
+void Mesh::rotate(double angle, double x, double y, double z)
+{
+  Matrix::rotate(stack.back().m, angle, x, y, z);
+}
+
+void Mesh::scale(double x, double y, double z)
+{
+  Matrix::scale(stack.back().m, x, y, z);
+}
+
+void Mesh::multMatrix(const double m[16])
+{
+  Matrix::multiply(stack.back().m, stack.back().m, m);
+}
+
+/*
+ *  Copy vertices and indices into buffer objects
+ *  Triangles come first in the index buffer followed by lines
+ */
+void Mesh::upload()
+{
+  if (!vbo)
+    glGenBuffers(1, &vbo);
+  if (!ibo)
+    glGenBuffers(1, &ibo);
+
+  std::vector<unsigned int> indices(triangles);
+  indices.insert(indices.end(), lines.begin(), lines.end());
+  triangleIndices = (int)triangles.size();
+  lineIndices = (int)lines.size();
+
+  for (int k = 0; k < 3; k++)
+    lower[k] = upper[k] = 0.0f;
+  for (size_t i = 0; i < vertices.size(); i++)
+    for (int k = 0; k < 3; k++)
+    {
+      float p = vertices[i].position[k];
+      lower[k] = i == 0 || p < lower[k] ? p : lower[k];
+      upper[k] = i == 0 || p > upper[k] ? p : upper[k];
+    }
+
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+  Util::ErrCheck("Mesh::upload");
+}
+
+/*
+ *  Lit meshes are shaded per pixel, unlit ones need no program at all
+ */
+void Mesh::draw() const
+{
+  if (!Lights::enabled())
+  {
+    drawInstanced(0);
+    return;
+  }
+  unsigned int prog = litProgram();
+  glUseProgram(prog);
+  Shader::setFixedState(prog);
+  drawInstanced(0);
+  glUseProgram(0);
+}
+
+/*
+ *  Draw the buffers count times with glDrawElementsInstanced - the caller has
+ *  set up the per-instance attributes, a count of 0 is a plain draw
+ */
+void Mesh::drawInstanced(int count) const
+{
+  if (!vbo || (!triangleIndices && !lineIndices))
+    return;
+
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_NORMAL_ARRAY);
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+  if (colored)
+    glEnableClientState(GL_COLOR_ARRAY);
+  glVertexPointer(3, GL_FLOAT, sizeof(Vertex), (void *)offsetof(Vertex, position));
+  glNormalPointer(GL_FLOAT, sizeof(Vertex), (void *)offsetof(Vertex, normal));
+  glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), (void *)offsetof(Vertex, texCoord));
+  glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(Vertex), (void *)offsetof(Vertex, color));
+
+  if (triangleIndices)
+    drawElements(GL_TRIANGLES, triangleIndices, 0, count);
+  if (lineIndices)
+  {
+    glLineWidth(lineWidth);
+    drawElements(GL_LINES, lineIndices, triangleIndices, count);
+    glLineWidth(1.0f);
+  }
+
+  glDisableClientState(GL_VERTEX_ARRAY);
+  glDisableClientState(GL_NORMAL_ARRAY);
+  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+  glDisableClientState(GL_COLOR_ARRAY);
+
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void Mesh::drawElements(unsigned int primitive, int indices, int offset, int count) const
+{
+  void *start = (void *)(offset * sizeof(unsigned int));
+  if (count > 0)
+    glDrawElementsInstanced(primitive, indices, GL_UNSIGNED_INT, start, count);
+  else
+    glDrawElements(primitive, indices, GL_UNSIGNED_INT, start);
+}
+
+void Mesh::clear()
+{
+  vertices.clear();
+  triangles.clear();
+  colored = false;
+  lines.clear();
+  stack.resize(1);
+  Matrix::identity(stack[0].m);
+  region[0] = region[1] = 0.0f;
+  region[2] = region[3] = 1.0f;
+  if (vbo)
+    glDeleteBuffers(1, &vbo);
+  if (ibo)
+    glDeleteBuffers(1, &ibo);
+  vbo = ibo = 0;
+  triangleIndices = lineIndices = 0;
+}
+
+bool Mesh::hasColors() const
+{
+  return colored;
+}
+
+void Mesh::center(double c[3]) const
+{
+  for (int k = 0; k < 3; k++)
+    c[k] = 0.5 * (lower[k] + upper[k]);
+}
+
+void Mesh::bounds(double lo[3], double hi[3]) const
+{
+  for (int k = 0; k < 3; k++)
+  {
+    lo[k] = lower[k];
+    hi[k] = upper[k];
+  }
+}
+
+bool Mesh::empty() const
+{
+  return triangles.empty() && lines.empty();
+}
+
+int Mesh::triangleCount() const
+{
+  return (int)triangles.size() / 3;
+}
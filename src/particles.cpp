@@ -0,0 +1,548 @@
+#include <cmath>
+#include <cstddef> // For offsetof
+#include <cstring>
+#include "particles.hpp"
+#include "frustum.hpp"
+#include "shader.hpp"
+#include "workers.hpp"
+#include "util.hpp"
+#ifdef USEGLEW
+#include <GL/glew.h>
+#endif
+//  OpenGL with prototypes for glext
+#define GL_GLEXT_PROTOTYPES
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+// Tell Xcode IDE to not gripe about OpenGL deprecation
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#else
+#include <GL/glut.h>
+#endif
+
+//  A multiple of the widest SIMD vector so the kernels never need a tail loop
+const int Particles::CAPACITY = 32768;
+
+//  Longest step simulated at once, so a stall doesn't fling everything away
+static const double MAX_STEP = 0.1;
+//  Seconds a particle takes to fade out at the end of its life
+static const double FADE = 0.5;
+
+//  How each kind is emitted, moves and looks
+struct Behavior
+{
+  double rate;            // Particles per second
+  double life[2];         // Seconds, picked between the two
+  double size[2];         // World units, picked between the two
+  float gravity;          // Downward acceleration
+  float drag;             // Fraction of the speed lost per second
+  float bounce;           // Fraction of the speed kept off the ground
+  float friction;         // Fraction of the sliding speed kept on a bounce
+  unsigned char color[3];
+  float opacity;
+};
+
+static const Behavior BEHAVIORS[] = {
+    //  Dust is light, hangs in the air and fades slowly
+    {14000, {1.2, 2.4}, {0.8, 2.0}, 4.0f, 1.2f, 0.1f, 0.3f, {190, 155, 110}, 0.35f},
+    //  Debris is heavy, bounces once or twice and settles
+    {30000, {0.8, 1.6}, {0.3, 0.7}, 60.0f, 0.2f, 0.4f, 0.6f, {85, 75, 65}, 0.9f},
+};
+
+//  A stream as the kernels see it
+struct Block
+{
+  float *x, *y, *z, *vx, *vy, *vz, *life, *size;
+  int count;
+};
+
+//  One step of motion, premultiplied by the step length
+struct Motion
+{
+  float dt, fall, damp, bounce, friction;
+};
+
+/*
+ *  Drop particle i by moving the last one into its place
+ */
+static void removeParticle(Block &b, int i)
+{
+  int last = --b.count;
+  b.x[i] = b.x[last];
+  b.y[i] = b.y[last];
+  b.z[i] = b.z[last];
+  b.vx[i] = b.vx[last];
+  b.vy[i] = b.vy[last];
+  b.vz[i] = b.vz[last];
+  b.life[i] = b.life[last];
+  b.size[i] = b.size[last];
+}
+
+/*
+ *  Move every particle one step - the ground is the flat track at y = 0,
+ *  particles that go through it bounce back up and slide
+ */
+static void integrateScalar(Block &b, const Motion &m)
+{
+  for (int i = 0; i < b.count; i++)
+  {
+    float vx = b.vx[i] * m.damp;
+    float vy = (b.vy[i] - m.fall) * m.damp;
+    float vz = b.vz[i] * m.damp;
+    float y = b.y[i] + vy * m.dt;
+    b.x[i] += vx * m.dt;
+    b.z[i] += vz * m.dt;
+    if (y < 0.0f)
+    {
+      y = 0.0f;
+      vy *= -m.bounce;
+      vx *= m.friction;
+      vz *= m.friction;
+    }
+    b.y[i] = y;
+    b.vx[i] = vx;
+    b.vy[i] = vy;
+    b.vz[i] = vz;
+    b.life[i] -= m.dt;
+  }
+}
+
+/*
+ *  Drop the expired particles - from the end, so whatever moves into a
+ *  hole has already been checked
+ */
+static void cullScalar(Block &b)
+{
+  for (int i = b.count - 1; i >= 0; i--)
+    if (b.life[i] <= 0.0f)
+      removeParticle(b, i);
+}
+
+#ifdef SIMD_KERNELS
+__attribute__((target("sse2"))) static void integrateSSE(Block &b, const Motion &m)
+{
+  const __m128 dt = _mm_set1_ps(m.dt), fall = _mm_set1_ps(m.fall), damp = _mm_set1_ps(m.damp);
+  const __m128 bounce = _mm_set1_ps(-m.bounce), friction = _mm_set1_ps(m.friction);
+  const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+  for (int i = 0; i < b.count; i += 4)
+  {
+    __m128 vx = _mm_mul_ps(_mm_load_ps(b.vx + i), damp);
+    __m128 vy = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(b.vy + i), fall), damp);
+    __m128 vz = _mm_mul_ps(_mm_load_ps(b.vz + i), damp);
+    _mm_store_ps(b.x + i, _mm_add_ps(_mm_load_ps(b.x + i), _mm_mul_ps(vx, dt)));
+    _mm_store_ps(b.z + i, _mm_add_ps(_mm_load_ps(b.z + i), _mm_mul_ps(vz, dt)));
+    __m128 y = _mm_add_ps(_mm_load_ps(b.y + i), _mm_mul_ps(vy, dt));
+    //  No blend before SSE4.1 - select with masks
+    __m128 under = _mm_cmplt_ps(y, zero);
+    __m128 slide = _mm_or_ps(_mm_and_ps(under, friction), _mm_andnot_ps(under, one));
+    vy = _mm_or_ps(_mm_and_ps(under, _mm_mul_ps(vy, bounce)), _mm_andnot_ps(under, vy));
+    _mm_store_ps(b.y + i, _mm_max_ps(y, zero));
+    _mm_store_ps(b.vx + i, _mm_mul_ps(vx, slide));
+    _mm_store_ps(b.vy + i, vy);
+    _mm_store_ps(b.vz + i, _mm_mul_ps(vz, slide));
+    _mm_store_ps(b.life + i, _mm_sub_ps(_mm_load_ps(b.life + i), dt));
+  }
+}
+
+__attribute__((target("sse2"))) static void cullSSE(Block &b)
+{
+  const __m128 zero = _mm_setzero_ps();
+  for (int i = (b.count - 1) & ~3; i >= 0; i -= 4)
+  {
+    //  Four lifetimes per test, most groups have no expired particle at all
+    int dead = _mm_movemask_ps(_mm_cmple_ps(_mm_load_ps(b.life + i), zero));
+    for (int lane = 3; dead && lane >= 0; lane--)
+      if ((dead >> lane & 1) && i + lane < b.count)
+        removeParticle(b, i + lane);
+  }
+}
+
+__attribute__((target("avx2,fma"))) static void integrateAVX2(Block &b, const Motion &m)
+{
+  const __m256 dt = _mm256_set1_ps(m.dt), fall = _mm256_set1_ps(m.fall), damp = _mm256_set1_ps(m.damp);
+  const __m256 bounce = _mm256_set1_ps(-m.bounce), friction = _mm256_set1_ps(m.friction);
+  const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+  for (int i = 0; i < b.count; i += 8)
+  {
+    __m256 vx = _mm256_mul_ps(_mm256_load_ps(b.vx + i), damp);
+    __m256 vy = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(b.vy + i), fall), damp);
+    __m256 vz = _mm256_mul_ps(_mm256_load_ps(b.vz + i), damp);
+    _mm256_store_ps(b.x + i, _mm256_fmadd_ps(vx, dt, _mm256_load_ps(b.x + i)));
+    _mm256_store_ps(b.z + i, _mm256_fmadd_ps(vz, dt, _mm256_load_ps(b.z + i)));
+    __m256 y = _mm256_fmadd_ps(vy, dt, _mm256_load_ps(b.y + i));
+    __m256 under = _mm256_cmp_ps(y, zero, _CMP_LT_OQ);
+    __m256 slide = _mm256_blendv_ps(one, friction, under);
+    _mm256_store_ps(b.y + i, _mm256_max_ps(y, zero));
+    _mm256_store_ps(b.vx + i, _mm256_mul_ps(vx, slide));
+    _mm256_store_ps(b.vy + i, _mm256_blendv_ps(vy, _mm256_mul_ps(vy, bounce), under));
+    _mm256_store_ps(b.vz + i, _mm256_mul_ps(vz, slide));
+    _mm256_store_ps(b.life + i, _mm256_sub_ps(_mm256_load_ps(b.life + i), dt));
+  }
+}
+
+__attribute__((target("avx2"))) static void cullAVX2(Block &b)
+{
+  const __m256 zero = _mm256_setzero_ps();
+  for (int i = (b.count - 1) & ~7; i >= 0; i -= 8)
+  {
+    int dead = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_load_ps(b.life + i), zero, _CMP_LE_OQ));
+    for (int lane = 7; dead && lane >= 0; lane--)
+      if ((dead >> lane & 1) && i + lane < b.count)
+        removeParticle(b, i + lane);
+  }
+}
+#endif
+
+//  The kernels this CPU runs
+struct Kernels
+{
+  void (*integrate)(Block &b, const Motion &m);
+  void (*cull)(Block &b);
+  const char *name;
+};
+
+//  Indexed by Util::simd()
+static const Kernels choices[] = {
+    {integrateScalar, cullScalar, "scalar"},
+#ifdef SIMD_KERNELS
+    {integrateSSE, cullSSE, "SSE"},
+    {integrateAVX2, cullAVX2, "AVX2"},
+#endif
+};
+
+static const Kernels &pick()
+{
+  return choices[Util::simd()];
+}
+
+static const char *vertexSource =
+    "#version 120\n"
+    "uniform float pixels;\n"
+    "uniform bool orthographic;\n"
+    "varying vec4 color;\n"
+    "void main()\n"
+    "{\n"
+    "  vec4 eye = gl_ModelViewMatrix * vec4(gl_Vertex.xyz, 1.0);\n"
+    //  The size rides in w and shrinks with distance
+    "  gl_PointSize = max(gl_Vertex.w * pixels / (orthographic ? 1.0 : max(-eye.z, 1.0)), 1.0);\n"
+    "  color = gl_Color;\n"
+    "  gl_Position = gl_ProjectionMatrix * eye;\n"
+    "}\n";
+
+static const char *fragmentSource =
+    "#version 120\n"
+    "varying vec4 color;\n"
+    "void main()\n"
+    "{\n"
+    "  vec2 d = 2.0 * gl_PointCoord - 1.0;\n"
+    "  float r = dot(d, d);\n"
+    "  if (r > 1.0)\n"
+    "    discard;\n"
+    "  gl_FragColor = vec4(color.rgb, color.a * (1.0 - r));\n"
+    "}\n";
+
+static unsigned int program = 0;
+
+/*
+ *  Build the point sprite program the first time it is needed
+ */
+static unsigned int particleProgram()
+{
+  if (!program)
+    program = Shader::program("Particles", vertexSource, fragmentSource);
+  return program;
+}
+
+/*
+ *  Buffers can be mapped once and written while the GPU draws from them
+ */
+static bool persistent()
+{
+  static int available = -1;
+  if (available < 0)
+  {
+    const char *version = (const char *)glGetString(GL_VERSION);
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+    int major = version ? version[0] - '0' : 0;
+    int minor = version && version[1] == '.' ? version[2] - '0' : 0;
+    available = major > 4 || (major == 4 && minor >= 4) || (extensions && strstr(extensions, "GL_ARB_buffer_storage"));
+  }
+  return available;
+}
+
+float *Particles::Stream::field(Field f)
+{
+  uintptr_t p = (uintptr_t)storage.data();
+  return (float *)((p + 31) & ~(uintptr_t)31) + f * CAPACITY;
+}
+
+Particles::Particles() : last(-1.0), travelled(0.0), elapsed(0.0), vbo(0), mapped(0), section(0)
+{
+  middle[0] = middle[1] = middle[2] = 0.0f;
+  for (int s = 0; s < SECTIONS; s++)
+    fences[s] = 0;
+}
+
+int Particles::addEmitter(Kind kind, const double origin[3])
+{
+  if (vbo)
+    Util::Fatal("Particle emitters must be added before the first update\n");
+  streams.push_back(Stream());
+  Stream &stream = streams.back();
+  stream.kind = kind;
+  for (int k = 0; k < 3; k++)
+    stream.origin[k] = (float)origin[k];
+  //  Room to align the first field
+  stream.storage.assign(FIELD_COUNT * CAPACITY + 8, 0.0f);
+  stream.count = 0;
+  stream.owed = 0.0;
+  stream.random = Util::mix((uint32_t)streams.size() * 0x9e3779b9u) | 1;
+  return (int)streams.size() - 1;
+}
+
+void Particles::moveEmitter(int emitter, const double origin[3])
+{
+  for (int k = 0; k < 3; k++)
+    streams[emitter].origin[k] = (float)origin[k];
+}
+
+/*
+ *  One buffer section per frame in flight, mapped for good when the
+ *  context allows it
+ */
+void Particles::create()
+{
+  size_t total = streams.size() * CAPACITY;
+  glGenBuffers(1, &vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+#ifdef GL_MAP_PERSISTENT_BIT
+  if (persistent())
+  {
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_ARRAY_BUFFER, SECTIONS * total * sizeof(Vertex), 0, flags);
+    mapped = (Vertex *)glMapBufferRange(GL_ARRAY_BUFFER, 0, SECTIONS * total * sizeof(Vertex), flags);
+  }
+#endif
+  if (!mapped)
+  {
+    glBufferData(GL_ARRAY_BUFFER, total * sizeof(Vertex), 0, GL_STREAM_DRAW);
+    staging.resize(total);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  firsts.resize(streams.size());
+  counts.resize(streams.size());
+  Util::ErrCheck("Particles::create");
+}
+
+/*
+ *  Start n new particles at the emitter - spread over the ground driven
+ *  since the last update so a slow frame leaves no gaps in the trail
+ */
+void Particles::emit(Stream &stream, int n, double distance, double moved)
+{
+  const Behavior &behavior = BEHAVIORS[stream.kind];
+  if (n > CAPACITY - stream.count)
+    n = CAPACITY - stream.count;
+  float *x = stream.field(X), *y = stream.field(Y), *z = stream.field(Z);
+  float *vx = stream.field(VX), *vy = stream.field(VY), *vz = stream.field(VZ);
+  float *life = stream.field(LIFE), *size = stream.field(SIZE);
+  uint32_t &r = stream.random;
+
+  for (int k = 0; k < n; k++)
+  {
+    int i = stream.count++;
+    double back = moved * Util::uniform(r);
+    if (stream.kind == DUST)
+    {
+      //  Across the tyre's width, thrown up and sideways
+      x[i] = (float)(stream.origin[0] + distance - back + 1.5 * (Util::uniform(r) - 0.5));
+      y[i] = (float)(stream.origin[1] + 0.5 * Util::uniform(r));
+      z[i] = (float)(stream.origin[2] + 5.0 * (Util::uniform(r) - 0.5));
+      vx[i] = (float)(6.0 * (Util::uniform(r) - 0.5));
+      vy[i] = (float)(2.0 + 5.0 * Util::uniform(r));
+      vz[i] = (float)(4.0 * (Util::uniform(r) - 0.5));
+    }
+    else
+    {
+      //  Out from the bit in every direction
+      double angle = 2.0 * 3.14159265 * Util::uniform(r), speed = 3.0 + 7.0 * Util::uniform(r);
+      x[i] = (float)(stream.origin[0] + distance - back);
+      y[i] = (float)stream.origin[1];
+      z[i] = (float)stream.origin[2];
+      vx[i] = (float)(speed * cos(angle));
+      vy[i] = (float)(1.0 + 5.0 * Util::uniform(r));
+      vz[i] = (float)(speed * sin(angle));
+    }
+    life[i] = (float)(behavior.life[0] + (behavior.life[1] - behavior.life[0]) * Util::uniform(r));
+    size[i] = (float)(behavior.size[0] + (behavior.size[1] - behavior.size[0]) * Util::uniform(r));
+  }
+}
+
+/*
+ *  Move, cull, emit and write out one stream - runs on any thread, so no GL
+ */
+void Particles::step(Stream &stream, float dt, double distance, double moved, Vertex *out)
+{
+  const Behavior &behavior = BEHAVIORS[stream.kind];
+  const Kernels &kernels = pick();
+  Block block = {stream.field(X), stream.field(Y), stream.field(Z), stream.field(VX), stream.field(VY),
+                 stream.field(VZ), stream.field(LIFE), stream.field(SIZE), stream.count};
+  float damp = 1.0f - behavior.drag * dt;
+  Motion motion = {dt, behavior.gravity * dt, damp > 0.0f ? damp : 0.0f, behavior.bounce, behavior.friction};
+  kernels.integrate(block, motion);
+  kernels.cull(block);
+  stream.count = block.count;
+
+  stream.owed += behavior.rate * dt;
+  int due = (int)stream.owed;
+  stream.owed -= due;
+  emit(stream, due, distance, moved);
+
+  //  Fade out over the last moments of life
+  for (int i = 0; i < stream.count; i++)
+  {
+    Vertex &v = out[i];
+    v.position[0] = block.x[i];
+    v.position[1] = block.y[i];
+    v.position[2] = block.z[i];
+    v.size = block.size[i];
+    v.color[0] = behavior.color[0];
+    v.color[1] = behavior.color[1];
+    v.color[2] = behavior.color[2];
+    float fade = block.life[i] < FADE ? block.life[i] / (float)FADE : 1.0f;
+    v.color[3] = (unsigned char)(255.0f * behavior.opacity * fade);
+  }
+}
+
+void Particles::update(double now, double distance)
+{
+  double start = Util::seconds();
+  if (streams.empty())
+    return;
+  if (!vbo)
+    create();
+
+  double since = last < 0.0 ? 0.0 : now - last;
+  float dt = (float)(since < 0.0 ? 0.0 : since > MAX_STEP ? MAX_STEP : since);
+  double moved = last < 0.0 ? 0.0 : distance - travelled;
+  last = now;
+  travelled = distance;
+
+  //  Write the section drawn longest ago, once the GPU is done with it
+  int n = (int)streams.size();
+  section = (section + 1) % SECTIONS;
+  Vertex *out = staging.data();
+#ifdef GL_MAP_PERSISTENT_BIT
+  if (mapped)
+  {
+    out = mapped + (size_t)section * n * CAPACITY;
+    if (fences[section])
+    {
+      GLsync fence = (GLsync)fences[section];
+      while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+        ;
+      glDeleteSync(fence);
+      fences[section] = 0;
+    }
+  }
+#endif
+
+  //  Streams are stepped on the workers and this thread
+  Workers::parallelFor(n, [this, dt, distance, moved, out](int s)
+                       { step(streams[s], dt, distance, moved, out + (size_t)s * CAPACITY); });
+
+  for (int s = 0; s < n; s++)
+  {
+    firsts[s] = s * CAPACITY;
+    counts[s] = streams[s].count;
+  }
+
+  //  Without a mapping the survivors are copied over in one orphaned buffer
+  if (!mapped)
+  {
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, staging.size() * sizeof(Vertex), 0, GL_STREAM_DRAW);
+    for (int s = 0; s < n; s++)
+      glBufferSubData(GL_ARRAY_BUFFER, firsts[s] * sizeof(Vertex), counts[s] * sizeof(Vertex), &staging[firsts[s]]);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    Util::ErrCheck("Particles::update");
+  }
+
+  for (int k = 0; k < 3; k++)
+  {
+    middle[k] = 0.0f;
+    for (int s = 0; s < n; s++)
+      middle[k] += streams[s].origin[k] / n;
+  }
+  middle[0] += (float)distance;
+  elapsed = 1000.0 * (Util::seconds() - start);
+}
+
+void Particles::draw() const
+{
+  if (count() == 0)
+    return;
+
+  unsigned int prog = particleProgram();
+  glUseProgram(prog);
+  Frustum view = Frustum::current();
+  glUniform1f(glGetUniformLocation(prog, "pixels"), (float)view.pixels(1.0, 1.0));
+  glUniform1i(glGetUniformLocation(prog, "orthographic"), view.orthographic());
+
+  //  Round sprites sized by the shader, blended over the scene without hiding each other
+  glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+  glEnable(GL_POINT_SPRITE);
+  glDepthMask(GL_FALSE);
+
+  size_t base = mapped ? (size_t)section * streams.size() * CAPACITY * sizeof(Vertex) : 0;
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glVertexPointer(4, GL_FLOAT, sizeof(Vertex), (void *)(base + offsetof(Vertex, position)));
+  glEnableClientState(GL_COLOR_ARRAY);
+  glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(Vertex), (void *)(base + offsetof(Vertex, color)));
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  //  Every stream in one call
+  glMultiDrawArrays(GL_POINTS, firsts.data(), counts.data(), (int)streams.size());
+
+  glDisableClientState(GL_COLOR_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+  glDepthMask(GL_TRUE);
+  glDisable(GL_POINT_SPRITE);
+  glDisable(GL_VERTEX_PROGRAM_POINT_SIZE);
+  glUseProgram(0);
+
+#ifdef GL_MAP_PERSISTENT_BIT
+  //  The section can be written again once the GPU has passed this point
+  if (mapped)
+  {
+    if (fences[section])
+      glDeleteSync((GLsync)fences[section]);
+    fences[section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+#endif
+  Util::ErrCheck("Particles::draw");
+}
+
+int Particles::count() const
+{
+  int total = 0;
+  for (size_t s = 0; s < streams.size(); s++)
+    total += streams[s].count;
+  return total;
+}
+
+void Particles::center(double c[3]) const
+{
+  for (int k = 0; k < 3; k++)
+    c[k] = middle[k];
+}
+
+double Particles::updateTime() const
+{
+  return elapsed;
+}
+
+const char *Particles::kernels()
+{
+  return pick().name;
+}
@@ -0,0 +1,199 @@
+#include <cmath>
+#include <map>
+#include "primitives.hpp"
+#include "mesh.hpp"
+#include "util.hpp"
+#ifdef USEGLEW
+#include <GL/glew.h>
+#endif
+//  OpenGL with prototypes for glext
+#define GL_GLEXT_PROTOTYPES
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+// Tell Xcode IDE to not gripe about OpenGL deprecation
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#else
+#include <GL/glut.h>
+#endif
+
+// Cosine and Sine in degrees
+#define Cos(x) (cos((x) * 3.14159265 / 180))
+#define Sin(x) (sin((x) * 3.14159265 / 180))
+
+// Caches keyed by tessellation level
+static std::map<int, std::vector<double>> circles;
+static std::map<double, Mesh> spheres;
+static std::map<int, Mesh> tubes, upCaps, downCaps, cylinders, cones;
+
+const std::vector<double> &Primitives::circle(int segments)
+{
+  std::vector<double> &table = circles[segments];
+  if (table.empty())
+  {
+    double step = 2.0 * Util::PI / segments;
+    for (int i = 0; i <= segments; ++i)
+    {
+      table.push_back(cos(i * step));
+      table.push_back(sin(i * step));
+    }
+  }
+  return table;
+}
+
+/*
+ *  Sphere vertex in polar coordinates - same layout as Util::Vertex
+ */
+static void sphereVertex(Mesh &mesh, double th, double ph)
+{
+  double x = Sin(th) * Cos(ph);
+  double y = Cos(th) * Cos(ph);
+  double z = Sin(ph);
+  mesh.normal(x, y, z);
+  mesh.texCoord(th / 360, ph / 180 + 0.5);
+  mesh.vertex(x, y, z);
+}
+
+const Mesh &Primitives::sphere(double inc)
+{
+  std::map<double, Mesh>::iterator it = spheres.find(inc);
+  if (it != spheres.end())
+    return it->second;
+
+  Mesh &mesh = spheres[inc];
+  buildSphere(mesh, inc);
+  mesh.upload();
+  return mesh;
+}
+
+const Mesh &Primitives::tube(int segments)
+{
+  std::map<int, Mesh>::iterator it = tubes.find(segments);
+  if (it != tubes.end())
+    return it->second;
+
+  Mesh &mesh = tubes[segments];
+  buildTube(mesh, segments);
+  mesh.upload();
+  return mesh;
+}
+
+const Mesh &Primitives::cap(int segments, bool down)
+{
+  std::map<int, Mesh> &caps = down ? downCaps : upCaps;
+  std::map<int, Mesh>::iterator it = caps.find(segments);
+  if (it != caps.end())
+    return it->second;
+
+  Mesh &mesh = caps[segments];
+  buildCap(mesh, segments, down);
+  mesh.upload();
+  return mesh;
+}
+
+const Mesh &Primitives::cylinder(int segments)
+{
+  std::map<int, Mesh>::iterator it = cylinders.find(segments);
+  if (it != cylinders.end())
+    return it->second;
+
+  Mesh &mesh = cylinders[segments];
+  buildCylinder(mesh, segments);
+  mesh.upload();
+  return mesh;
+}
+
+const Mesh &Primitives::cone(int segments)
+{
+  std::map<int, Mesh>::iterator it = cones.find(segments);
+  if (it != cones.end())
+    return it->second;
+
+  Mesh &mesh = cones[segments];
+  buildCone(mesh, segments);
+  mesh.upload();
+  return mesh;
+}
+
+void Primitives::buildSphere(Mesh &mesh, double inc)
+{
+  // Bands of latitude
+  for (double ph = -90.0; ph < 90.0; ph += inc)
+  {
+    mesh.begin(GL_QUAD_STRIP);
+    for (double th = 0.0; th <= 360.0; th += 2 * inc)
+    {
+      sphereVertex(mesh, th, ph);
+      sphereVertex(mesh, th, ph + inc);
+    }
+    mesh.end();
+  }
+}
+
+void Primitives::buildTube(Mesh &mesh, int segments)
+{
+  const std::vector<double> &c = circle(segments);
+  mesh.begin(GL_QUAD_STRIP);
+  for (int i = 0; i <= segments; ++i)
+  {
+    double x = c[2 * i];
+    double z = c[2 * i + 1];
+    double texCoord = static_cast<double>(i) / segments;
+
+    mesh.normal(x, 0.0, z);
+    mesh.texCoord(texCoord, 0.0);
+    mesh.vertex(x, 0.0, z); // Bottom vertex
+    mesh.texCoord(texCoord, 1.0);
+    mesh.vertex(x, 1.0, z); // Top vertex
+  }
+  mesh.end();
+}
+
+/*
+ *  Recorded as a fan around the center with planar texture coordinates
+ */
+void Primitives::buildCap(Mesh &mesh, int segments, bool down)
+{
+  const std::vector<double> &c = circle(segments);
+  mesh.normal(0.0, down ? -1.0 : 1.0, 0.0);
+  mesh.begin(GL_TRIANGLE_FAN);
+  mesh.texCoord(0.5, 0.5);
+  mesh.vertex(0.0, 0.0, 0.0); // Center of the cap
+  for (int i = 0; i <= segments; ++i)
+  {
+    double x = c[2 * i];
+    double z = c[2 * i + 1];
+    mesh.texCoord(0.5 + 0.5 * x, 0.5 + 0.5 * z);
+    mesh.vertex(x, 0.0, z);
+  }
+  mesh.end();
+}
+
+void Primitives::buildCylinder(Mesh &mesh, int segments)
+{
+  buildTube(mesh, segments);
+  // Bottom cap
+  buildCap(mesh, segments, true);
+  // Top cap
+  mesh.pushMatrix();
+  mesh.translate(0.0, 1.0, 0.0);
+  buildCap(mesh, segments, false);
+  mesh.popMatrix();
+}
+
+void Primitives::buildCone(Mesh &mesh, int segments)
+{
+  const std::vector<double> &c = circle(segments);
+  // Side normals lean away from the axis by 45 degrees
+  mesh.begin(GL_TRIANGLE_FAN);
+  mesh.normal(0.0, 1.0, 0.0);
+  mesh.vertex(0.0, 0.0, 0.0); // Apex
+  for (int i = 0; i <= segments; ++i)
+  {
+    double x = c[2 * i];
+    double z = c[2 * i + 1];
+    mesh.normal(x, 1.0, z);
+    mesh.texCoord(static_cast<double>(i) / segments, 1.0);
+    mesh.vertex(x, -1.0, z);
+  }
+  mesh.end();
+}
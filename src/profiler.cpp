@@ -0,0 +1,214 @@
+#include <cstring>
+#include "profiler.hpp"
+#include "util.hpp"
+#ifdef USEGLEW
+#include <GL/glew.h>
+#endif
+//  OpenGL with prototypes for glext
+#define GL_GLEXT_PROTOTYPES
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+// Tell Xcode IDE to not gripe about OpenGL deprecation
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+// Legacy contexts only have the EXT timer query
+#define GL_TIME_ELAPSED GL_TIME_ELAPSED_EXT
+#define glGetQueryObjectui64v glGetQueryObjectui64vEXT
+#else
+#include <GL/glut.h>
+#endif
+
+static const char *passNames[Profiler::PASS_COUNT] = {"Fleet", "Shadows", "Lighting", "Culling", "Environment", "Rover", "Particles", "Render", "HUD"};
+
+void Profiler::Stats::add(double ms)
+{
+  samples[next] = ms;
+  next = (next + 1) % HISTORY;
+  if (count < HISTORY)
+    count++;
+}
+
+void Profiler::Stats::summary(double &min, double &avg, double &max) const
+{
+  min = avg = max = 0.0;
+  if (!count)
+    return;
+  min = max = samples[0];
+  double sum = 0.0;
+  for (int i = 0; i < count; i++)
+  {
+    sum += samples[i];
+    if (samples[i] < min)
+      min = samples[i];
+    if (samples[i] > max)
+      max = samples[i];
+  }
+  avg = sum / count;
+}
+
+Profiler::Profiler() : frameStart(0.0), frame(0), gpuTimers(false), visible(false)
+{
+  memset(cpu, 0, sizeof(cpu));
+  memset(gpu, 0, sizeof(gpu));
+  memset(&frameTimes, 0, sizeof(frameTimes));
+  memset(queries, 0, sizeof(queries));
+  memset(issued, 0, sizeof(issued));
+  memset(passStart, 0, sizeof(passStart));
+}
+
+void Profiler::beginFrame()
+{
+  // Queries need a context so create them on the first frame
+  if (frame == 0)
+  {
+    const char *version = (const char *)glGetString(GL_VERSION);
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+    gpuTimers = (version && (version[0] > '3' || (version[0] == '3' && version[2] >= '3'))) ||
+                (extensions && (strstr(extensions, "GL_ARB_timer_query") || strstr(extensions, "GL_EXT_timer_query")));
+    if (gpuTimers)
+      glGenQueries(LATENCY * PASS_COUNT, &queries[0][0]);
+  }
+
+  // Read back the slot about to be reused, issued LATENCY frames ago
+  collect(frame % LATENCY);
+  frameStart = Util::seconds();
+}
+
+void Profiler::endFrame()
+{
+  frameTimes.add(1000.0 * (Util::seconds() - frameStart));
+  frame++;
+}
+
+void Profiler::begin(Pass pass)
+{
+  passStart[pass] = Util::seconds();
+  if (gpuTimers)
+    glBeginQuery(GL_TIME_ELAPSED, queries[frame % LATENCY][pass]);
+}
+
+void Profiler::end(Pass pass)
+{
+  if (gpuTimers)
+  {
+    glEndQuery(GL_TIME_ELAPSED);
+    issued[frame % LATENCY][pass] = true;
+  }
+  cpu[pass].add(1000.0 * (Util::seconds() - passStart[pass]));
+}
+
+/*
+ *  Take the results that are ready - anything still pending is dropped
+ *  rather than waited on
+ */
+void Profiler::collect(int slot)
+{
+  if (!gpuTimers)
+    return;
+  for (int pass = 0; pass < PASS_COUNT; pass++)
+  {
+    if (!issued[slot][pass])
+      continue;
+    issued[slot][pass] = false;
+    int available = 0;
+    glGetQueryObjectiv(queries[slot][pass], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+      continue;
+    GLuint64 ns = 0;
+    glGetQueryObjectui64v(queries[slot][pass], GL_QUERY_RESULT, &ns);
+    gpu[pass].add(ns / 1.0e6);
+  }
+}
+
+void Profiler::toggle()
+{
+  visible = !visible;
+}
+
+bool Profiler::isVisible() const
+{
+  return visible;
+}
+
+void Profiler::draw(int width, int height, int y) const
+{
+  if (!visible)
+    return;
+
+  //  Table of passes above the info lines
+  glColor3f(1, 1, 1);
+  y += 20 * PASS_COUNT;
+  glWindowPos2i(5, y);
+  Util::Print("Pass  CPU min/avg/max ms  GPU min/avg/max ms");
+  for (int pass = 0; pass < PASS_COUNT; pass++)
+  {
+    double cmin, cavg, cmax, gmin, gavg, gmax;
+    cpu[pass].summary(cmin, cavg, cmax);
+    gpu[pass].summary(gmin, gavg, gmax);
+    glWindowPos2i(5, y - 20 * (pass + 1));
+    if (gpuTimers)
+      Util::Print("%s  %.2f/%.2f/%.2f  %.2f/%.2f/%.2f", passNames[pass], cmin, cavg, cmax, gmin, gavg, gmax);
+    else
+      Util::Print("%s  %.2f/%.2f/%.2f  n/a", passNames[pass], cmin, cavg, cmax);
+  }
+
+  //  Frame time graph in the bottom right corner, 33 ms full scale
+  const int graphWidth = 2 * HISTORY;
+  const int graphHeight = 80;
+  const double scale = graphHeight / 33.3;
+  glMatrixMode(GL_PROJECTION);
+  glPushMatrix();
+  glLoadIdentity();
+  glOrtho(0, width, 0, height, -1, 1);
+  glMatrixMode(GL_MODELVIEW);
+  glPushMatrix();
+  glLoadIdentity();
+  glDisable(GL_DEPTH_TEST);
+
+  int x0 = width - graphWidth - 10;
+  int y0 = 10;
+  glColor3f(0.4f, 0.4f, 0.4f);
+  glBegin(GL_LINE_LOOP);
+  glVertex2i(x0, y0);
+  glVertex2i(x0 + graphWidth, y0);
+  glVertex2i(x0 + graphWidth, y0 + graphHeight);
+  glVertex2i(x0, y0 + graphHeight);
+  glEnd();
+  //  16.7 ms line
+  glBegin(GL_LINES);
+  glVertex2d(x0, y0 + 16.7 * scale);
+  glVertex2d(x0 + graphWidth, y0 + 16.7 * scale);
+  glEnd();
+
+  //  Oldest sample on the left
+  glColor3f(1, 1, 0);
+  glBegin(GL_LINE_STRIP);
+  for (int i = 0; i < frameTimes.count; i++)
+  {
+    int k = (frameTimes.next - frameTimes.count + i + HISTORY) % HISTORY;
+    double h = frameTimes.samples[k] * scale;
+    if (h > graphHeight)
+      h = graphHeight;
+    glVertex2d(x0 + 2 * i, y0 + h);
+  }
+  glEnd();
+
+  glEnable(GL_DEPTH_TEST);
+  glPopMatrix();
+  glMatrixMode(GL_PROJECTION);
+  glPopMatrix();
+  glMatrixMode(GL_MODELVIEW);
+}
+
+void Profiler::report(FILE *out) const
+{
+  for (int pass = 0; pass < PASS_COUNT; pass++)
+  {
+    double cmin, cavg, cmax, gmin, gavg, gmax;
+    cpu[pass].summary(cmin, cavg, cmax);
+    gpu[pass].summary(gmin, gavg, gmax);
+    if (gpuTimers)
+      fprintf(out, "%-12s CPU %.3f ms  GPU %.3f ms (avg of last %d frames)\n", passNames[pass], cavg, gavg, cpu[pass].count);
+    else
+      fprintf(out, "%-12s CPU %.3f ms (avg of last %d frames)\n", passNames[pass], cavg, cpu[pass].count);
+  }
+}
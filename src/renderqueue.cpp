@@ -0,0 +1,327 @@
+#include <algorithm>
+#include <cstring>
+#include "renderqueue.hpp"
+#include "arms.hpp"
+#include "mesh.hpp"
+#include "instances.hpp"
+#include "lights.hpp"
+#include "particles.hpp"
+#include "terrain.hpp"
+#include "textures.hpp"
+#include "util.hpp"
+#ifdef USEGLEW
+#include <GL/glew.h>
+#endif
+//  OpenGL with prototypes for glext
+#define GL_GLEXT_PROTOTYPES
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+// Tell Xcode IDE to not gripe about OpenGL deprecation
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#else
+#include <GL/glut.h>
+#endif
+
+/*
+ *  Key layout, most significant first
+ *    opaque:  0 | shader:1 | material:12 | texture:16 | depth:32 | 0:2
+ *    blended: 1 | ~depth:32 | material:12 | texture:16 | shader:1 | 0:2
+ *  Depth is the float bit pattern of the eye distance, which orders like an
+ *  unsigned integer for positive values
+ */
+static uint64_t opaqueKey(bool shader, int material, unsigned int texture, uint32_t depth)
+{
+  return ((uint64_t)shader << 62) | ((uint64_t)(material & 0xFFF) << 50) |
+         ((uint64_t)(texture & 0xFFFF) << 34) | ((uint64_t)depth << 2);
+}
+
+static uint64_t blendedKey(bool shader, int material, unsigned int texture, uint32_t depth)
+{
+  return (1ULL << 63) | ((uint64_t)(~depth) << 31) | ((uint64_t)(material & 0xFFF) << 19) |
+         ((uint64_t)(texture & 0xFFFF) << 3) | ((uint64_t)shader << 2);
+}
+
+static uint32_t depthBits(double depth)
+{
+  float d = depth > 0 ? (float)depth : 0.0f;
+  uint32_t bits;
+  memcpy(&bits, &d, sizeof(bits));
+  return bits;
+}
+
+static bool same(const float *a, const float *b, int n)
+{
+  for (int k = 0; k < n; k++)
+    if (a[k] != b[k])
+      return false;
+  return true;
+}
+
+RenderQueue::RenderQueue() : calls(0), changes(0)
+{
+}
+
+int RenderQueue::material(const Material &m)
+{
+  for (size_t i = 0; i < materials.size(); i++)
+  {
+    const Material &o = materials[i];
+    if (o.texture == m.texture && o.lit == m.lit && o.blend == m.blend && o.shininess == m.shininess &&
+        same(o.color, m.color, 4) && same(o.specular, m.specular, 4) && same(o.emission, m.emission, 4))
+      return (int)i;
+  }
+  materials.push_back(m);
+  return (int)materials.size() - 1;
+}
+
+void RenderQueue::add(int material, const Mesh *mesh, const Instances *instances, const double model[16], const float texOffset[2])
+{
+  Draw draw;
+  draw.key = 0;
+  draw.material = material;
+  draw.mesh = mesh;
+  draw.instances = instances;
+  draw.terrain = 0;
+  draw.particles = 0;
+  draw.arms = 0;
+  draw.bone = 0;
+  draw.transform = -1;
+  if (model)
+  {
+    draw.transform = (int)transforms.size() / 16;
+    transforms.insert(transforms.end(), model, model + 16);
+  }
+  draw.shifted = texOffset != 0;
+  draw.texOffset[0] = texOffset ? texOffset[0] : 0.0f;
+  draw.texOffset[1] = texOffset ? texOffset[1] : 0.0f;
+  draws.push_back(draw);
+}
+
+void RenderQueue::submit(int material, const Mesh &mesh, const double model[16], const float texOffset[2])
+{
+  add(material, &mesh, 0, model, texOffset);
+}
+
+void RenderQueue::submit(int material, const Mesh &mesh, const Instances &instances, const double model[16])
+{
+  if (instances.count() > 0)
+    add(material, &mesh, &instances, model, 0);
+}
+
+void RenderQueue::submit(int material, const Terrain &terrain)
+{
+  if (terrain.nodeCount() > 0)
+  {
+    add(material, 0, 0, 0, 0);
+    draws.back().terrain = &terrain;
+  }
+}
+
+void RenderQueue::submit(int material, const Particles &particles, const double model[16])
+{
+  if (particles.count() > 0)
+  {
+    add(material, 0, 0, model, 0);
+    draws.back().particles = &particles;
+  }
+}
+
+void RenderQueue::submit(int material, const Mesh &mesh, const Arms &arms, int bone, const double model[16])
+{
+  if (arms.drawnCount() > 0)
+  {
+    add(material, &mesh, 0, model, 0);
+    draws.back().arms = &arms;
+    draws.back().bone = bone;
+  }
+}
+
+void RenderQueue::flush(bool lighting)
+{
+  calls = changes = 0;
+
+  //  Eye distance of each draw's center decides its place within a material
+  double view[16];
+  glGetDoublev(GL_MODELVIEW_MATRIX, view);
+  for (size_t i = 0; i < draws.size(); i++)
+  {
+    Draw &draw = draws[i];
+    const Material &m = materials[draw.material];
+    double c[3];
+    if (draw.instances)
+      draw.instances->center(c);
+    else if (draw.arms)
+      draw.arms->center(c);
+    else if (draw.terrain)
+      draw.terrain->center(c);
+    else if (draw.particles)
+      draw.particles->center(c);
+    else
+      draw.mesh->center(c);
+    if (draw.transform >= 0)
+    {
+      const double *t = &transforms[16 * draw.transform];
+      double x = c[0], y = c[1], z = c[2];
+      for (int k = 0; k < 3; k++)
+        c[k] = t[k] * x + t[4 + k] * y + t[8 + k] * z + t[12 + k];
+    }
+    double depth = -(view[2] * c[0] + view[6] * c[1] + view[10] * c[2] + view[14]);
+    unsigned int texture = m.texture >= 0 ? Textures::name(m.texture) : 0;
+    bool shader = draw.instances || draw.arms || draw.terrain || draw.particles || (m.lit && lighting);
+    draw.key = m.blend ? blendedKey(shader, draw.material, texture, depthBits(depth))
+                       : opaqueKey(shader, draw.material, texture, depthBits(depth));
+  }
+  std::stable_sort(draws.begin(), draws.end(), [](const Draw &a, const Draw &b)
+                   { return a.key < b.key; });
+
+  //  State left by whatever ran before is unknown, so the first draw sets it all
+  int lit = -1, textured = -1, blended = -1;
+  unsigned int bound = 0;
+  bool colorKnown = false, materialKnown = false;
+  float color[4], shininess = 0, specular[4], emission[4];
+
+  for (size_t i = 0; i < draws.size(); i++)
+  {
+    const Draw &draw = draws[i];
+    const Material &m = materials[draw.material];
+
+    if (lit != (m.lit && lighting))
+    {
+      lit = m.lit && lighting;
+      Lights::enable(lit);
+      changes++;
+    }
+    if (textured != (m.texture >= 0))
+    {
+      textured = m.texture >= 0;
+      if (textured)
+        glEnable(GL_TEXTURE_2D);
+      else
+        glDisable(GL_TEXTURE_2D);
+      changes++;
+    }
+    if (textured && (bound == 0 || bound != Textures::name(m.texture)))
+    {
+      bound = Textures::name(m.texture);
+      glBindTexture(GL_TEXTURE_2D, bound);
+      changes++;
+    }
+    if (blended != m.blend)
+    {
+      blended = m.blend;
+      if (blended)
+      {
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+      }
+      else
+        glDisable(GL_BLEND);
+      changes++;
+    }
+    bool colors = (draw.mesh && draw.mesh->hasColors()) || draw.particles;
+    if (!colors && (!colorKnown || !same(color, m.color, 4)))
+    {
+      memcpy(color, m.color, sizeof(color));
+      glColor4fv(color);
+      colorKnown = true;
+      changes++;
+    }
+    if (!materialKnown || shininess != m.shininess || !same(specular, m.specular, 4) || !same(emission, m.emission, 4))
+    {
+      shininess = m.shininess;
+      memcpy(specular, m.specular, sizeof(specular));
+      memcpy(emission, m.emission, sizeof(emission));
+      glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, shininess);
+      glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, specular);
+      glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, emission);
+      materialKnown = true;
+      changes++;
+    }
+
+    //  Scrolling texture coordinates
+    if (draw.shifted)
+    {
+      glMatrixMode(GL_TEXTURE);
+      glLoadIdentity();
+      glTranslatef(draw.texOffset[0], draw.texOffset[1], 0.0f);
+      glMatrixMode(GL_MODELVIEW);
+    }
+    if (draw.transform >= 0)
+    {
+      glPushMatrix();
+      glMultMatrixd(&transforms[16 * draw.transform]);
+    }
+
+    if (draw.instances)
+      draw.instances->draw(*draw.mesh);
+    else if (draw.arms)
+      draw.arms->draw(*draw.mesh, draw.bone);
+    else if (draw.terrain)
+      draw.terrain->draw();
+    else if (draw.particles)
+      draw.particles->draw();
+    else
+      draw.mesh->draw();
+    calls++;
+
+    if (draw.transform >= 0)
+      glPopMatrix();
+    if (draw.shifted)
+    {
+      glMatrixMode(GL_TEXTURE);
+      glLoadIdentity();
+      glMatrixMode(GL_MODELVIEW);
+    }
+    //  Per-vertex colors leave the current color undefined
+    if (colors)
+      colorKnown = false;
+  }
+
+  if (blended > 0)
+    glDisable(GL_BLEND);
+  Lights::enable(false);
+  draws.clear();
+  transforms.clear();
+  Util::ErrCheck("RenderQueue::flush");
+}
+
+void RenderQueue::flushDepth()
+{
+  //  Nothing but depth is written, so no material state is needed
+  Lights::enable(false);
+  glDisable(GL_TEXTURE_2D);
+  for (size_t i = 0; i < draws.size(); i++)
+  {
+    const Draw &draw = draws[i];
+    if (materials[draw.material].blend || draw.particles)
+      continue;
+    if (draw.transform >= 0)
+    {
+      glPushMatrix();
+      glMultMatrixd(&transforms[16 * draw.transform]);
+    }
+    if (draw.instances)
+      draw.instances->draw(*draw.mesh);
+    else if (draw.arms)
+      draw.arms->draw(*draw.mesh, draw.bone);
+    else if (draw.terrain)
+      draw.terrain->draw();
+    else
+      draw.mesh->draw();
+    if (draw.transform >= 0)
+      glPopMatrix();
+  }
+  draws.clear();
+  transforms.clear();
+  Util::ErrCheck("RenderQueue::flushDepth");
+}
+
+int RenderQueue::drawCalls() const
+{
+  return calls;
+}
+
+int RenderQueue::stateChanges() const
+{
+  return changes;
+}
@@ -0,0 +1,317 @@
+#include <climits>
+#include <cmath>
+#include <stdint.h>
+#include "rockfield.hpp"
+#include "terrain.hpp"
+#include "matrix.hpp"
+#include "util.hpp"
+#ifdef USEGLEW
+#include <GL/glew.h>
+#endif
+//  OpenGL with prototypes for glext
+#define GL_GLEXT_PROTOTYPES
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+// Tell Xcode IDE to not gripe about OpenGL deprecation
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#else
+#include <GL/glut.h>
+#endif
+
+//  Strip width along X and how far the ring reaches behind the rover - the
+//  field stays inside the ground the terrain always draws
+static const double STRIP = 10.0;
+static const double BEHIND = 140.0;
+//  Half width of the rover's lane kept clear and of the field across Z
+static const double CLEAR = 14.0;
+static const double REACH = 170.0;
+//  Rock sizes - most are pebbles, a few are boulders
+static const double SMALL = 0.25;
+static const double LARGE = 3.0;
+//  Rocks are squashed, sunk into the ground and reach this far from their center
+static const double FLAT = 0.6;
+static const double SINK = 0.3;
+static const double RADIUS = 1.3;
+//  Spatial hash cell edge and placements tried before a rock lands crowded
+static const double CELL = 4.0;
+static const int TRIES = 4;
+//  Column of a strip that was never placed
+static const long NONE = LONG_MIN;
+
+static long cell(double v)
+{
+  return (long)floor(v / CELL);
+}
+
+/*
+ *  Lumpy icosahedron with a flat base - each seed gives another shape
+ */
+static void buildRock(Mesh &mesh, unsigned int seed)
+{
+  const double g = 0.5 * (1.0 + sqrt(5.0));
+  const double corners[12][3] = {{-1, g, 0}, {1, g, 0}, {-1, -g, 0}, {1, -g, 0}, {0, -1, g}, {0, 1, g},
+                                 {0, -1, -g}, {0, 1, -g}, {g, 0, -1}, {g, 0, 1}, {-g, 0, -1}, {-g, 0, 1}};
+  const int faces[20][3] = {{0, 11, 5}, {0, 5, 1}, {0, 1, 7}, {0, 7, 10}, {0, 10, 11}, {1, 5, 9}, {5, 11, 4},
+                            {11, 10, 2}, {10, 7, 6}, {7, 1, 8}, {3, 9, 4}, {3, 4, 2}, {3, 2, 6}, {3, 6, 8},
+                            {3, 8, 9}, {4, 9, 5}, {2, 4, 11}, {6, 2, 10}, {8, 6, 7}, {9, 8, 1}};
+
+  double p[12][3];
+  for (int i = 0; i < 12; i++)
+  {
+    double r = (2.0 - RADIUS) + 2.0 * (RADIUS - 1.0) * (Util::mix(seed * 12 + i + 1) / 4294967295.0);
+    double len = sqrt(corners[i][0] * corners[i][0] + corners[i][1] * corners[i][1] + corners[i][2] * corners[i][2]);
+    for (int k = 0; k < 3; k++)
+      p[i][k] = r * corners[i][k] / len;
+    if (p[i][1] < -0.4)
+      p[i][1] = -0.4;
+  }
+
+  //  Faceted, so every triangle has its own normal
+  mesh.begin(GL_TRIANGLES);
+  for (int f = 0; f < 20; f++)
+  {
+    const double *a = p[faces[f][0]], *b = p[faces[f][1]], *c = p[faces[f][2]];
+    double u[3], v[3], n[3];
+    for (int k = 0; k < 3; k++)
+    {
+      u[k] = b[k] - a[k];
+      v[k] = c[k] - a[k];
+    }
+    n[0] = u[1] * v[2] - u[2] * v[1];
+    n[1] = u[2] * v[0] - u[0] * v[2];
+    n[2] = u[0] * v[1] - u[1] * v[0];
+    //  Turn faces the flattened base folded inwards back out
+    if (n[0] * (a[0] + b[0] + c[0]) + n[1] * (a[1] + b[1] + c[1]) + n[2] * (a[2] + b[2] + c[2]) < 0)
+    {
+      for (int k = 0; k < 3; k++)
+        n[k] = -n[k];
+      const double *t = b;
+      b = c;
+      c = t;
+    }
+    mesh.normal(n[0], n[1], n[2]);
+    mesh.vertex(a[0], a[1], a[2]);
+    mesh.vertex(b[0], b[1], b[2]);
+    mesh.vertex(c[0], c[1], c[2]);
+  }
+  mesh.end();
+}
+
+RockField::RockField(unsigned int seed, int capacity) : seed(seed), first(0), moved(0), mask(0), fresh(true)
+{
+  resize(capacity);
+}
+
+void RockField::resize(int capacity)
+{
+  perStrip = capacity / STRIPS / VARIANTS * VARIANTS;
+  if (perStrip < VARIANTS)
+    perStrip = VARIANTS;
+  int n = perStrip * STRIPS;
+
+  x.assign(n, 0.0f);
+  z.assign(n, 0.0f);
+  y.assign(n, 0.0f);
+  size.assign(n, 0.0f);
+  yaw.assign(n, 0.0f);
+
+  //  About one rock per bucket
+  unsigned int buckets = 1;
+  while (buckets < (unsigned int)n)
+    buckets <<= 1;
+  heads.assign(buckets, -1);
+  next.assign(n, -1);
+  mask = buckets - 1;
+
+  for (int s = 0; s < STRIPS; s++)
+  {
+    columns[s] = NONE;
+    low[s] = high[s] = 0.0f;
+  }
+
+  //  Every instance exists from the start, placing a rock only overwrites it
+  double m[16];
+  Matrix::identity(m);
+  for (int v = 0; v < VARIANTS; v++)
+  {
+    placed[v].clear();
+    for (int i = 0; i < n / VARIANTS; i++)
+      placed[v].add(m);
+  }
+  fresh = true;
+}
+
+int RockField::count() const
+{
+  return (int)x.size();
+}
+
+int RockField::bucket(double px, double pz) const
+{
+  return Util::mix((uint32_t)cell(px) * 0x8da6b343u ^ (uint32_t)cell(pz) * 0xd8163841u) & mask;
+}
+
+void RockField::link(int rock)
+{
+  int b = bucket(x[rock], z[rock]);
+  next[rock] = heads[b];
+  heads[b] = rock;
+}
+
+void RockField::unlink(int rock)
+{
+  int *p = &heads[bucket(x[rock], z[rock])];
+  while (*p != rock)
+    p = &next[*p];
+  *p = next[rock];
+}
+
+/*
+ *  A rock of this radius at x, z would touch one already placed
+ */
+bool RockField::crowded(double px, double pz, double radius) const
+{
+  double reach = radius + LARGE;
+  for (long i = cell(px - reach); i <= cell(px + reach); i++)
+    for (long j = cell(pz - reach); j <= cell(pz + reach); j++)
+      for (int n = heads[bucket(i * CELL, j * CELL)]; n >= 0; n = next[n])
+      {
+        double dx = x[n] - px, dz = z[n] - pz, r = radius + size[n];
+        if (dx * dx + dz * dz < r * r)
+          return true;
+      }
+  return false;
+}
+
+int RockField::query(double px, double pz, double radius, std::vector<int> *found) const
+{
+  int hits = 0;
+  for (long i = cell(px - radius); i <= cell(px + radius); i++)
+    for (long j = cell(pz - radius); j <= cell(pz + radius); j++)
+      for (int n = heads[bucket(i * CELL, j * CELL)]; n >= 0; n = next[n])
+      {
+        //  Cells sharing a bucket are skipped so no rock is counted twice
+        double dx = x[n] - px, dz = z[n] - pz;
+        if (cell(x[n]) != i || cell(z[n]) != j || dx * dx + dz * dz > radius * radius)
+          continue;
+        hits++;
+        if (found)
+          found->push_back(n);
+      }
+  return hits;
+}
+
+void RockField::position(int rock, double p[3]) const
+{
+  p[0] = x[rock];
+  p[1] = y[rock];
+  p[2] = z[rock];
+}
+
+/*
+ *  Scatter a strip's rocks over a column, seeded by the column
+ */
+void RockField::place(const Terrain &terrain, int strip, long col)
+{
+  int begin = strip * perStrip;
+  if (columns[strip] != NONE)
+    for (int r = begin; r < begin + perStrip; r++)
+      unlink(r);
+  columns[strip] = col;
+
+  uint32_t state = Util::mix(seed ^ ((uint32_t)col * 0x9e3779b9u)) | 1;
+  int perVariant = perStrip / VARIANTS;
+  for (int k = 0; k < perStrip; k++)
+  {
+    int r = begin + k;
+    double s = SMALL + (LARGE - SMALL) * pow(Util::uniform(state), 4.0);
+    double px = 0, pz = 0;
+    for (int t = 0; t < TRIES; t++)
+    {
+      double side = Util::uniform(state) < 0.5 ? -1.0 : 1.0;
+      px = (col + Util::uniform(state)) * STRIP;
+      pz = side * (CLEAR + s + Util::uniform(state) * (REACH - CLEAR - s));
+      if (!crowded(px, pz, s))
+        break;
+    }
+    x[r] = (float)px;
+    z[r] = (float)pz;
+    y[r] = (float)(terrain.height(px, pz) - SINK * s);
+    size[r] = (float)s;
+    yaw[r] = (float)(360.0 * Util::uniform(state));
+    link(r);
+
+    double m[16];
+    Matrix::identity(m);
+    Matrix::translate(m, x[r], y[r], z[r]);
+    Matrix::rotate(m, yaw[r], 0, 1, 0);
+    Matrix::scale(m, s, FLAT * s, s);
+    placed[k % VARIANTS].set(strip * perVariant + k / VARIANTS, m);
+
+    float bottom = (float)(y[r] - RADIUS * FLAT * s), top = (float)(y[r] + RADIUS * FLAT * s);
+    low[strip] = k == 0 || bottom < low[strip] ? bottom : low[strip];
+    high[strip] = k == 0 || top > high[strip] ? top : high[strip];
+  }
+  moved += perStrip;
+
+  if (!fresh)
+    for (int v = 0; v < VARIANTS; v++)
+      placed[v].upload(strip * perVariant, perVariant);
+}
+
+void RockField::update(const Terrain &terrain, double distance)
+{
+  //  The rock meshes are made once, with the first context
+  if (meshes[0].empty())
+    for (int v = 0; v < VARIANTS; v++)
+    {
+      buildRock(meshes[v], seed + v);
+      meshes[v].upload();
+    }
+
+  moved = 0;
+  first = (long)floor((distance - BEHIND) / STRIP);
+  for (long col = first; col < first + STRIPS; col++)
+  {
+    int strip = (int)(((col % STRIPS) + STRIPS) % STRIPS);
+    if (columns[strip] != col)
+      place(terrain, strip, col);
+  }
+
+  if (fresh)
+  {
+    for (int v = 0; v < VARIANTS; v++)
+      placed[v].upload();
+    fresh = false;
+  }
+}
+
+const Mesh &RockField::mesh(int variant) const
+{
+  return meshes[variant];
+}
+
+const Instances &RockField::instances(int variant) const
+{
+  return placed[variant];
+}
+
+void RockField::bounds(double distance, double lo[3], double hi[3]) const
+{
+  lo[0] = first * STRIP - distance - RADIUS * LARGE;
+  hi[0] = (first + STRIPS) * STRIP - distance + RADIUS * LARGE;
+  lo[1] = low[0];
+  hi[1] = high[0];
+  for (int s = 1; s < STRIPS; s++)
+  {
+    lo[1] = low[s] < lo[1] ? low[s] : lo[1];
+    hi[1] = high[s] > hi[1] ? high[s] : hi[1];
+  }
+  lo[2] = -REACH - RADIUS * LARGE;
+  hi[2] = REACH + RADIUS * LARGE;
+}
+
+int RockField::recycled() const
+{
+  return moved;
+}
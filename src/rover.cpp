@@ -1,5 +1,10 @@
 #include "rover.hpp"
+#include "arms.hpp"
 #include "util.hpp"
+#include "primitives.hpp"
+#include "matrix.hpp"
+#include "textures.hpp"
+#include "lights.hpp"
 #ifdef USEGLEW
 #include <GL/glew.h>
 #endif
@@ -22,30 +27,243 @@
 
 #include <cmath> // For mathematical operations
 
+// Wheel size - the tyre runs from its center along +Z
+static const double WHEEL_RADIUS = 4.0;
+static const double WHEEL_WIDTH = 5.0;
+
 Rover::Rover()
 {
   size = 25.0;
   bodyPlacementHeight = 15.0;
 }
 
-void Rover::loadTextures()
+void Rover::loadTextures(RenderQueue &queue)
 {
-  //  Load textures
-  bodyTexture = Util::LoadTexBMP("textures/body_texture.bmp");
-  supportTexture = Util::LoadTexBMP("textures/support_texture.bmp");
-  wheelTexture = Util::LoadTexBMP("textures/wheel_texture.bmp");
-  drillTexture = Util::LoadTexBMP("textures/support_texture.bmp");
-  drillBitTexture = Util::LoadTexBMP("textures/drill_bit_texture.bmp");
+  //  Pack the materials into one atlas - it fills in as the workers decode
+  //  the files, and texture coordinates are mapped into it as meshes are built
+  const char *files[MATERIAL_COUNT] = {
+      "textures/body_texture.bmp",
+      "textures/support_texture.bmp",
+      "textures/wheel_texture.bmp",
+      "textures/support_texture.bmp",
+      "textures/drill_bit_texture.bmp"};
+  atlas = Textures::atlas(files, MATERIAL_COUNT, regions);
+
+  //  Lit atlas for the parts, a shiny lens and the unlit blended beam
+  RenderQueue::Material part = {atlas, true, false, {1, 1, 1, 1}, 1, {1, 1, 0, 1}, {0, 0, 0, 1}};
+  partMaterial = queue.material(part);
+  RenderQueue::Material lens = part;
+  lens.shininess = 50;
+  lensMaterial = queue.material(lens);
+  RenderQueue::Material beam = {-1, false, true, {1, 1, 1, 0.3f}, 1, {1, 1, 0, 1}, {1, 1, 1, 0.3f}};
+  beamMaterial = queue.material(beam);
+
+  // The rover never changes shape so tessellate it once now
+  buildMeshes();
 }
 
-void Rover::draw(bool isDay)
+/*
+ *  Record every part into the cached meshes and upload them
+ */
+void Rover::buildMeshes()
 {
+  bodyMesh.clear();
+  for (size_t i = 0; i < parts.size(); i++)
+    parts[i].instances.clear();
+  parts.clear();
+  lensMesh.clear();
+  beamMesh.clear();
+  wheelMesh.clear();
+  fleetMesh.clear();
+  armMesh.clear();
+  drillHeadMesh.clear();
+  struts.clear();
+
   buildBody();            // Build the rover's body
   buildSupports();        // Build the rover's supports
   buildWheels();          // Build the rover's wheels
-  buildCamera(isDay);     // Build the rover's camera
+  buildCamera();          // Build the rover's camera
   buildRearPowerSource(); // Build the rover's rear power source
   buildArmDrill();        // Build the rover's arm drill
+
+  // Every strut is placed from the table once, the sizes they follow never change
+  placeStruts();
+
+  // The fleet's rovers carry every strut as built in their one mesh, with
+  // the body and lens that are in the atlas already
+  fleetMesh.color(1, 1, 1);
+  for (size_t i = 0; i < struts.size(); i++)
+  {
+    fleetMesh.pushMatrix();
+    fleetMesh.multMatrix(struts[i].transform);
+    fleetMesh.texRegion(regions[struts[i].material]);
+    fleetMesh.append(Primitives::cylinder(36));
+    fleetMesh.popMatrix();
+  }
+  const float whole[4] = {0, 0, 1, 1};
+  fleetMesh.texRegion(whole);
+  fleetMesh.append(bodyMesh);
+  fleetMesh.append(lensMesh);
+
+  bodyMesh.upload();
+  for (size_t i = 0; i < parts.size(); i++)
+    parts[i].instances.upload();
+  lensMesh.upload();
+  beamMesh.upload();
+  wheelMesh.upload();
+  fleetMesh.upload();
+  armMesh.upload();
+  drillHeadMesh.upload();
+}
+
+/*
+ *  Body mesh with texture coordinates mapped into a material's region
+ */
+Mesh &Rover::batch(Material material)
+{
+  bodyMesh.texRegion(regions[material]);
+  return bodyMesh;
+}
+
+/*
+ *  Find or create the instances of a unit mesh
+ */
+Instances &Rover::part(const Mesh &mesh)
+{
+  for (size_t i = 0; i < parts.size(); i++)
+    if (parts[i].mesh == &mesh)
+      return parts[i].instances;
+  parts.push_back(Part());
+  parts.back().mesh = &mesh;
+  return parts.back().instances;
+}
+
+/*
+ *  Transforms of the struts from their ends, straight into the cylinder's
+ *  instances
+ */
+void Rover::placeStruts()
+{
+  if (struts.empty())
+    return;
+  Instances &cylinders = part(Primitives::cylinder(36));
+  for (size_t i = 0; i < struts.size(); i++)
+  {
+    Strut &strut = struts[i];
+    Matrix::segment(strut.transform, strut.start, strut.end, strut.radius);
+    cylinders.set(i, strut.transform, regions[strut.material]);
+  }
+}
+
+void Rover::draw(RenderQueue &queue, bool isDay, const double model[16])
+{
+  // Every material is in the atlas - the queue binds it once for the whole rover
+  queue.submit(partMaterial, bodyMesh, model);
+
+  // One instanced draw per unit mesh, however many parts share it
+  for (size_t i = 0; i < parts.size(); i++)
+    queue.submit(partMaterial, *parts[i].mesh, parts[i].instances, model);
+
+  // Camera lens
+  queue.submit(lensMaterial, lensMesh, model);
+
+  // Transparent beam, sorted after the opaque draws
+  if (!isDay)
+    queue.submit(beamMaterial, beamMesh, model);
+}
+
+void Rover::drawFleet(RenderQueue &queue, const Instances &bodies, const Instances &wheels, const Instances &beams, bool isDay,
+                      const double model[16]) const
+{
+  if (bodies.count() == 0)
+    return;
+  queue.submit(partMaterial, fleetMesh, bodies, model);
+  queue.submit(partMaterial, wheelMesh, wheels, model);
+  if (!isDay && beams.count() > 0)
+    queue.submit(beamMaterial, beamMesh, beams, model);
+}
+
+void Rover::drawArms(RenderQueue &queue, const Arms &arms, const double model[16]) const
+{
+  // Both arm bones share the tube, the head hangs from the wrist
+  queue.submit(partMaterial, armMesh, arms, Arms::UPPER, model);
+  queue.submit(partMaterial, armMesh, arms, Arms::FORE, model);
+  queue.submit(partMaterial, drillHeadMesh, arms, Arms::HEAD, model);
+}
+
+void Rover::place(int slot, const double pose[16], double rolled, Instances &bodies, Instances &wheels) const
+{
+  bodies.set(slot, pose);
+
+  // Wheels turn about their axle, along Z through the center
+  double m[16];
+  double turn = -rolled / WHEEL_RADIUS * 180 / 3.14159265;
+  for (int w = 0; w < wheelCount(); w++)
+  {
+    const double *c = &wheelCenters[3 * w];
+    for (int k = 0; k < 16; k++)
+      m[k] = pose[k];
+    Matrix::translate(m, c[0], c[1], c[2]);
+    Matrix::rotate(m, turn, 0, 0, 1);
+    wheels.set(slot * wheelCount() + w, m, regions[WHEEL]);
+  }
+}
+
+static void grow(double lo[3], double hi[3], const double a[3], const double b[3])
+{
+  for (int k = 0; k < 3; k++)
+  {
+    lo[k] = a[k] < lo[k] ? a[k] : lo[k];
+    hi[k] = b[k] > hi[k] ? b[k] : hi[k];
+  }
+}
+
+void Rover::bounds(double lo[3], double hi[3]) const
+{
+  double a[3], b[3];
+  bodyMesh.bounds(lo, hi);
+  for (size_t i = 0; i < parts.size(); i++)
+  {
+    parts[i].instances.bounds(*parts[i].mesh, a, b);
+    grow(lo, hi, a, b);
+  }
+  lensMesh.bounds(a, b);
+  grow(lo, hi, a, b);
+  beamMesh.bounds(a, b);
+  grow(lo, hi, a, b);
+
+  // Wherever the arm reaches - around the shoulder by both bones and the drop to the tip
+  double joints[3 * Arms::JOINT_COUNT], tip[3], reach = 0;
+  armRest(joints, tip);
+  for (int j = 0; j < Arms::WRIST; j++)
+    reach += sqrt(pow(joints[3 * j + 3] - joints[3 * j], 2) + pow(joints[3 * j + 4] - joints[3 * j + 1], 2) +
+                  pow(joints[3 * j + 5] - joints[3 * j + 2], 2));
+  reach += sqrt(pow(tip[0] - joints[3 * Arms::WRIST], 2) + pow(tip[1] - joints[3 * Arms::WRIST + 1], 2) +
+                pow(tip[2] - joints[3 * Arms::WRIST + 2], 2));
+  for (int k = 0; k < 3; k++)
+  {
+    a[k] = joints[3 * Arms::SHOULDER + k] - reach;
+    b[k] = joints[3 * Arms::SHOULDER + k] + reach;
+  }
+  grow(lo, hi, a, b);
+}
+
+int Rover::wheelCount() const
+{
+  return (int)wheelCenters.size() / 3;
+}
+
+void Rover::wheelContact(int wheel, double p[3]) const
+{
+  p[0] = wheelCenters[3 * wheel];
+  p[1] = wheelCenters[3 * wheel + 1] - WHEEL_RADIUS;
+  p[2] = wheelCenters[3 * wheel + 2] + WHEEL_WIDTH / 2;
+}
+
+void Rover::drillTip(double p[3]) const
+{
+  for (int k = 0; k < 3; k++)
+    p[k] = drillBitEnd[k];
 }
 
 void Rover::buildBody()
@@ -57,205 +275,205 @@ void Rover::buildBody()
   // glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, white);
   // glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, black);
   //
-  // glPushMatrix();
+  // m.pushMatrix();
 
-  glBindTexture(GL_TEXTURE_2D, bodyTexture);
-  glColor3f(1, 1, 1); // Set color to white to not affect texture color
+  Mesh &m = batch(BODY);
+  m.color(1, 1, 1); // Set color to white to not affect texture color
 
   // Drawing the cuboid using quads
-  glBegin(GL_QUADS);
+  m.begin(GL_QUADS);
 
   // Front face
-  glNormal3f(0, 0, 1);
-  glTexCoord2f(0, 0);
-  glVertex3f(-0.75f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
-  glTexCoord2f(1, 0);
-  glVertex3f(0.75f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
-  glTexCoord2f(1, 1);
-  glVertex3f(0.75f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
-  glTexCoord2f(0, 1);
-  glVertex3f(-0.75f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.normal(0, 0, 1);
+  m.texCoord(0, 0);
+  m.vertex(-0.75f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.texCoord(1, 0);
+  m.vertex(0.75f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.texCoord(1, 1);
+  m.vertex(0.75f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.texCoord(0, 1);
+  m.vertex(-0.75f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
 
   // Back face
-  glNormal3f(0, 0, -1);
-  glTexCoord2f(0, 0);
-  glVertex3f(-0.75f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
-  glTexCoord2f(1, 0);
-  glVertex3f(0.75f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
-  glTexCoord2f(1, 1);
-  glVertex3f(0.75f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
-  glTexCoord2f(0, 1);
-  glVertex3f(-0.75f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.normal(0, 0, -1);
+  m.texCoord(0, 0);
+  m.vertex(-0.75f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.texCoord(1, 0);
+  m.vertex(0.75f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.texCoord(1, 1);
+  m.vertex(0.75f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.texCoord(0, 1);
+  m.vertex(-0.75f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
 
   // Left face
-  glNormal3f(-1, 0, 0);
-  glTexCoord2f(0, 0);
-  glVertex3f(-0.75f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
-  glTexCoord2f(1, 0);
-  glVertex3f(-0.75f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
-  glTexCoord2f(1, 1);
-  glVertex3f(-0.75f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
-  glTexCoord2f(0, 1);
-  glVertex3f(-0.75f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.normal(-1, 0, 0);
+  m.texCoord(0, 0);
+  m.vertex(-0.75f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.texCoord(1, 0);
+  m.vertex(-0.75f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.texCoord(1, 1);
+  m.vertex(-0.75f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.texCoord(0, 1);
+  m.vertex(-0.75f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
 
   // Right face
-  glNormal3f(1, 0, 0);
-  glTexCoord2f(0, 0);
-  glVertex3f(0.75f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
-  glTexCoord2f(1, 0);
-  glVertex3f(0.75f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
-  glTexCoord2f(1, 1);
-  glVertex3f(0.75f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
-  glTexCoord2f(0, 1);
-  glVertex3f(0.75f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.normal(1, 0, 0);
+  m.texCoord(0, 0);
+  m.vertex(0.75f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.texCoord(1, 0);
+  m.vertex(0.75f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.texCoord(1, 1);
+  m.vertex(0.75f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.texCoord(0, 1);
+  m.vertex(0.75f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
 
   // Top face
-  glNormal3f(0, 1, 0);
-  glTexCoord2f(0, 0);
-  glVertex3f(-0.75f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
-  glTexCoord2f(1, 0);
-  glVertex3f(0.75f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
-  glTexCoord2f(1, 1);
-  glVertex3f(0.75f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
-  glTexCoord2f(0, 1);
-  glVertex3f(-0.75f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.normal(0, 1, 0);
+  m.texCoord(0, 0);
+  m.vertex(-0.75f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.texCoord(1, 0);
+  m.vertex(0.75f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.texCoord(1, 1);
+  m.vertex(0.75f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.texCoord(0, 1);
+  m.vertex(-0.75f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
 
   // Bottom face
-  glNormal3f(0, -1, 0);
-  glTexCoord2f(0, 0);
-  glVertex3f(-0.75f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
-  glTexCoord2f(1, 0);
-  glVertex3f(0.75f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
-  glTexCoord2f(1, 1);
-  glVertex3f(0.75f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
-  glTexCoord2f(0, 1);
-  glVertex3f(-0.75f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
-
-  glEnd();
+  m.normal(0, -1, 0);
+  m.texCoord(0, 0);
+  m.vertex(-0.75f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.texCoord(1, 0);
+  m.vertex(0.75f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.texCoord(1, 1);
+  m.vertex(0.75f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.texCoord(0, 1);
+  m.vertex(-0.75f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
+
+  m.end();
 }
 
 void Rover::buildRearPowerSource()
 {
   // Set the color for the power source
-  // glColor3f(0.0f, 0.0f, 1.0f); // Blue color
+  // m.color(0.0f, 0.0f, 1.0f); // Blue color
 
-  glBindTexture(GL_TEXTURE_2D, bodyTexture);
-  glColor3f(1, 1, 1); // Set color to white to not affect texture color
+  Mesh &m = batch(BODY);
+  m.color(1, 1, 1); // Set color to white to not affect texture color
 
   // Draw the rear power source using quads
-  glBegin(GL_QUADS);
+  m.begin(GL_QUADS);
 
   // Front face
-  glNormal3f(0, 0, 1);
-  glTexCoord2f(0, 0);
-  glVertex3f(-0.75f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
-  glTexCoord2f(1, 0);
-  glVertex3f(-0.85f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
-  glTexCoord2f(1, 1);
-  glVertex3f(-1.4f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
-  glTexCoord2f(0, 1);
-  glVertex3f(-0.75f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.normal(0, 0, 1);
+  m.texCoord(0, 0);
+  m.vertex(-0.75f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.texCoord(1, 0);
+  m.vertex(-0.85f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.texCoord(1, 1);
+  m.vertex(-1.4f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.texCoord(0, 1);
+  m.vertex(-0.75f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
 
   // Back face
-  glNormal3f(0, 0, -1);
-  glTexCoord2f(0, 0);
-  glVertex3f(-0.75f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
-  glTexCoord2f(1, 0);
-  glVertex3f(-0.85f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
-  glTexCoord2f(1, 1);
-  glVertex3f(-1.4f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
-  glTexCoord2f(0, 1);
-  glVertex3f(-0.75f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.normal(0, 0, -1);
+  m.texCoord(0, 0);
+  m.vertex(-0.75f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.texCoord(1, 0);
+  m.vertex(-0.85f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.texCoord(1, 1);
+  m.vertex(-1.4f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.texCoord(0, 1);
+  m.vertex(-0.75f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
 
   // Left face
-  glNormal3f(-1, 0, 0);
-  glTexCoord2f(0, 0);
-  glVertex3f(-0.75f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
-  glTexCoord2f(1, 0);
-  glVertex3f(-0.75f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
-  glTexCoord2f(1, 1);
-  glVertex3f(-0.75f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
-  glTexCoord2f(0, 1);
-  glVertex3f(-0.75f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.normal(-1, 0, 0);
+  m.texCoord(0, 0);
+  m.vertex(-0.75f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.texCoord(1, 0);
+  m.vertex(-0.75f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.texCoord(1, 1);
+  m.vertex(-0.75f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.texCoord(0, 1);
+  m.vertex(-0.75f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
 
   // Right face
-  glNormal3f(1, 0, 0);
-  glTexCoord2f(0, 0);
-  glVertex3f(-0.85f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
-  glTexCoord2f(1, 0);
-  glVertex3f(-0.85f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
-  glTexCoord2f(1, 1);
-  glVertex3f(-1.4f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
-  glTexCoord2f(0, 1);
-  glVertex3f(-1.4f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.normal(1, 0, 0);
+  m.texCoord(0, 0);
+  m.vertex(-0.85f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.texCoord(1, 0);
+  m.vertex(-0.85f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.texCoord(1, 1);
+  m.vertex(-1.4f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.texCoord(0, 1);
+  m.vertex(-1.4f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
 
   // // Top face
-  // glVertex3f(-0.75f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
-  // glVertex3f(-0.85f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
-  // glVertex3f(-0.85f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
-  // glVertex3f(-0.75f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
+  // m.vertex(-0.75f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
+  // m.vertex(-0.85f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size);
+  // m.vertex(-0.85f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
+  // m.vertex(-0.75f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size);
 
   // Bottom face
-  glNormal3f(0, -1, 0);
-  glTexCoord2f(0, 0);
-  glVertex3f(-0.75f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
-  glTexCoord2f(1, 0);
-  glVertex3f(-0.85f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
-  glTexCoord2f(1, 1);
-  glVertex3f(-0.85f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
-  glTexCoord2f(0, 1);
-  glVertex3f(-0.75f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
-
-  glEnd();
+  m.normal(0, -1, 0);
+  m.texCoord(0, 0);
+  m.vertex(-0.75f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.texCoord(1, 0);
+  m.vertex(-0.85f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.texCoord(1, 1);
+  m.vertex(-0.85f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.texCoord(0, 1);
+  m.vertex(-0.75f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size);
+
+  m.end();
 
   // Repeat the same quad but position more inner so lighting works
-  glBegin(GL_QUADS);
+  m.begin(GL_QUADS);
 
   // Front face
-  glNormal3f(0, 0, -1);
-  glTexCoord2f(0, 0);
-  glVertex3f(-0.75f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size - 0.01);
-  glTexCoord2f(1, 0);
-  glVertex3f(-0.85f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size - 0.01);
-  glTexCoord2f(1, 1);
-  glVertex3f(-1.4f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size - 0.01);
-  glTexCoord2f(0, 1);
-  glVertex3f(-0.75f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size - 0.01);
+  m.normal(0, 0, -1);
+  m.texCoord(0, 0);
+  m.vertex(-0.75f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size - 0.01);
+  m.texCoord(1, 0);
+  m.vertex(-0.85f * size, -0.25f * size + bodyPlacementHeight, 0.4f * size - 0.01);
+  m.texCoord(1, 1);
+  m.vertex(-1.4f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size - 0.01);
+  m.texCoord(0, 1);
+  m.vertex(-0.75f * size, 0.25f * size + bodyPlacementHeight, 0.4f * size - 0.01);
 
   // Back face
-  glNormal3f(0, 0, 1);
-  glTexCoord2f(0, 0);
-  glVertex3f(-0.75f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size + 0.01);
-  glTexCoord2f(1, 0);
-  glVertex3f(-0.85f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size + 0.01);
-  glTexCoord2f(1, 1);
-  glVertex3f(-1.4f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size + 0.01);
-  glTexCoord2f(0, 1);
-  glVertex3f(-0.75f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size + 0.01);
+  m.normal(0, 0, 1);
+  m.texCoord(0, 0);
+  m.vertex(-0.75f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size + 0.01);
+  m.texCoord(1, 0);
+  m.vertex(-0.85f * size, -0.25f * size + bodyPlacementHeight, -0.4f * size + 0.01);
+  m.texCoord(1, 1);
+  m.vertex(-1.4f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size + 0.01);
+  m.texCoord(0, 1);
+  m.vertex(-0.75f * size, 0.25f * size + bodyPlacementHeight, -0.4f * size + 0.01);
 
   // Left face
-  glNormal3f(1, 0, 0);
-  glTexCoord2f(0, 0);
-  glVertex3f(-0.75f * size + 0.01, -0.25f * size + bodyPlacementHeight, -0.4f * size);
-  glTexCoord2f(1, 0);
-  glVertex3f(-0.75f * size + 0.01, -0.25f * size + bodyPlacementHeight, 0.4f * size);
-  glTexCoord2f(1, 1);
-  glVertex3f(-0.75f * size + 0.01, 0.25f * size + bodyPlacementHeight, 0.4f * size);
-  glTexCoord2f(0, 1);
-  glVertex3f(-0.75f * size + 0.01, 0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.normal(1, 0, 0);
+  m.texCoord(0, 0);
+  m.vertex(-0.75f * size + 0.01, -0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.texCoord(1, 0);
+  m.vertex(-0.75f * size + 0.01, -0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.texCoord(1, 1);
+  m.vertex(-0.75f * size + 0.01, 0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.texCoord(0, 1);
+  m.vertex(-0.75f * size + 0.01, 0.25f * size + bodyPlacementHeight, -0.4f * size);
 
   // Right face
-  glNormal3f(-1, 0, 0);
-  glTexCoord2f(0, 0);
-  glVertex3f(-0.85f * size - 0.01, -0.25f * size + bodyPlacementHeight, -0.4f * size);
-  glTexCoord2f(1, 0);
-  glVertex3f(-0.85f * size - 0.01, -0.25f * size + bodyPlacementHeight, 0.4f * size);
-  glTexCoord2f(1, 1);
-  glVertex3f(-1.4f * size - 0.01, 0.25f * size + bodyPlacementHeight, 0.4f * size);
-  glTexCoord2f(0, 1);
-  glVertex3f(-1.4f * size - 0.01, 0.25f * size + bodyPlacementHeight, -0.4f * size);
-
-  glEnd();
+  m.normal(-1, 0, 0);
+  m.texCoord(0, 0);
+  m.vertex(-0.85f * size - 0.01, -0.25f * size + bodyPlacementHeight, -0.4f * size);
+  m.texCoord(1, 0);
+  m.vertex(-0.85f * size - 0.01, -0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.texCoord(1, 1);
+  m.vertex(-1.4f * size - 0.01, 0.25f * size + bodyPlacementHeight, 0.4f * size);
+  m.texCoord(0, 1);
+  m.vertex(-1.4f * size - 0.01, 0.25f * size + bodyPlacementHeight, -0.4f * size);
+
+  m.end();
 
   // Cylinder for the power source - sticking out in the back - using drawsupport function
   double powerSourceStart[3] = {
@@ -268,142 +486,90 @@ void Rover::buildRearPowerSource()
       bodyPlacementHeight * 1.7,
       0}; // End point
 
-  drawSupport(5, powerSourceStart, powerSourceEnd, wheelTexture);
+  drawSupport(5, powerSourceStart, powerSourceEnd, WHEEL);
 }
 
 void Rover::buildWheels()
 {
-
-  glBindTexture(GL_TEXTURE_2D, wheelTexture);
-  glColor3f(1, 1, 1); // Set color to white to not affect texture color
-
-  // Parameters for the wheel
-  double radius = 4.0; // Large radius for the wheel (adjust as needed)
-  double height = 5.0; // Thickness of the wheel
+  // Every wheel shares one mesh
+  wheelMesh.color(1, 1, 1);
+  drawWheel(wheelMesh, WHEEL_RADIUS, WHEEL_WIDTH);
+  wheelCenters.clear();
 
   // * Right side wheels
-
-  // Draw the rear right wheel
-  glPushMatrix();
-  // Position the wheel
-  glTranslated(-0.75 * size, bodyPlacementHeight * 0.3, 0.5 * size); // Position the wheel
-  drawWheel(radius, height);                                         // Draw the wheel
-  glPopMatrix();
-
-  // Draw the mid right wheel
-  glPushMatrix();
-  // Position the wheel
-  glTranslated(0.05 * size, bodyPlacementHeight * 0.3, 0.5 * size); // Position the wheel
-  drawWheel(radius, height);                                        // Draw the wheel
-  glPopMatrix();
-
-  // Draw the front right wheel
-  glPushMatrix();
-  // Position the wheel
-  glTranslated(0.75 * size, bodyPlacementHeight * 0.3, 0.5 * size); // Position the wheel
-  drawWheel(radius, height);                                        // Draw the wheel
-  glPopMatrix();
+  placeWheel(-0.75 * size, bodyPlacementHeight * 0.3, 0.5 * size); // Rear right wheel
+  placeWheel(0.05 * size, bodyPlacementHeight * 0.3, 0.5 * size);  // Mid right wheel
+  placeWheel(0.75 * size, bodyPlacementHeight * 0.3, 0.5 * size);  // Front right wheel
 
   // * Left side wheels
+  placeWheel(-0.75 * size, bodyPlacementHeight * 0.3, -0.7 * size); // Rear left wheel
+  placeWheel(0.05 * size, bodyPlacementHeight * 0.3, -0.7 * size);  // Mid left wheel
+  placeWheel(0.75 * size, bodyPlacementHeight * 0.3, -0.7 * size);  // Front left wheel
+}
 
-  // Draw the rear left wheel
-  glPushMatrix();
-  // Position the wheel
-  glTranslated(-0.75 * size, bodyPlacementHeight * 0.3, -0.7 * size); // Position the wheel
-  drawWheel(radius, height);                                          // Draw the wheel
-  glPopMatrix();
-
-  // Draw the mid left wheel
-  glPushMatrix();
-  // Position the wheel
-  glTranslated(0.05 * size, bodyPlacementHeight * 0.3, -0.7 * size); // Position the wheel
-  drawWheel(radius, height);                                         // Draw the wheel
-  glPopMatrix();
-
-  // Draw the front left wheel
-  glPushMatrix();
-  // Position the wheel
-  glTranslated(0.75 * size, bodyPlacementHeight * 0.3, -0.7 * size); // Position the wheel
-  drawWheel(radius, height);                                         // Draw the wheel
-  glPopMatrix();
+/*
+ *  Add a wheel instance at (x,y,z)
+ */
+void Rover::placeWheel(double x, double y, double z)
+{
+  double m[16];
+  Matrix::identity(m);
+  Matrix::translate(m, x, y, z);
+  part(wheelMesh).add(m, regions[WHEEL]);
+  wheelCenters.push_back(x);
+  wheelCenters.push_back(y);
+  wheelCenters.push_back(z);
 }
 
-void Rover::drawWheel(double radius, double height)
+void Rover::drawWheel(Mesh &m, double radius, double height)
 {
   // Set the wheel's color (optional)
-  glColor3f(0.3f, 0.3f, 0.3f); // Dark gray color for the wheel
+  m.color(0.3f, 0.3f, 0.3f); // Dark gray color for the wheel
 
-  // Draw the cylinder for the wheel
-  glPushMatrix();
+  int segments = 36; // Number of segments for smoothness of the wheel surface
 
-  int segments = 36;                       // Number of segments for smoothness of the wheel surface
-  double step = 2.0 * Util::PI / segments; // Incremental angle for each segment
+  // The unit tube runs along +Y, wheels run along +Z - swap the two axes
+  m.pushMatrix();
+  m.scale(1.0, 1.0, -1.0);
+  m.rotate(-90.0, 1.0, 0.0, 0.0);
 
-  // Draw the wheel using GL_QUAD_STRIP
-  glBegin(GL_QUAD_STRIP);
-  for (int i = 0; i <= segments; ++i)
-  {
-    double angle = i * step;
-    double x = radius * cos(angle);
-    double y = radius * sin(angle);
-
-    // Outer circle (top and bottom vertices)
-    glNormal3d(cos(angle), sin(angle), 0.0); // Normal for lighting
-    glTexCoord2f((float)i / segments, 0.0);
-    glVertex3d(x, y, 0.0); // Bottom vertex
-    glTexCoord2f((float)i / segments, 1.0);
-    glVertex3d(x, y, height); // Top vertex
-  }
-  glEnd();
+  // Outer tyre from z=0 to z=height
+  m.pushMatrix();
+  m.scale(radius, height, radius);
+  m.append(Primitives::tube(segments));
+  m.popMatrix();
 
-  // Draw the inner spoke center using GL_QUAD_STRIP
-  glColor3f(0.5f, 0.5f, 0.5f);
+  // Inner spoke center from z=height/1.5 back to z=height/2
+  m.color(0.5f, 0.5f, 0.5f);
   double innerRadius = radius / 4; // Radius for the inner circle
-  glBegin(GL_QUAD_STRIP);
-  for (int i = 0; i <= segments; ++i)
-  {
-    double angle = i * step;
-    double x = innerRadius * cos(angle);
-    double y = innerRadius * sin(angle);
-
-    // Inner circle (top and bottom vertices)
-    glNormal3d(cos(angle), sin(angle), 0.0); // Normal for lighting
-    glTexCoord2f((float)i / segments, 0.0);
-    glVertex3d(x, y, height / 1.5); // Bottom vertex
-    glTexCoord2f((float)i / segments, 1.0);
-    glVertex3d(x, y, height / 2); // Top vertex
-  }
-  glEnd();
+  m.pushMatrix();
+  m.translate(0.0, height / 1.5, 0.0);
+  m.scale(innerRadius, height / 2 - height / 1.5, innerRadius);
+  m.append(Primitives::tube(segments));
+  m.popMatrix();
+
+  m.popMatrix();
 
   // Draw 6 evenly spaced spokes connecting the inner circle to the outer circle
-  glLineWidth(4.0f); // Increase line width for spokes
-  glBegin(GL_LINES);
+  m.setLineWidth(4.0f); // Increase line width for spokes
+  m.begin(GL_LINES);
   int spokeCount = 6;
+  const std::vector<double> &spokes = Primitives::circle(spokeCount);
   for (int i = 0; i < spokeCount; ++i)
   {
-    double angle = i * (2.0 * Util::PI / spokeCount); // Calculate the angle for each spoke
-
-    // Outer circle coordinates
-    double outerX = radius * cos(angle);
-    double outerY = radius * sin(angle);
-
-    // Inner circle coordinates
-    double innerX = innerRadius * cos(angle);
-    double innerY = innerRadius * sin(angle);
+    double c = spokes[2 * i];
+    double s = spokes[2 * i + 1];
 
     // Draw line (spoke) from inner circle to outer circle
-    glTexCoord2f(0.0, 0.0);
-    glVertex3d(innerX, innerY, height / 2); // Inner point
-    glTexCoord2f(1.0, 1.0);
-    glVertex3d(outerX, outerY, height / 2); // Outer point
+    m.texCoord(0.0, 0.0);
+    m.vertex(innerRadius * c, innerRadius * s, height / 2); // Inner point
+    m.texCoord(1.0, 1.0);
+    m.vertex(radius * c, radius * s, height / 2); // Outer point
   }
-  glEnd();
-  glLineWidth(1.0f); // Reset line width to default
-
-  glPopMatrix();
+  m.end();
 }
 
-void Rover::buildCamera(bool isDay)
+void Rover::buildCamera()
 {
   // * Camera arm
   double cameraArmStart[3] = {
@@ -416,14 +582,14 @@ void Rover::buildCamera(bool isDay)
       bodyPlacementHeight * 2.0,
       0.27 * size}; // End point
 
-  drawSupport(0.8, cameraArmStart, cameraArmEnd, -1);
+  drawSupport(0.8, cameraArmStart, cameraArmEnd, SUPPORT);
 
   // * Camera (Rectangular Prism)
   // Set the color for the camera
-  // glColor3f(1.0f, 1.0f, 1.0f); // White color
+  // m.color(1.0f, 1.0f, 1.0f); // White color
 
-  glBindTexture(GL_TEXTURE_2D, bodyTexture);
-  glColor3f(1, 1, 1); // Set color to white to not affect texture color
+  Mesh &m = batch(BODY);
+  m.color(1, 1, 1); // Set color to white to not affect texture color
 
   // Dimensions for the rectangular camera
   double cubeWidth = 0.17 * size;  // X-axis
@@ -440,373 +606,293 @@ void Rover::buildCamera(bool isDay)
   double halfDepth = cubeDepth / 2.0;
 
   // Drawing the camera using quads
-  glBegin(GL_QUADS);
+  m.begin(GL_QUADS);
 
   // Front face (Positive Z)
-  glNormal3f(0.0f, 0.0f, 1.0f); // Normal pointing forward
-  glTexCoord2f(0, 0);
-  glVertex3f(centerX - halfWidth, centerY - halfHeight, centerZ + halfDepth);
-  glTexCoord2f(1, 0);
-  glVertex3f(centerX + halfWidth, centerY - halfHeight, centerZ + halfDepth);
-  glTexCoord2f(1, 1);
-  glVertex3f(centerX + halfWidth, centerY + halfHeight, centerZ + halfDepth);
-  glTexCoord2f(0, 1);
-  glVertex3f(centerX - halfWidth, centerY + halfHeight, centerZ + halfDepth);
+  m.normal(0.0f, 0.0f, 1.0f); // Normal pointing forward
+  m.texCoord(0, 0);
+  m.vertex(centerX - halfWidth, centerY - halfHeight, centerZ + halfDepth);
+  m.texCoord(1, 0);
+  m.vertex(centerX + halfWidth, centerY - halfHeight, centerZ + halfDepth);
+  m.texCoord(1, 1);
+  m.vertex(centerX + halfWidth, centerY + halfHeight, centerZ + halfDepth);
+  m.texCoord(0, 1);
+  m.vertex(centerX - halfWidth, centerY + halfHeight, centerZ + halfDepth);
 
   // Back face (Negative Z)
-  glNormal3f(0.0f, 0.0f, -1.0f); // Normal pointing backward
-  glTexCoord2f(0, 0);
-  glVertex3f(centerX - halfWidth, centerY - halfHeight, centerZ - halfDepth);
-  glTexCoord2f(1, 0);
-  glVertex3f(centerX + halfWidth, centerY - halfHeight, centerZ - halfDepth);
-  glTexCoord2f(1, 1);
-  glVertex3f(centerX + halfWidth, centerY + halfHeight, centerZ - halfDepth);
-  glTexCoord2f(0, 1);
-  glVertex3f(centerX - halfWidth, centerY + halfHeight, centerZ - halfDepth);
+  m.normal(0.0f, 0.0f, -1.0f); // Normal pointing backward
+  m.texCoord(0, 0);
+  m.vertex(centerX - halfWidth, centerY - halfHeight, centerZ - halfDepth);
+  m.texCoord(1, 0);
+  m.vertex(centerX + halfWidth, centerY - halfHeight, centerZ - halfDepth);
+  m.texCoord(1, 1);
+  m.vertex(centerX + halfWidth, centerY + halfHeight, centerZ - halfDepth);
+  m.texCoord(0, 1);
+  m.vertex(centerX - halfWidth, centerY + halfHeight, centerZ - halfDepth);
 
   // Left face (Negative X)
-  glNormal3f(-1.0f, 0.0f, 0.0f); // Normal pointing left
-  glTexCoord2f(0, 0);
-  glVertex3f(centerX - halfWidth, centerY - halfHeight, centerZ - halfDepth);
-  glTexCoord2f(1, 0);
-  glVertex3f(centerX - halfWidth, centerY - halfHeight, centerZ + halfDepth);
-  glTexCoord2f(1, 1);
-  glVertex3f(centerX - halfWidth, centerY + halfHeight, centerZ + halfDepth);
-  glTexCoord2f(0, 1);
-  glVertex3f(centerX - halfWidth, centerY + halfHeight, centerZ - halfDepth);
+  m.normal(-1.0f, 0.0f, 0.0f); // Normal pointing left
+  m.texCoord(0, 0);
+  m.vertex(centerX - halfWidth, centerY - halfHeight, centerZ - halfDepth);
+  m.texCoord(1, 0);
+  m.vertex(centerX - halfWidth, centerY - halfHeight, centerZ + halfDepth);
+  m.texCoord(1, 1);
+  m.vertex(centerX - halfWidth, centerY + halfHeight, centerZ + halfDepth);
+  m.texCoord(0, 1);
+  m.vertex(centerX - halfWidth, centerY + halfHeight, centerZ - halfDepth);
 
   // Right face (Positive X)
-  glNormal3f(1.0f, 0.0f, 0.0f); // Normal pointing right
-  glTexCoord2f(0, 0);
-  glVertex3f(centerX + halfWidth, centerY - halfHeight, centerZ - halfDepth);
-  glTexCoord2f(1, 0);
-  glVertex3f(centerX + halfWidth, centerY - halfHeight, centerZ + halfDepth);
-  glTexCoord2f(1, 1);
-  glVertex3f(centerX + halfWidth, centerY + halfHeight, centerZ + halfDepth);
-  glTexCoord2f(0, 1);
-  glVertex3f(centerX + halfWidth, centerY + halfHeight, centerZ - halfDepth);
+  m.normal(1.0f, 0.0f, 0.0f); // Normal pointing right
+  m.texCoord(0, 0);
+  m.vertex(centerX + halfWidth, centerY - halfHeight, centerZ - halfDepth);
+  m.texCoord(1, 0);
+  m.vertex(centerX + halfWidth, centerY - halfHeight, centerZ + halfDepth);
+  m.texCoord(1, 1);
+  m.vertex(centerX + halfWidth, centerY + halfHeight, centerZ + halfDepth);
+  m.texCoord(0, 1);
+  m.vertex(centerX + halfWidth, centerY + halfHeight, centerZ - halfDepth);
 
   // Top face (Positive Y)
-  glNormal3f(0.0f, 1.0f, 0.0f); // Normal pointing up
-  glTexCoord2f(0, 0);
-  glVertex3f(centerX - halfWidth, centerY + halfHeight, centerZ - halfDepth);
-  glTexCoord2f(1, 0);
-  glVertex3f(centerX + halfWidth, centerY + halfHeight, centerZ - halfDepth);
-  glTexCoord2f(1, 1);
-  glVertex3f(centerX + halfWidth, centerY + halfHeight, centerZ + halfDepth);
-  glTexCoord2f(0, 1);
-  glVertex3f(centerX - halfWidth, centerY + halfHeight, centerZ + halfDepth);
+  m.normal(0.0f, 1.0f, 0.0f); // Normal pointing up
+  m.texCoord(0, 0);
+  m.vertex(centerX - halfWidth, centerY + halfHeight, centerZ - halfDepth);
+  m.texCoord(1, 0);
+  m.vertex(centerX + halfWidth, centerY + halfHeight, centerZ - halfDepth);
+  m.texCoord(1, 1);
+  m.vertex(centerX + halfWidth, centerY + halfHeight, centerZ + halfDepth);
+  m.texCoord(0, 1);
+  m.vertex(centerX - halfWidth, centerY + halfHeight, centerZ + halfDepth);
 
   // Bottom face (Negative Y)
-  glNormal3f(0.0f, -1.0f, 0.0f); // Normal pointing down
-  glTexCoord2f(0, 0);
-  glVertex3f(centerX - halfWidth, centerY - halfHeight, centerZ - halfDepth);
-  glTexCoord2f(1, 0);
-  glVertex3f(centerX + halfWidth, centerY - halfHeight, centerZ - halfDepth);
-  glTexCoord2f(1, 1);
-  glVertex3f(centerX + halfWidth, centerY - halfHeight, centerZ + halfDepth);
-  glTexCoord2f(0, 1);
-  glVertex3f(centerX - halfWidth, centerY - halfHeight, centerZ + halfDepth);
-
-  glEnd();
+  m.normal(0.0f, -1.0f, 0.0f); // Normal pointing down
+  m.texCoord(0, 0);
+  m.vertex(centerX - halfWidth, centerY - halfHeight, centerZ - halfDepth);
+  m.texCoord(1, 0);
+  m.vertex(centerX + halfWidth, centerY - halfHeight, centerZ - halfDepth);
+  m.texCoord(1, 1);
+  m.vertex(centerX + halfWidth, centerY - halfHeight, centerZ + halfDepth);
+  m.texCoord(0, 1);
+  m.vertex(centerX - halfWidth, centerY - halfHeight, centerZ + halfDepth);
+
+  m.end();
 
   // * Camera lens (Sphere)
   // Set the color for the camera lens
-  // glColor3f(0.0f, 0.0f, 0.0f); // Black color
-  glBindTexture(GL_TEXTURE_2D, wheelTexture);
-  glColor3f(1, 1, 1); // Set color to white to not affect texture color
+  // m.color(0.0f, 0.0f, 0.0f); // Black color
+  lensMesh.color(1, 1, 1); // Set color to white to not affect texture color
+  lensMesh.texRegion(regions[WHEEL]);
 
   // Define the lens position and size
   double lensRadius = 0.05 * size; // Adjust as needed
-  double lensX = centerX + (halfWidth * 0.7);
-  double lensY = centerY;
-  double lensZ = centerZ - (halfDepth * 0.5); // Slightly protrude outwards
-
-  // Draw the sphere (lens) using Util::ball
-  Util::ball(lensX, lensY, lensZ, lensRadius, 10.0, 50.0, 0.0);
-
-  // **Add Light Source at the Lens When It's Night**
-  if (!isDay)
+  lensPosition[0] = centerX + (halfWidth * 0.7);
+  lensPosition[1] = centerY;
+  lensPosition[2] = centerZ - (halfDepth * 0.5); // Slightly protrude outwards
+
+  // Record the sphere (lens), drawn with the Util::ball material
+  Util::sphere(lensMesh, lensPosition[0], lensPosition[1], lensPosition[2], lensRadius, 10.0);
+
+  // **Beam of Light (Cone)** - only drawn at night
+  // Set the cone color with transparency
+  beamMesh.color(1.0f, 1.0f, 1.0f, 0.3f);
+
+  // Beam parameters
+  double beamLength = 100.0; // Adjust the length of the beam
+  double beamAngle = 15.0;   // Beam angle in degrees (half-angle of the cone)
+  int segments = 36;         // Number of segments around the base
+  double beamRadius = beamLength * tan(beamAngle * M_PI / 180.0);
+
+  // Save current transformation matrix
+  beamMesh.pushMatrix();
+
+  // Translate to the lens position
+  beamMesh.translate(lensPosition[0], lensPosition[1], lensPosition[2]);
+
+  // Align the cone with the beam direction
+  // Beam direction (adjust if needed)
+  double dirX = -1.0; // Assuming the beam points along the positive X-axis
+  double dirY = 0.0;
+  double dirZ = 0.0;
+
+  // Calculate rotation axis and angle
+  double upX = 0.0, upY = 1.0, upZ = 0.0; // Up vector
+  double rotationAxisX = upY * dirZ - upZ * dirY;
+  double rotationAxisY = upZ * dirX - upX * dirZ;
+  double rotationAxisZ = upX * dirY - upY * dirX;
+  double rotationAngle = acos(dirY) * 180.0 / M_PI;
+
+  // Avoid division by zero
+  if (rotationAxisX != 0 || rotationAxisY != 0 || rotationAxisZ != 0)
   {
-    // Enable GL_LIGHT1
-    glEnable(GL_LIGHT1);
-
-    // Set the light's position (at the lens)
-    GLfloat lightPos[] = {(GLfloat)lensX, (GLfloat)lensY, (GLfloat)lensZ, 1.0f}; // Positional light
-    glLightfv(GL_LIGHT1, GL_POSITION, lightPos);
-
-    // Set ambient, diffuse, and specular components for brighter light
-    GLfloat ambient[] = {0.4f, 0.4f, 0.4f, 1.0f};  // Increased ambient
-    GLfloat diffuse[] = {1.0f, 1.0f, 1.0f, 1.0f};  // Maxed out diffuse
-    GLfloat specular[] = {1.0f, 1.0f, 1.0f, 1.0f}; // Maxed out specular
-    glLightfv(GL_LIGHT1, GL_AMBIENT, ambient);
-    glLightfv(GL_LIGHT1, GL_DIFFUSE, diffuse);
-    glLightfv(GL_LIGHT1, GL_SPECULAR, specular);
-
-    // Adjust attenuation for a more focused and brighter light
-    glLightf(GL_LIGHT1, GL_CONSTANT_ATTENUATION, 1.0f);   // Remains the same
-    glLightf(GL_LIGHT1, GL_LINEAR_ATTENUATION, 0.05f);    // Reduced linear attenuation
-    glLightf(GL_LIGHT1, GL_QUADRATIC_ATTENUATION, 0.02f); // Further reduced quadratic attenuation
-
-    // Enhanced spotlight settings for better illumination
-    GLfloat spotDirection[] = {1.0f, 0.0f, 0.0f}; // Ensure this points correctly based on camera orientation
-    glLightfv(GL_LIGHT1, GL_SPOT_DIRECTION, spotDirection);
-    glLightf(GL_LIGHT1, GL_SPOT_CUTOFF, 45.0f);   // Increased cone angle for wider coverage
-    glLightf(GL_LIGHT1, GL_SPOT_EXPONENT, 20.0f); // Increased concentration for sharper spotlight
-
-    // **Render the Beam of Light (Cone)**
-    // Enable blending for transparency
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    // Set the cone color with transparency
-    glColor4f(1.0f, 1.0f, 1.0f, 0.3f);
-
-    // Disable lighting on the cone to make it emissive
-    glDisable(GL_LIGHTING);
-
-    // Set emissive material property
-    GLfloat emissive[] = {1.0f, 1.0f, 1.0f, 0.3f};
-    glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, emissive);
-
-    // Beam parameters
-    double beamLength = 100.0; // Adjust the length of the beam
-    double beamAngle = 15.0;   // Beam angle in degrees (half-angle of the cone)
-    int segments = 36;         // Number of segments around the base
-    double beamRadius = beamLength * tan(beamAngle * M_PI / 180.0);
-
-    // Save current transformation matrix
-    glPushMatrix();
-
-    // Translate to the lens position
-    glTranslatef((GLfloat)lensX, (GLfloat)lensY, (GLfloat)lensZ);
-
-    // Align the cone with the beam direction
-    // Beam direction (adjust if needed)
-    double dirX = -1.0; // Assuming the beam points along the positive X-axis
-    double dirY = 0.0;
-    double dirZ = 0.0;
-
-    // Calculate rotation axis and angle
-    double upX = 0.0, upY = 1.0, upZ = 0.0; // Up vector
-    double rotationAxisX = upY * dirZ - upZ * dirY;
-    double rotationAxisY = upZ * dirX - upX * dirZ;
-    double rotationAxisZ = upX * dirY - upY * dirX;
-    double rotationAngle = acos(dirY) * 180.0 / M_PI;
-
-    // Avoid division by zero
-    if (rotationAxisX != 0 || rotationAxisY != 0 || rotationAxisZ != 0)
-    {
-      glRotatef((GLfloat)rotationAngle, (GLfloat)rotationAxisX, (GLfloat)rotationAxisY, (GLfloat)rotationAxisZ);
-    }
-
-    // Draw the cone
-    glBegin(GL_TRIANGLE_FAN);
-
-    // Apex of the cone at the origin (lens position)
-    glVertex3f(0.0f, 0.0f, 0.0f);
-
-    // Base of the cone
-    for (int i = 0; i <= segments; ++i)
-    {
-      double theta = i * 2.0 * M_PI / segments;
-      double x = beamRadius * cos(theta);
-      double z = beamRadius * sin(theta);
-      glVertex3f((GLfloat)x, (GLfloat)-beamLength, (GLfloat)z);
-    }
-
-    glEnd();
-
-    // Restore the transformation matrix
-    glPopMatrix();
-
-    // Disable blending
-    glDisable(GL_BLEND);
-
-    // Re-enable lighting if needed
-    glEnable(GL_LIGHTING);
-
-    // Reset emissive material property
-    GLfloat no_emissive[] = {0.0f, 0.0f, 0.0f, 1.0f};
-    glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, no_emissive);
-  }
-  else
-  {
-    // Disable GL_LIGHT1 during the day
-    glDisable(GL_LIGHT1);
+    beamMesh.rotate(rotationAngle, rotationAxisX, rotationAxisY, rotationAxisZ);
   }
+
+  // Shared unit cone scaled to the beam
+  beamMesh.scale(beamRadius, beamLength, beamRadius);
+  beamMesh.append(Primitives::cone(segments));
+
+  // Restore the transformation matrix
+  beamMesh.popMatrix();
 }
 
-void Rover::buildArmDrill()
+void Rover::setupHeadlamp(bool isDay, const double model[16])
 {
-  // * Drill arm
-  // Set the color for the drill arm
-  glColor3f(1.0f, 1.0f, 1.0f); // White color
-
-  double drillArmStart[3] = {0.75 * size, bodyPlacementHeight, -0.38 * size};
-  double drillArmEnd[3] = {1.0 * size, bodyPlacementHeight * 0.95, -0.08 * size};
-  drawSupport(0.8, drillArmStart, drillArmEnd, bodyTexture);
+  // The headlamp only shines at night
+  if (isDay)
+    return;
 
-  double drillArmStart2[3] = {1.0 * size, bodyPlacementHeight * 0.95, -0.08 * size};
-  double drillArmEnd2[3] = {1.3 * size, bodyPlacementHeight * 1.3, 0.4 * size};
-  drawSupport(0.8, drillArmStart2, drillArmEnd2, bodyTexture);
+  double pose[16];
+  Matrix::identity(pose);
+  Lights::add(headlamp(model ? model : pose));
+}
 
-  // * Vertical drill machine
-  // Set the color for the drill machine
-  // glColor3f(0.0f, 0.1f, 0.0f); // Dark green color
+Lights::Light Rover::headlamp(const double pose[16]) const
+{
+  // Bright spotlight at the lens, pointing ahead along +X with a wide, sharp cone
+  double p[3];
+  Matrix::transformPoint(pose, lensPosition, p);
+  Lights::Light lamp = {{(float)p[0], (float)p[1], (float)p[2], 1.0f},
+                        {0.4f, 0.4f, 0.4f},
+                        {1.0f, 1.0f, 1.0f},
+                        {1.0f, 1.0f, 1.0f},
+                        {1.0f, 0.05f, 0.02f},
+                        {(float)pose[0], (float)pose[1], (float)pose[2]},
+                        45.0f,
+                        20.0f};
+  return lamp;
+}
 
-  // Vertical support for the drill machine
+void Rover::buildArmDrill()
+{
+  // * Drill arm - the arms bend their bones between the joints on the GPU
+  //   (see Arms), so only the unit meshes are recorded here. The arm is a
+  //   tube from the origin up +Y to 1, drawn from shoulder to elbow and
+  //   from elbow to wrist
+  double joints[3 * Arms::JOINT_COUNT];
+  armRest(joints, drillBitEnd);
+  armMesh.color(1, 1, 1);
+  armMesh.texRegion(regions[BODY]);
+  armMesh.pushMatrix();
+  armMesh.scale(0.8, 1, 0.8);
+  armMesh.append(Primitives::cylinder(36));
+  armMesh.popMatrix();
+
+  // * Drill head - recorded where it hangs at rest, around the wrist
+  const double *wrist = &joints[3 * Arms::WRIST];
+  drillHeadMesh.color(1, 1, 1);
+  drillHeadMesh.translate(-wrist[0], -wrist[1], -wrist[2]);
+
+  // Vertical drill machine
   double drillMachineStart[3] = {1.3 * size, bodyPlacementHeight * 1.4, 0.4 * size};
   double drillMachineEnd[3] = {1.3 * size, bodyPlacementHeight * 0.9, 0.4 * size};
-  drawSupport(2.5, drillMachineStart, drillMachineEnd, drillTexture);
+  drawHeadPart(2.5, drillMachineStart, drillMachineEnd, DRILL);
 
   // * Drill bit
   double drillBitStart[3] = {1.3 * size, bodyPlacementHeight * 1.5, 0.4 * size};
-  double drillBitEnd[3] = {1.3 * size, bodyPlacementHeight * 0.8, 0.4 * size};
-  drawSupport(0.5, drillBitStart, drillBitEnd, wheelTexture);
+  drawHeadPart(0.5, drillBitStart, drillBitEnd, WHEEL);
 
   // * Drill bit supports
   double drillBitSupport1Start[3] = {1.25 * size, bodyPlacementHeight * 1.5, 0.4 * size};
   double drillBitSupport1End[3] = {1.25 * size, bodyPlacementHeight * 0.8, 0.4 * size};
-  drawSupport(0.5, drillBitSupport1Start, drillBitSupport1End, drillTexture);
+  drawHeadPart(0.5, drillBitSupport1Start, drillBitSupport1End, DRILL);
 
   double drillBitSupport2Start[3] = {1.35 * size, bodyPlacementHeight * 1.5, 0.4 * size};
   double drillBitSupport2End[3] = {1.35 * size, bodyPlacementHeight * 0.8, 0.4 * size};
-  drawSupport(0.5, drillBitSupport2Start, drillBitSupport2End, drillTexture);
+  drawHeadPart(0.5, drillBitSupport2Start, drillBitSupport2End, DRILL);
+}
+
+void Rover::armRest(double joints[9], double tip[3]) const
+{
+  // Shoulder on the body's front corner, the elbow dropped below the line
+  // to the wrist so the arm bends down as it reaches
+  const double rest[9] = {0.75 * size, bodyPlacementHeight, -0.38 * size,
+                          1.0 * size, bodyPlacementHeight * 0.95, -0.08 * size,
+                          1.3 * size, bodyPlacementHeight * 1.3, 0.4 * size};
+  for (int k = 0; k < 9; k++)
+    joints[k] = rest[k];
+  tip[0] = 1.3 * size;
+  tip[1] = bodyPlacementHeight * 0.8;
+  tip[2] = 0.4 * size;
+}
+
+double Rover::groundHeight() const
+{
+  // Under the wheels, whose centers buildWheels puts at 0.3 of the body height
+  return bodyPlacementHeight * 0.3 - WHEEL_RADIUS;
 }
 
 void Rover::buildSupports()
 {
   // // Dark gun metal color for the supports
-  // glColor3f(0.2f, 0.2f, 0.2f);
+  // m.color(0.2f, 0.2f, 0.2f);
 
   // * First support
   double supportOneStart[3] = {-0.75 * size, bodyPlacementHeight * .68, 0.5 * size}; // Start point
   double supportOneEnd[3] = {-0.30 * size, bodyPlacementHeight * .68, 0.5 * size};   // End point
-  drawSupport(1.0, supportOneStart, supportOneEnd, -1);
+  drawSupport(1.0, supportOneStart, supportOneEnd, SUPPORT);
 
   double supportOneStartA[3] = {-0.30 * size, bodyPlacementHeight * .68, 0.5 * size};
   double supportOneEndA[3] = {0.22 * size, bodyPlacementHeight, 0.5 * size};
-  drawSupport(1.0, supportOneStartA, supportOneEndA, -1);
+  drawSupport(1.0, supportOneStartA, supportOneEndA, SUPPORT);
 
   double supportOneStartB[3] = {0.22 * size, bodyPlacementHeight, 0.5 * size};
   double supportOneEndB[3] = {0.75 * size, bodyPlacementHeight * 0.68, 0.5 * size};
-  drawSupport(1.0, supportOneStartB, supportOneEndB, -1);
+  drawSupport(1.0, supportOneStartB, supportOneEndB, SUPPORT);
 
   double supportOneStartC[3] = {-0.30 * size, bodyPlacementHeight * 0.68, 0.5 * size};
   double supportOneEndC[3] = {0.05 * size, bodyPlacementHeight * 0.4, 0.5 * size};
-  drawSupport(0.6, supportOneStartC, supportOneEndC, -1);
+  drawSupport(0.6, supportOneStartC, supportOneEndC, SUPPORT);
 
   // * Second support
   double supportTwoStart[3] = {-0.75 * size, bodyPlacementHeight * .68, -0.5 * size}; // Start point
   double supportTwoEnd[3] = {-0.30 * size, bodyPlacementHeight * .68, -0.5 * size};   // End point
-  drawSupport(1.0, supportTwoStart, supportTwoEnd, -1);
+  drawSupport(1.0, supportTwoStart, supportTwoEnd, SUPPORT);
 
   double supportTwoStartA[3] = {-0.30 * size, bodyPlacementHeight * .68, -0.5 * size};
   double supportTwoEndA[3] = {0.22 * size, bodyPlacementHeight, -0.5 * size};
-  drawSupport(1.0, supportTwoStartA, supportTwoEndA, -1);
+  drawSupport(1.0, supportTwoStartA, supportTwoEndA, SUPPORT);
 
   double supportTwoStartB[3] = {0.22 * size, bodyPlacementHeight, -0.5 * size};
   double supportTwoEndB[3] = {0.75 * size, bodyPlacementHeight * 0.68, -0.5 * size};
-  drawSupport(1.0, supportTwoStartB, supportTwoEndB, -1);
+  drawSupport(1.0, supportTwoStartB, supportTwoEndB, SUPPORT);
 
   double supportTwoStartC[3] = {-0.30 * size, bodyPlacementHeight * 0.68, -0.5 * size};
   double supportTwoEndC[3] = {0.05 * size, bodyPlacementHeight * 0.4, -0.5 * size};
-  drawSupport(0.6, supportTwoStartC, supportTwoEndC, -1);
+  drawSupport(0.6, supportTwoStartC, supportTwoEndC, SUPPORT);
 }
 
-void Rover::drawSupport(double radius, const double start[3], const double end[3], int texture)
+void Rover::drawSupport(double radius, const double start[3], const double end[3], Material material)
 {
-  if (texture == -1)
-  {
-    glBindTexture(GL_TEXTURE_2D, supportTexture); // Set to default support texture
-  }
-  else
-  {
-    glBindTexture(GL_TEXTURE_2D, texture); // Set to custom texture
-  }
-  glColor3f(1, 1, 1); // Set color to white to not affect texture color
-
-  // Calculate the rotation angle and axis to align the cylinder
-  double angle;
-  double rotationAxis[3];
-  Util::calculateRotation(start, end, angle, rotationAxis);
-
-  // Direction vector from start to end
-  double dirX = end[0] - start[0];
-  double dirY = end[1] - start[1];
-  double dirZ = end[2] - start[2];
-
-  // Calculate the length of the cylinder
-  double cylinderLength = sqrt(dirX * dirX + dirY * dirY + dirZ * dirZ);
-  if (cylinderLength == 0.0)
-    return; // Avoid drawing a zero-length cylinder
-
-  // Save the current transformation matrix
-  glPushMatrix();
-
-  // Translate to the start position
-  glTranslated(start[0], start[1], start[2]);
-
-  // Rotate the cylinder to align with the direction vector
-  if (angle != 0.0)
-    glRotated(angle, rotationAxis[0], rotationAxis[1], rotationAxis[2]);
+  // Avoid drawing a zero-length cylinder
+  if (start[0] == end[0] && start[1] == end[1] && start[2] == end[2])
+    return;
 
-  // Set color for the support (e.g., brown)
-  // glColor3f(0.54f, 0.47f, 0.3f); // Brown color
-
-  // Define the number of segments for the cylinder
-  int segments = 36; // More segments = smoother cylinder
-  double step = 2.0 * Util::PI / segments;
-
-  // Draw the cylinder sides using GL_QUAD_STRIP
-  glBegin(GL_QUAD_STRIP);
-  for (int i = 0; i <= segments; ++i)
-  {
-    double theta = i * step;
-    double x = radius * cos(theta);
-    double z = radius * sin(theta);
-
-    // Compute the normal vector for lighting
-    glNormal3d(cos(theta), 0.0, sin(theta));
-
-    // Calculate texture coordinates
-    double texCoord = static_cast<double>(i) / segments;
-
-    glTexCoord2d(texCoord, 0.0);
-    glVertex3d(x, 0.0, z); // Bottom vertex
-
-    glTexCoord2d(texCoord, 1.0);
-    glVertex3d(x, cylinderLength, z); // Top vertex
-  }
-  glEnd();
-
-  // Draw the bottom cap using GL_TRIANGLE_FAN
-  glBegin(GL_TRIANGLE_FAN);
-  glNormal3d(0.0, -1.0, 0.0); // Normal pointing down
-  glVertex3d(0.0, 0.0, 0.0);  // Center of the bottom cap
-  for (int i = 0; i <= segments; ++i)
+  // A new entry in the strut table, placed with the others once they are all recorded
+  Strut strut;
+  for (int k = 0; k < 3; k++)
   {
-    double theta = i * step;
-    double x = radius * cos(theta);
-    double z = radius * sin(theta);
-    glVertex3d(x, 0.0, z);
+    strut.start[k] = start[k];
+    strut.end[k] = end[k];
   }
-  glEnd();
+  strut.radius = radius;
+  strut.material = material;
+  Matrix::identity(strut.transform);
+  struts.push_back(strut);
 
-  // Draw the top cap using GL_TRIANGLE_FAN
-  glBegin(GL_TRIANGLE_FAN);
-  glNormal3d(0.0, 1.0, 0.0);            // Normal pointing up
-  glVertex3d(0.0, cylinderLength, 0.0); // Center of the top cap
-  for (int i = 0; i <= segments; ++i)
-  {
-    double theta = i * step;
-    double x = radius * cos(theta);
-    double z = radius * sin(theta);
-    glVertex3d(x, cylinderLength, z);
-  }
-  glEnd();
+  // Instance of the shared unit cylinder textured with the material
+  part(Primitives::cylinder(36)).add(strut.transform, regions[material]);
+}
 
-  // Restore the transformation matrix
-  glPopMatrix();
+/*
+ *  Cylinder of the drill head from start to end - recorded straight into
+ *  its mesh, which the arms hang from the wrist
+ */
+void Rover::drawHeadPart(double radius, const double start[3], const double end[3], Material material)
+{
+  double m[16];
+  Matrix::segment(m, start, end, radius);
+  drillHeadMesh.pushMatrix();
+  drillHeadMesh.multMatrix(m);
+  drillHeadMesh.texRegion(regions[material]);
+  drillHeadMesh.append(Primitives::cylinder(36));
+  drillHeadMesh.popMatrix();
 }
@@ -2,6 +2,11 @@
 #include "scene.hpp"
 #include "util.hpp"
 #include "rover.hpp"
+#include "primitives.hpp"
+#include "mesh.hpp"
+#include "textures.hpp"
+#include "matrix.hpp"
+#include "lights.hpp"
 
 #ifdef USEGLEW
 #include <GL/glew.h>
@@ -16,14 +21,42 @@
 #include <GL/glut.h>
 #endif
 
+// Rocks in the field unless set otherwise, and the reach the HUD counts them within
+static const int ROCKS = 20000;
+static const double NEARBY = 30.0;
+// Base-station lamps lit at night unless set otherwise
+static const int BEACONS = 120;
+// Sun ball size
+static const double SUN_RADIUS = 20.0;
+// Ground around the rover the sun shadows, ahead and behind, up to the mountain tops, and across
+static const double SHADOWED_LO[3] = {-160.0, -20.0, -170.0};
+static const double SHADOWED_HI[3] = {160.0, 80.0, 170.0};
+
 // Cosine and Sine in degrees
 #define Cos(x) (cos((x) * 3.14159265 / 180))
 #define Sin(x) (sin((x) * 3.14159265 / 180))
 
-Scene::Scene(double dim, int res, int fov, double asp) : dim(dim), res(res), fov(fov), asp(asp), th(0), ph(0), showAxes(true), viewMode(0), moveSpeed(5), rotSpeed(0.2), light(true), spin(true)
+Scene::Scene(double dim, int res, int fov, double asp) : dim(dim), res(res), fov(fov), asp(asp), width(800), height(800), terrain(2024), rocks(2024, ROCKS), beacons(2024, BEACONS), fleet(2024, 0), debrisEmitter(0), zh(90), angle(0.0), th(0), ph(0), showAxes(true), viewMode(0), moveSpeed(5), rotSpeed(0.2), light(true), spin(true)
 {
   textureMode = true;
   isDay = true;
+  sun[0] = sun[1] = sun[2] = 0.0f;
+  sun[3] = 1.0f;
+  eye[0] = 100;
+  eye[1] = 50;
+  eye[2] = 0;
+
+  //  The rover stays at the origin and the ground slides back under it, the
+  //  sun ball hangs from the sun's position
+  double m[16];
+  Matrix::identity(m);
+  Matrix::scale(m, SUN_RADIUS, SUN_RADIUS, SUN_RADIUS);
+  roverNode = graph.add(SceneGraph::ROOT);
+  groundNode = graph.add(SceneGraph::ROOT);
+  sunNode = graph.add(SceneGraph::ROOT);
+  sunBallNode = graph.add(sunNode, m);
+  cameraNode = graph.add(SceneGraph::ROOT);
+  placeCamera();
 }
 
 /* Globals */
@@ -40,36 +73,71 @@ int diffuse = 50;  // Diffuse intensity (%)
 int specular = 0;  // Specular intensity (%)
 int shininess = 0; // Shininess (power of two)
 float shiny = 1;   // Shininess (value)
-int zh = 90;       // Light azimuth
 float ylight = 0;  // Elevation of light
 
-// Objects
-Rover rover = Rover();
-
-// Variables
-double rockX;
-double rockZ;
-
 // Textures
 int mode = 0; // Texture mode
 
-double groundOffset = 0.0; // Global offset for the ground texture
+void Scene::loadTextures()
+{
+  rover.loadTextures(queue);
+  groundTexture = Textures::load("textures/ground_texture.bmp");
+  mountainTexture = Textures::load("textures/mountain_texture.bmp");
+
+  //  Unlit white ball for the sun, the lit environment shares its yellow specular
+  RenderQueue::Material m = {-1, false, false, {1, 1, 1, 1}, shiny, {1, 1, 0, 1}, {0.0f, 0.0f, 0.01f * emission, 1.0f}};
+  sunMaterial = queue.material(m);
+  m.lit = true;
+  m.texture = groundTexture;
+  groundMaterial = queue.material(m);
+  m.texture = mountainTexture;
+  mountainMaterial = queue.material(m);
+  //  Gray rock
+  m.texture = -1;
+  m.color[0] = m.color[1] = m.color[2] = 0.4f;
+  rockMaterial = queue.material(m);
+  //  Lamps glow whether or not anything lights them
+  m.lit = false;
+  m.color[0] = 1.0f;
+  m.color[1] = 0.9f;
+  m.color[2] = 0.75f;
+  beaconMaterial = queue.material(m);
+  //  Particles color themselves and blend over everything else
+  RenderQueue::Material dust = {-1, false, true, {1, 1, 1, 1}, 1, {0, 0, 0, 1}, {0, 0, 0, 1}};
+  particleMaterial = queue.material(dust);
+
+  //  Dust where each wheel meets the ground, debris where the drill bit does
+  double p[3];
+  for (int w = 0; w < rover.wheelCount(); w++)
+  {
+    rover.wheelContact(w, p);
+    particles.addEmitter(Particles::DUST, p);
+  }
+  rover.drillTip(p);
+  debrisEmitter = particles.addEmitter(Particles::DEBRIS, p);
 
-// Camera parameters
-double eyeX = 100, eyeY = 50, eyeZ = 0.0;      // Initial position of the camera
-double centerX = 0, centerY = 50, centerZ = 0; // Point the camera is looking at
-double upX = 0.0, upY = 1.0, upZ = 0.0;        // Up vector
+  buildEnvironment();
+  registerObjects();
+}
 
-// Player orientation
-double angle = 0.0; // Angle in radians
+void Scene::setRockCount(int count)
+{
+  rocks.resize(count);
+}
 
-void Scene::loadTextures()
+void Scene::setLightCount(int count)
 {
-  rover.loadTextures();
-  groundTexture = Util::LoadTexBMP("textures/ground_texture.bmp");
-  mountainTexture = Util::LoadTexBMP("textures/mountain_texture.bmp");
+  beacons.resize(count);
+}
 
-  resetRock();
+void Scene::setRoverCount(int count)
+{
+  fleet.resize(count - 1);
+}
+
+void Scene::startSimulationThread()
+{
+  simulation.start();
 }
 
 void Scene::idle()
@@ -78,24 +146,17 @@ void Scene::idle()
   if (light && spin)
   {
     //  Elapsed time in seconds
-    double t = glutGet(GLUT_ELAPSED_TIME) / 2000.0;
+    double t = Util::seconds() / 2.0;
     zh = fmod(90 * t, 360.0);
   }
 
-  // Increment ground offset to simulate movement
-  groundOffset += 0.001;
-
-  rockX -= 0.28;
-
-  // If rock goes behind the camera (e.g., rockZ < -50),
-  // reset it to appear in front again
-  if (rockX < -145)
-  {
-    resetRock();
-  }
+  // Run the fixed steps that are due, unless the simulation has its own thread
+  if (!simulation.threaded())
+    simulation.advance(Util::seconds());
 
   //  Tell GLUT it is necessary to redisplay the scene
-  glutPostRedisplay();
+  if (!Util::headless)
+    glutPostRedisplay();
 }
 
 void Scene::toggleViewMode()
@@ -113,89 +174,43 @@ void Scene::toggleLightSpin()
   spin = !spin;
 }
 
-void Scene::resetRock()
+/*
+ *  Sun position for the light azimuth
+ */
+static void sunPosition(double dim, int zh, float pos2[4])
 {
-  // Pick a random Z between 0 and 130
-  rockZ = rand() % 130;
-  rockX = 145.0;
+  pos2[0] = 0.0f;
+  pos2[1] = static_cast<float>(1.2 * dim * Sin(zh));
+  pos2[2] = static_cast<float>(1.2 * dim * Cos(zh));
+  pos2[3] = 1.0f;
 }
 
 /*
- *  Draw a ball
- *     at (x,y,z)
- *     radius (r)
+ *  Add the sun to the frame's lights, shadowed, and return its position
  */
-static void ball(double x, double y, double z, double r)
-{
-  //  Save transformation
-  glPushMatrix();
-  //  Offset, scale and rotate
-  glTranslated(x, y, z);
-  glScaled(r, r, r);
-  //  White ball with yellow specular
-  float yellow[] = {1.0, 1.0, 0.0, 1.0};
-  float Emission[] = {0.0f, 0.0f, 0.01f * emission, 1.0f};
-  glColor3f(1, 1, 1);
-  glMaterialf(GL_FRONT, GL_SHININESS, shiny);
-  glMaterialfv(GL_FRONT, GL_SPECULAR, yellow);
-  glMaterialfv(GL_FRONT, GL_EMISSION, Emission);
-  //  Bands of latitude
-  for (int ph = -90; ph < 90; ph += inc)
-  {
-    glBegin(GL_QUAD_STRIP);
-    for (int th = 0; th <= 360; th += 2 * inc)
-    {
-      Util::Vertex(th, ph);
-      Util::Vertex(th, ph + inc);
-    }
-    glEnd();
-  }
-  //  Undo transofrmations
-  glPopMatrix();
-}
-
-bool doLighting(double dim)
+static bool doLighting(double dim, int zh, float pos2[4])
 {
-  double ballRadius = 20.0;
-  float pos2[] = {
-      0.0f,
-      static_cast<float>(1.2 * dim * Sin(zh)),
-      static_cast<float>(1.2 * dim * Cos(zh)),
-      1.0f};
-  glColor3f(1, 1, 1);
-  ball(pos2[0], pos2[1], pos2[2], ballRadius);
+  sunPosition(dim, zh, pos2);
 
+  // Below the horizon the sun adds nothing, so it is left out
   bool lightAboveGround = pos2[1] > 0;
-
-  // Translate intensity to color vectors
-  float Ambient[] = {0.0f, 0.0f, 0.0f, 1.0f};
-  float Diffuse[] = {0.0f, 0.0f, 0.0f, 1.0f};
-  float Specular[] = {0.0f, 0.0f, 0.0f, 1.0f};
-
   if (lightAboveGround)
   {
-    Ambient[0] = Ambient[1] = Ambient[2] = 0.01f * ambient;
-    Diffuse[0] = Diffuse[1] = Diffuse[2] = 0.01f * diffuse;
-    Specular[0] = Specular[1] = Specular[2] = 0.01f * specular;
+    float a = 0.01f * ambient, d = 0.01f * diffuse, s = 0.01f * specular;
+    Lights::Light sunLight = {{pos2[0], pos2[1], pos2[2], pos2[3]}, {a, a, a}, {d, d, d}, {s, s, s}, {1, 0, 0}, {0, 0, -1}, 180, 0};
+    Lights::add(sunLight, true);
   }
 
-  glEnable(GL_NORMALIZE);                                     // OpenGL should normalize normal vectors
-  glEnable(GL_LIGHTING);                                      // Enable lighting
-  glLightModeli(GL_LIGHT_MODEL_LOCAL_VIEWER, local);          // Location of viewer for specular calculations
-  glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE); // glColor sets ambient and diffuse color materials
-  glEnable(GL_COLOR_MATERIAL);
-  glEnable(GL_LIGHT0); // Enable light 0
-  //  Set ambient, diffuse, specular components and position of light 0
-  glLightfv(GL_LIGHT0, GL_AMBIENT, Ambient);
-  glLightfv(GL_LIGHT0, GL_DIFFUSE, Diffuse);
-  glLightfv(GL_LIGHT0, GL_SPECULAR, Specular);
-  glLightfv(GL_LIGHT0, GL_POSITION, pos2);
-
-  return pos2[1] > 0;
+  return lightAboveGround;
 }
 
 void Scene::draw()
 {
+  profiler.beginFrame();
+
+  // Swap in the textures the workers finished since the last frame
+  Textures::update();
+
   if (isDay)
   {
     glClearColor(0.89, 0.61, 0.33, 1.0);
@@ -210,6 +225,14 @@ void Scene::draw()
   glEnable(GL_DEPTH_TEST);
   glLoadIdentity();
 
+  // Move the nodes that moved since the last frame, at the world state interpolated to now
+  Simulation::State world = simulation.sample(Util::seconds());
+  placeWorld(world);
+  graph.update();
+  // Rocks the rover has passed are recycled ahead before the shadow caches
+  // and the culling see them, so a recycle marks the caches stale this frame
+  rocks.update(terrain, world.travelled);
+
   if (viewMode == 0)
   {
     double cameraX = -2 * dim * Sin(th) * Cos(ph);
@@ -219,12 +242,10 @@ void Scene::draw()
   }
   else if (viewMode == 1)
   {
-    // Calculate the new center position based on the angle
-    centerX = eyeX + sin(angle);
-    centerZ = eyeZ - cos(angle);
-
-    // Set the camera view
-    gluLookAt(eyeX, eyeY, eyeZ, centerX, centerY, centerZ, upX, upY, upZ);
+    // The view undoes the camera node's placement
+    double view[16];
+    Matrix::invert(view, graph.world(cameraNode));
+    glLoadMatrixd(view);
   }
   else
   {
@@ -232,236 +253,325 @@ void Scene::draw()
     glRotatef(th, 0, 1, 0);
   }
 
-  // * Lighting
-  if (light)
-  {
-    isDay = doLighting(dim);
-  }
-  else
-  {
-    glDisable(GL_LIGHTING);
-  }
+  // Everything below is culled against this view
+  Frustum frustum = Frustum::current();
 
-  glEnable(GL_TEXTURE_2D);
-  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, textureMode ? GL_MODULATE : GL_REPLACE);
+  // * Fleet - every rover of the convoy driven to now and every drill arm
+  //   solved, the ones on the ground placed before anything draws them
+  profiler.begin(Profiler::FLEET);
+  fleet.update(terrain, rover, Util::seconds(), world.travelled, isDay);
+  profiler.end(Profiler::FLEET);
 
-  // Draw enviroment
-  drawEnviroment();
+  // * Shadows - the sun's depth maps for this view, only stale caches and due casters are drawn
+  profiler.begin(Profiler::SHADOWS);
+  drawShadows(world);
+  profiler.end(Profiler::SHADOWS);
 
-  // Draw objects
-  rover.draw(isDay);
+  // * Lighting - the frame's lights are collected in the camera's coordinates and
+  //   binned into the view once, the headlamp lights the ground even when the rover is out of view
+  profiler.begin(Profiler::LIGHTING);
+  Lights::begin();
+  if (light)
+    isDay = doLighting(dim, zh, sun);
+  rover.setupHeadlamp(isDay, graph.world(roverNode));
+  if (!isDay)
+    fleet.addLights(rover, graph.world(roverNode));
+  beacons.update(terrain, world.travelled);
+  if (!isDay)
+    beacons.addLights(world.travelled);
+  Lights::upload();
+  profiler.end(Profiler::LIGHTING);
+
+  // Move the objects that moved and find the ones in view
+  profiler.begin(Profiler::CULLING);
+  cull(frustum, world);
+  profiler.end(Profiler::CULLING);
+
+  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, textureMode ? GL_MODULATE : GL_REPLACE);
 
-  // No lighting from here on
-  glDisable(GL_LIGHTING);
+  // Queue the enviroment
+  profiler.begin(Profiler::ENVIRONMENT);
+  drawEnviroment(world, frustum);
+  profiler.end(Profiler::ENVIRONMENT);
+
+  // Queue objects
+  profiler.begin(Profiler::ROVER);
+  if (bvh.visible(roverObject))
+    rover.draw(queue, isDay, graph.world(roverNode));
+  fleet.draw(queue, rover, isDay, graph.world(roverNode));
+  profiler.end(Profiler::ROVER);
+
+  // Particles are kept along world X, like the rocks - the debris follows
+  // the tip of the leader's drill arm
+  profiler.begin(Profiler::PARTICLES);
+  double tip[3];
+  fleet.drillArms().tip(0, tip);
+  particles.moveEmitter(debrisEmitter, tip);
+  particles.update(Util::seconds(), world.travelled);
+  queue.submit(particleMaterial, particles, graph.world(groundNode));
+  profiler.end(Profiler::PARTICLES);
+
+  // Sorted draws with only the state changes they need
+  profiler.begin(Profiler::RENDER);
+  queue.flush(light);
+  profiler.end(Profiler::RENDER);
 
   // No textures from here on
   glDisable(GL_TEXTURE_2D);
 
+  profiler.begin(Profiler::HUD);
   // Draw axes if enabled
   drawAxes();
   // Draw screen info
-  drawInfo();
+  drawInfo(world);
+  profiler.end(Profiler::HUD);
 
   Util::ErrCheck("display");
 
-  //  Flush and swap buffer
-  glFlush();
-  glutSwapBuffers();
+  //  Flush and swap buffer - offscreen frames finish instead so timings include the GPU work
+  if (Util::headless)
+    glFinish();
+  else
+  {
+    glFlush();
+    glutSwapBuffers();
+  }
+
+  profiler.endFrame();
 }
 
-void Scene::drawEnviroment()
+const Profiler &Scene::timings() const
 {
-  glBindTexture(GL_TEXTURE_2D, groundTexture);
-  glColor3f(1, 1, 1);
+  return profiler;
+}
 
-  float groundSize = 150;
-
-  // Draw ground
-  glBegin(GL_QUADS);
-
-  // Top face (Positive Y)
-  glNormal3f(0, 1, 0);
-  glTexCoord2f(0, 0 + groundOffset);
-  glVertex3d(-groundSize, -0.01, -groundSize);
-  glTexCoord2f(1, 0 + groundOffset);
-  glVertex3d(-groundSize, -0.01, groundSize);
-  glTexCoord2f(1, 1 + groundOffset);
-  glVertex3d(groundSize, -0.01, groundSize);
-  glTexCoord2f(0, 1 + groundOffset);
-  glVertex3d(groundSize, -0.01, -groundSize);
-
-  // Bottom face (Negative Y)
-  glNormal3f(0, -1, 0);
-  glTexCoord2f(0, 0);
-  glVertex3d(-groundSize, -0.01, -groundSize);
-  glTexCoord2f(1, 0);
-  glVertex3d(groundSize, -0.01, -groundSize);
-  glTexCoord2f(1, 1);
-  glVertex3d(groundSize, -0.01, groundSize);
-  glTexCoord2f(0, 1);
-  glVertex3d(-groundSize, -0.01, groundSize);
-
-  // Front face (Positive Z)
-  glNormal3f(0, 0, 1);
-  glTexCoord2f(0, 0);
-  glVertex3d(-groundSize, -0.01, groundSize);
-  glTexCoord2f(1, 0);
-  glVertex3d(-groundSize, 0.01, groundSize);
-  glTexCoord2f(1, 1);
-  glVertex3d(groundSize, 0.01, groundSize);
-  glTexCoord2f(0, 1);
-  glVertex3d(groundSize, -0.01, groundSize);
-
-  // Back face (Negative Z)
-  glNormal3f(0, 0, -1);
-  glTexCoord2f(0, 0);
-  glVertex3d(-groundSize, -0.01, -groundSize);
-  glTexCoord2f(1, 0);
-  glVertex3d(-groundSize, 0.01, -groundSize);
-  glTexCoord2f(1, 1);
-  glVertex3d(groundSize, 0.01, -groundSize);
-  glTexCoord2f(0, 1);
-  glVertex3d(groundSize, -0.01, -groundSize);
-
-  // Left face (Negative X)
-  glNormal3f(-1, 0, 0);
-  glTexCoord2f(0, 0);
-  glVertex3d(-groundSize, -0.01, -groundSize);
-  glTexCoord2f(1, 0);
-  glVertex3d(-groundSize, 0.01, -groundSize);
-  glTexCoord2f(1, 1);
-  glVertex3d(-groundSize, 0.01, groundSize);
-  glTexCoord2f(0, 1);
-  glVertex3d(-groundSize, -0.01, groundSize);
-
-  // Right face (Positive X)
-  glNormal3f(1, 0, 0);
-  glTexCoord2f(0, 0);
-  glVertex3d(groundSize, -0.01, -groundSize);
-  glTexCoord2f(1, 0);
-  glVertex3d(groundSize, 0.01, -groundSize);
-  glTexCoord2f(1, 1);
-  glVertex3d(groundSize, 0.01, groundSize);
-  glTexCoord2f(0, 1);
-  glVertex3d(groundSize, -0.01, groundSize);
+const RenderQueue &Scene::renderQueue() const
+{
+  return queue;
+}
 
-  glEnd();
+const Bvh &Scene::objects() const
+{
+  return bvh;
+}
 
-  glBindTexture(GL_TEXTURE_2D, mountainTexture);
-  glColor3f(1, 1, 1);
+const Particles &Scene::particleSystem() const
+{
+  return particles;
+}
+
+const Shadows &Scene::shadowMaps() const
+{
+  return shadows;
+}
 
-  glBegin(GL_TRIANGLE_STRIP);
+const Fleet &Scene::rovers() const
+{
+  return fleet;
+}
+
+const SceneGraph &Scene::transforms() const
+{
+  return graph;
+}
+
+/*
+ *  First person camera at the eye, turned to its heading
+ */
+void Scene::placeCamera()
+{
+  double m[16];
+  Matrix::identity(m);
+  Matrix::translate(m, eye[0], eye[1], eye[2]);
+  Matrix::rotate(m, -angle * 180 / 3.14159265, 0, 1, 0);
+  graph.place(cameraNode, m);
+}
+
+/*
+ *  Slide the ground back by the distance driven and move the sun to its
+ *  azimuth - nodes left where they were stay clean
+ */
+void Scene::placeWorld(const Simulation::State &world)
+{
+  graph.place(groundNode, -world.travelled, 0, 0);
+  float pos[4];
+  sunPosition(dim, zh, pos);
+  graph.place(sunNode, pos[0], pos[1], pos[2]);
+}
+
+/*
+ *  Record the mountains once and generate the ground and rocks around the
+ *  start - both stream in from then on as the rover drives
+ */
+void Scene::buildEnvironment()
+{
+  mountainMesh.clear();
 
   // The idea: Place a series of peaks and valleys to create a mountainous silhouette
+  mountainMesh.begin(GL_TRIANGLE_STRIP);
+
   int mountainDistance = -100;
-  glNormal3f(0, 1, 0);
-  glTexCoord2f(0, 0);
-  glVertex3f(-150, -0.01f, mountainDistance);
-  glTexCoord2f(1, 0);
-  glVertex3f(-120, 40.0f, mountainDistance - 40);
-  glTexCoord2f(1, 1);
-  glVertex3f(-100, -0.01f, mountainDistance - 10);
-
-  glNormal3f(0, 1, 0);
-  glTexCoord2f(0, 0);
-  glVertex3f(-50, 60.0f, mountainDistance - 30);
-  glTexCoord2f(1, 0);
-  glVertex3f(0, -0.01f, mountainDistance + 30);
-  glTexCoord2f(1, 1);
-  glVertex3f(50, 75.0f, mountainDistance - 50);
-
-  glNormal3f(0, 1, 0);
-  glTexCoord2f(0, 0);
-  glVertex3f(100, -0.01f, mountainDistance + 10);
-  glTexCoord2f(1, 0);
-  glVertex3f(150, 60.0f, mountainDistance - 40);
-  glTexCoord2f(1, 1);
-  glVertex3f(150, -0.01f, mountainDistance - 40);
+  mountainMesh.normal(0, 1, 0);
+  mountainMesh.texCoord(0, 0);
+  mountainMesh.vertex(-150, -0.01f, mountainDistance);
+  mountainMesh.texCoord(1, 0);
+  mountainMesh.vertex(-120, 40.0f, mountainDistance - 40);
+  mountainMesh.texCoord(1, 1);
+  mountainMesh.vertex(-100, -0.01f, mountainDistance - 10);
+
+  mountainMesh.normal(0, 1, 0);
+  mountainMesh.texCoord(0, 0);
+  mountainMesh.vertex(-50, 60.0f, mountainDistance - 30);
+  mountainMesh.texCoord(1, 0);
+  mountainMesh.vertex(0, -0.01f, mountainDistance + 30);
+  mountainMesh.texCoord(1, 1);
+  mountainMesh.vertex(50, 75.0f, mountainDistance - 50);
+
+  mountainMesh.normal(0, 1, 0);
+  mountainMesh.texCoord(0, 0);
+  mountainMesh.vertex(100, -0.01f, mountainDistance + 10);
+  mountainMesh.texCoord(1, 0);
+  mountainMesh.vertex(150, 60.0f, mountainDistance - 40);
+  mountainMesh.texCoord(1, 1);
+  mountainMesh.vertex(150, -0.01f, mountainDistance - 40);
+
+  mountainMesh.end();
+
+  mountainMesh.begin(GL_TRIANGLE_STRIP);
+
+  mountainMesh.normal(0, -1, 0);
+  mountainMesh.texCoord(0, 0);
+  mountainMesh.vertex(-150, -0.01f, mountainDistance - 0.1);
+  mountainMesh.texCoord(1, 0);
+  mountainMesh.vertex(-120, 40.0f, mountainDistance - 40 - 0.1);
+  mountainMesh.texCoord(1, 1);
+  mountainMesh.vertex(-100, -0.01f, mountainDistance - 10 - 0.1);
+
+  mountainMesh.normal(0, -1, 0);
+  mountainMesh.texCoord(0, 0);
+  mountainMesh.vertex(-50, 60.0f, mountainDistance - 30 - 0.1);
+  mountainMesh.texCoord(1, 0);
+  mountainMesh.vertex(0, -0.01f, mountainDistance + 30 - 0.1);
+  mountainMesh.texCoord(1, 1);
+  mountainMesh.vertex(50, 75.0f, mountainDistance - 50 - 0.1);
+
+  mountainMesh.normal(0, -1, 0);
+  mountainMesh.texCoord(0, 0);
+  mountainMesh.vertex(100, -0.01f, mountainDistance + 10 - 0.1);
+  mountainMesh.texCoord(1, 0);
+  mountainMesh.vertex(150, 60.0f, mountainDistance - 40 - 0.1);
+  mountainMesh.texCoord(1, 1);
+  mountainMesh.vertex(150, -0.01f, mountainDistance - 40 - 0.1);
+
+  mountainMesh.end();
+
+  mountainMesh.upload();
+
+  terrain.update(0.0);
+  terrain.finish();
+  rocks.update(terrain, 0.0);
+}
 
-  glEnd();
+/*
+ *  Register everything drawn with the bounding volume hierarchy - the
+ *  terrain culls its own quadtree instead
+ */
+void Scene::registerObjects()
+{
+  double lo[3], hi[3];
+  rover.bounds(lo, hi);
+  roverObject = bvh.insert(lo, hi);
+  mountainMesh.bounds(lo, hi);
+  mountainObject = bvh.insert(lo, hi);
+  // The sun and rock field get their boxes every frame
+  sunObject = bvh.insert(lo, hi);
+  rockObject = bvh.insert(lo, hi);
+}
 
-  glBegin(GL_TRIANGLE_STRIP);
-
-  glNormal3f(0, -1, 0);
-  glTexCoord2f(0, 0);
-  glVertex3f(-150, -0.01f, mountainDistance - 0.1);
-  glTexCoord2f(1, 0);
-  glVertex3f(-120, 40.0f, mountainDistance - 40 - 0.1);
-  glTexCoord2f(1, 1);
-  glVertex3f(-100, -0.01f, mountainDistance - 10 - 0.1);
-
-  glNormal3f(0, -1, 0);
-  glTexCoord2f(0, 0);
-  glVertex3f(-50, 60.0f, mountainDistance - 30 - 0.1);
-  glTexCoord2f(1, 0);
-  glVertex3f(0, -0.01f, mountainDistance + 30 - 0.1);
-  glTexCoord2f(1, 1);
-  glVertex3f(50, 75.0f, mountainDistance - 50 - 0.1);
-
-  glNormal3f(0, -1, 0);
-  glTexCoord2f(0, 0);
-  glVertex3f(100, -0.01f, mountainDistance + 10 - 0.1);
-  glTexCoord2f(1, 0);
-  glVertex3f(150, 60.0f, mountainDistance - 40 - 0.1);
-  glTexCoord2f(1, 1);
-  glVertex3f(150, -0.01f, mountainDistance - 40 - 0.1);
+/*
+ *  Refit the moving objects and cull the hierarchy against the view
+ */
+void Scene::cull(const Frustum &frustum, const Simulation::State &world)
+{
+  double lo[3], hi[3];
+  for (int k = 0; k < 3; k++)
+  {
+    lo[k] = sun[k] - SUN_RADIUS;
+    hi[k] = sun[k] + SUN_RADIUS;
+  }
+  bvh.move(sunObject, lo, hi);
 
-  glEnd();
+  // The rocks were recycled at the start of the frame
+  rocks.bounds(world.travelled, lo, hi);
+  bvh.move(rockObject, lo, hi);
 
-  // Random rock
-  glDisable(GL_TEXTURE_2D);
-  glColor3f(0.4f, 0.4f, 0.4f); // Gray rock color
-
-  glPushMatrix();
-  double rockY = 5; // Slightly above ground
-  glTranslated(rockX, rockY, rockZ);
-
-  // Draw a small cube (or use Util::ball)
-  double rockSize = 8.0;
-  glBegin(GL_QUADS);
-  // Top
-  glNormal3f(0, 1, 0);
-  glVertex3f(-rockSize, 0, -rockSize);
-  glVertex3f(rockSize, 0, -rockSize);
-  glVertex3f(rockSize, 0, rockSize);
-  glVertex3f(-rockSize, 0, rockSize);
-  // Sides...
-  // Front
-  glNormal3f(0, 0, 1);
-  glVertex3f(-rockSize, 0, rockSize);
-  glVertex3f(rockSize, 0, rockSize);
-  glVertex3f(rockSize, -rockSize, rockSize);
-  glVertex3f(-rockSize, -rockSize, rockSize);
-  // Back
-  glNormal3f(0, 0, -1);
-  glVertex3f(rockSize, 0, -rockSize);
-  glVertex3f(-rockSize, 0, -rockSize);
-  glVertex3f(-rockSize, -rockSize, -rockSize);
-  glVertex3f(rockSize, -rockSize, -rockSize);
-  // Left
-  glNormal3f(-1, 0, 0);
-  glVertex3f(-rockSize, 0, -rockSize);
-  glVertex3f(-rockSize, 0, rockSize);
-  glVertex3f(-rockSize, -rockSize, rockSize);
-  glVertex3f(-rockSize, -rockSize, -rockSize);
-  // Right
-  glNormal3f(1, 0, 0);
-  glVertex3f(rockSize, 0, rockSize);
-  glVertex3f(rockSize, 0, -rockSize);
-  glVertex3f(rockSize, -rockSize, -rockSize);
-  glVertex3f(rockSize, -rockSize, rockSize);
-  // Bottom
-  glNormal3f(0, -1, 0);
-  glVertex3f(-rockSize, -rockSize, -rockSize);
-  glVertex3f(rockSize, -rockSize, -rockSize);
-  glVertex3f(rockSize, -rockSize, rockSize);
-  glVertex3f(-rockSize, -rockSize, rockSize);
-  glEnd();
+  bvh.cull(frustum);
+}
 
-  glPopMatrix();
+/*
+ *  Draw the static geometry into the stale shadow caches and the rover over
+ *  the due cascades - rocks stay put on the ground, so they are static too
+ *  and recycling them only marks the caches stale
+ */
+void Scene::drawShadows(const Simulation::State &world)
+{
+  float pos[4];
+  sunPosition(dim, zh, pos);
+  if (light && pos[1] > 0 && Shadows::supported())
+  {
+    if (rocks.recycled() > 0)
+      shadows.invalidate();
+    double direction[3] = {pos[0], pos[1], pos[2]};
+    shadows.fit(direction, world.travelled, SHADOWED_LO, SHADOWED_HI);
+
+    const double *drift = graph.world(groundNode);
+    for (int c = 0; c < Shadows::CASCADES; c++)
+      if (shadows.cacheDue(c))
+      {
+        shadows.begin(c, true);
+        terrain.select(Frustum::current(), world.travelled);
+        queue.submit(groundMaterial, terrain);
+        queue.submit(mountainMaterial, mountainMesh);
+        for (int v = 0; v < RockField::VARIANTS; v++)
+          queue.submit(rockMaterial, rocks.mesh(v), rocks.instances(v), drift);
+        queue.flushDepth();
+        shadows.end();
+      }
+    for (int c = 0; c < Shadows::CASCADES; c++)
+      if (shadows.castersDue(c))
+      {
+        shadows.begin(c, false);
+        rover.draw(queue, isDay, graph.world(roverNode));
+        fleet.draw(queue, rover, isDay, graph.world(roverNode));
+        queue.flushDepth();
+        shadows.end();
+      }
+  }
+  shadows.apply();
+}
 
-  // Re-enable textures if needed
-  glEnable(GL_TEXTURE_2D);
+void Scene::drawEnviroment(const Simulation::State &world, const Frustum &frustum)
+{
+  // Sun ball at the light position
+  if (light && bvh.visible(sunObject))
+    queue.submit(sunMaterial, Primitives::sphere(inc), graph.world(sunBallNode));
+
+  // Ground chunks around the rover, moving back as it drives, at the detail this view needs
+  terrain.update(world.travelled);
+  terrain.select(frustum, world.travelled);
+  queue.submit(groundMaterial, terrain);
+
+  if (bvh.visible(mountainObject))
+    queue.submit(mountainMaterial, mountainMesh);
+
+  // Rocks are placed along world X, the field moves back as the rover drives
+  if (bvh.visible(rockObject))
+    for (int v = 0; v < RockField::VARIANTS; v++)
+      queue.submit(rockMaterial, rocks.mesh(v), rocks.instances(v), graph.world(groundNode));
+
+  // Lamps are placed along world X too, and too small and few to be worth culling
+  if (beacons.count() > 0)
+    queue.submit(beaconMaterial, beacons.mesh(), beacons.instances(), graph.world(groundNode));
 }
 
 void Scene::drawAxes()
@@ -491,7 +601,7 @@ void Scene::drawAxes()
   Util::Print("Z");
 }
 
-void Scene::drawInfo()
+void Scene::drawInfo(const Simulation::State &world)
 {
   //  White
   glColor3f(1, 1, 1);
@@ -505,10 +615,44 @@ void Scene::drawInfo()
                                                             : "Orthographic");
 
   glWindowPos2i(5, 45);
-  Util::Print("Texture Mode (t): %s", textureMode ? "Modulate" : "Replace");
+  Util::Print("Texture Mode (t): %s  Resident: %d textures %.1f MB", textureMode ? "Modulate" : "Replace",
+              Textures::residentCount(), Textures::residentBytes() / 1048576.0);
 
   glWindowPos2i(5, 65);
   Util::Print("Lighting (l): %s", light ? "On" : "Off");
+
+  glWindowPos2i(5, 85);
+  Util::Print("Timings (p): %s", profiler.isVisible() ? "On" : "Off");
+
+  glWindowPos2i(5, 105);
+  Util::Print("Draws: %d  State changes: %d  Terrain: %d tiles %d triangles", queue.drawCalls(), queue.stateChanges(),
+              terrain.nodeCount(), terrain.triangleCount());
+
+  glWindowPos2i(5, 125);
+  Util::Print("Objects: %d visible %d culled  Nodes: %d, %d moved  Rocks: %d, %d within %.0f of the rover", bvh.visibleCount(),
+              bvh.culledCount(), graph.count(), graph.updatedCount(), rocks.count(), rocks.query(world.travelled, 0, NEARBY), NEARBY);
+
+  glWindowPos2i(5, 145);
+  Util::Print("Particles: %d  %s update %.2f ms", particles.count(), Particles::kernels(), particles.updateTime());
+
+  glWindowPos2i(5, 165);
+  Util::Print("Lights: %d  %.1f per cluster, %d at most  binned in %.2f ms", Lights::count(), Lights::clusterAverage(),
+              Lights::clusterMaximum(), Lights::binTime());
+
+  glWindowPos2i(5, 185);
+  Util::Print("Shadows: %d cascades  %d caches and %d caster maps drawn", shadows.cascadeCount(), shadows.cachesDrawn(),
+              shadows.castersDrawn());
+
+  glWindowPos2i(5, 205);
+  Util::Print("Rovers: %d, %d drawn  step %.2f ms  place %.2f ms  upload %.2f ms", fleet.count() + 1, fleet.drawnCount() + 1,
+              fleet.stepTime(), fleet.placeTime(), fleet.uploadTime());
+
+  glWindowPos2i(5, 225);
+  Util::Print("Arms: %d solved, %d drawn  %s solve %.2f ms", fleet.drillArms().count(), fleet.drillArms().drawnCount(),
+              Arms::kernels(), fleet.drillArms().solveTime());
+
+  // Pass timings and frame time graph
+  profiler.draw(res * width, res * height, 245);
 }
 
 void Scene::toggleAxes()
@@ -552,26 +696,28 @@ void Scene::key(unsigned char ch, int x, int y)
     toggleLight();
   else if (ch == 'k' || ch == 'K')
     toggleLightSpin();
+  else if (ch == 'p' || ch == 'P')
+    profiler.toggle();
 
   if (viewMode == 1)
   {
     switch (ch)
     {
     case 'w':
-      centerY += moveSpeed;
-      eyeY += moveSpeed;
+      eye[1] += moveSpeed;
       break;
     case 's':
-      centerY -= moveSpeed;
-      eyeY -= moveSpeed;
+      eye[1] -= moveSpeed;
       break;
     }
+    placeCamera();
   }
 
   project();
 
   //  Tell GLUT it is necessary to redisplay the scene
-  glutPostRedisplay();
+  if (!Util::headless)
+    glutPostRedisplay();
 }
 
 void Scene::special(int key, int x, int y)
@@ -581,12 +727,12 @@ void Scene::special(int key, int x, int y)
     switch (key)
     {
     case GLUT_KEY_UP:
-      eyeX += moveSpeed * sin(angle);
-      eyeZ -= moveSpeed * cos(angle);
+      eye[0] += moveSpeed * sin(angle);
+      eye[2] -= moveSpeed * cos(angle);
       break;
     case GLUT_KEY_DOWN:
-      eyeX -= moveSpeed * sin(angle);
-      eyeZ += moveSpeed * cos(angle);
+      eye[0] -= moveSpeed * sin(angle);
+      eye[2] += moveSpeed * cos(angle);
       break;
     case GLUT_KEY_LEFT:
       angle -= rotSpeed;
@@ -596,9 +742,8 @@ void Scene::special(int key, int x, int y)
       break;
     }
 
-    // Calculate the new center position based on the angle
-    centerX = eyeX + sin(angle);
-    centerZ = eyeZ - cos(angle);
+    // Point the camera node along the new heading
+    placeCamera();
   }
   else
   {
@@ -622,11 +767,14 @@ void Scene::special(int key, int x, int y)
   project();
 
   //  Tell GLUT it is necessary to redisplay the scene
-  glutPostRedisplay();
+  if (!Util::headless)
+    glutPostRedisplay();
 }
 
 void Scene::reshape(int width, int height)
 {
+  this->width = width;
+  this->height = height;
   //  Ratio of the width to the height of the window
   asp = (height > 0) ? (double)width / height : 1;
   //  Set the viewport to the entire window
@@ -0,0 +1,96 @@
+#include <cstring>
+#include "scenegraph.hpp"
+#include "matrix.hpp"
+#include "util.hpp"
+
+SceneGraph::SceneGraph() : moved(false), updated(0)
+{
+  add(-1);
+}
+
+int SceneGraph::add(int parent, const double local[16])
+{
+  int node = count();
+  if (parent >= node)
+    Util::Fatal("Scene graph node %d added before its parent %d\n", node, parent);
+
+  double m[16];
+  Matrix::identity(m);
+  parents.push_back(parent);
+  locals.insert(locals.end(), local ? local : m, (local ? local : m) + 16);
+  worlds.insert(worlds.end(), m, m + 16);
+  dirty.push_back(1);
+  moved = true;
+  return node;
+}
+
+void SceneGraph::place(int node, const double local[16])
+{
+  double *m = &locals[16 * node];
+  if (!memcmp(m, local, 16 * sizeof(double)))
+    return;
+  memcpy(m, local, 16 * sizeof(double));
+  dirty[node] = 1;
+  moved = true;
+}
+
+void SceneGraph::place(int node, double x, double y, double z)
+{
+  double m[16];
+  Matrix::identity(m);
+  Matrix::translate(m, x, y, z);
+  place(node, m);
+}
+
+/*
+ *  One pass in hierarchy order - a node is dirty when it or its parent is,
+ *  and a parent's flag is final before any of its children is reached
+ */
+void SceneGraph::update()
+{
+  updated = 0;
+  if (!moved)
+    return;
+
+  int n = count();
+  for (int i = 0; i < n; i++)
+  {
+    int p = parents[i];
+    if (p >= 0 && dirty[p])
+      dirty[i] = 1;
+    if (!dirty[i])
+      continue;
+    if (p < 0)
+      memcpy(&worlds[16 * i], &locals[16 * i], 16 * sizeof(double));
+    else
+      Matrix::multiply(&worlds[16 * i], &worlds[16 * p], &locals[16 * i]);
+    updated++;
+  }
+  memset(dirty.data(), 0, dirty.size());
+  moved = false;
+}
+
+int SceneGraph::count() const
+{
+  return (int)parents.size();
+}
+
+int SceneGraph::parent(int node) const
+{
+  return parents[node];
+}
+
+const double *SceneGraph::local(int node) const
+{
+  return &locals[16 * node];
+}
+
+const double *SceneGraph::world(int node) const
+{
+  return &worlds[16 * node];
+}
+
+int SceneGraph::updatedCount() const
+{
+  return updated;
+}
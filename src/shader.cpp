@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <vector>
+#include "shader.hpp"
+#include "lights.hpp"
+#include "util.hpp"
+#ifdef USEGLEW
+#include <GL/glew.h>
+#endif
+//  OpenGL with prototypes for glext
+#define GL_GLEXT_PROTOTYPES
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+// Tell Xcode IDE to not gripe about OpenGL deprecation
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#else
+#include <GL/glut.h>
+#endif
+
+/*
+ *  Print the shader or program log when there is one
+ */
+static void printLog(const char *name, unsigned int obj, bool isProgram)
+{
+  int len = 0;
+  if (isProgram)
+    glGetProgramiv(obj, GL_INFO_LOG_LENGTH, &len);
+  else
+    glGetShaderiv(obj, GL_INFO_LOG_LENGTH, &len);
+  if (len <= 1)
+    return;
+  std::vector<char> buffer(len);
+  if (isProgram)
+    glGetProgramInfoLog(obj, len, &len, buffer.data());
+  else
+    glGetShaderInfoLog(obj, len, &len, buffer.data());
+  fprintf(stderr, "%s:\n%s\n", name, buffer.data());
+}
+
+static unsigned int compile(const char *name, unsigned int type, const char *source)
+{
+  unsigned int shader = glCreateShader(type);
+  glShaderSource(shader, 1, &source, 0);
+  glCompileShader(shader);
+  int ok = 0;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+  if (!ok)
+  {
+    printLog(name, shader, false);
+    Util::Fatal("Error compiling %s shader for %s\n", type == GL_VERTEX_SHADER ? "vertex" : "fragment", name);
+  }
+  return shader;
+}
+
+unsigned int Shader::program(const char *name, const char *vert, const char *frag,
+                             int attributeCount, const char *const attributes[], const int locations[])
+{
+  unsigned int prog = glCreateProgram();
+  unsigned int vs = compile(name, GL_VERTEX_SHADER, vert);
+  unsigned int fs = compile(name, GL_FRAGMENT_SHADER, frag);
+  glAttachShader(prog, vs);
+  glAttachShader(prog, fs);
+  for (int i = 0; i < attributeCount; i++)
+    glBindAttribLocation(prog, locations[i], attributes[i]);
+  glLinkProgram(prog);
+  int ok = 0;
+  glGetProgramiv(prog, GL_LINK_STATUS, &ok);
+  if (!ok)
+  {
+    printLog(name, prog, true);
+    Util::Fatal("Error linking %s\n", name);
+  }
+  // The program keeps the compiled code
+  glDeleteShader(vs);
+  glDeleteShader(fs);
+  Util::ErrCheck(name);
+  return prog;
+}
+
+/*
+ *  Shaders cannot ask how textures are applied so pass it along as uniforms
+ */
+void Shader::setFixedState(unsigned int program)
+{
+  Lights::apply(program);
+
+  int mode = GL_MODULATE;
+  glGetTexEnviv(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, &mode);
+  glUniform1i(glGetUniformLocation(program, "textured"), glIsEnabled(GL_TEXTURE_2D));
+  glUniform1i(glGetUniformLocation(program, "replace"), mode == GL_REPLACE);
+  glUniform1i(glGetUniformLocation(program, "tex"), 0);
+}
@@ -0,0 +1,407 @@
+#include <cmath>
+#include <cstring>
+#include "shadows.hpp"
+#include "lights.hpp"
+#include "matrix.hpp"
+#include "util.hpp"
+#ifdef USEGLEW
+#include <GL/glew.h>
+#endif
+//  OpenGL with prototypes for glext
+#define GL_GLEXT_PROTOTYPES
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+// Tell Xcode IDE to not gripe about OpenGL deprecation
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#else
+#include <GL/glut.h>
+#endif
+
+//  Sun direction change in degrees before the maps follow it
+static const double SUN_STEP = 1.5;
+//  Weight of the logarithmic split against the even one
+static const double LAMBDA = 0.75;
+//  Grid cells across a cascade's box, and texels a lookup moves along the normal
+static const int CELLS = 8;
+static const double OFFSET = 1.5;
+
+/*
+ *  Rotation from world to light coordinates, looking along -d
+ */
+static void lightRotation(const double d[3], double m[16])
+{
+  double up[3] = {0, 0, 0};
+  up[fabs(d[0]) < 0.9 ? 0 : 1] = 1.0;
+  double r[3] = {up[1] * d[2] - up[2] * d[1], up[2] * d[0] - up[0] * d[2], up[0] * d[1] - up[1] * d[0]};
+  double len = sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+  for (int k = 0; k < 3; k++)
+    r[k] /= len;
+  double u[3] = {d[1] * r[2] - d[2] * r[1], d[2] * r[0] - d[0] * r[2], d[0] * r[1] - d[1] * r[0]};
+  Matrix::identity(m);
+  for (int k = 0; k < 3; k++)
+  {
+    m[4 * k] = r[k];
+    m[4 * k + 1] = u[k];
+    m[4 * k + 2] = d[k];
+  }
+}
+
+/*
+ *  Same as glOrtho
+ */
+static void ortho(double m[16], double l, double r, double b, double t, double n, double f)
+{
+  Matrix::identity(m);
+  m[0] = 2.0 / (r - l);
+  m[5] = 2.0 / (t - b);
+  m[10] = -2.0 / (f - n);
+  m[12] = -(r + l) / (r - l);
+  m[13] = -(t + b) / (t - b);
+  m[14] = -(f + n) / (f - n);
+}
+
+static void grow(double lo[3], double hi[3], const double p[3])
+{
+  for (int k = 0; k < 3; k++)
+  {
+    lo[k] = p[k] < lo[k] ? p[k] : lo[k];
+    hi[k] = p[k] > hi[k] ? p[k] : hi[k];
+  }
+}
+
+Shadows::Shadows() : count(0), fitted(false), frame(0), step(0), distance(0.0), caches(0), casters(0), saved(0)
+{
+  sun[0] = sun[2] = 0.0;
+  sun[1] = 1.0;
+  Matrix::identity(view);
+  memset(cascades, 0, sizeof(cascades));
+  for (int c = 0; c < CASCADES; c++)
+    cascades[c].staleSince = -1;
+}
+
+bool Shadows::supported()
+{
+  static int available = -1;
+  if (available < 0)
+  {
+    const char *version = (const char *)glGetString(GL_VERSION);
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+    available = (version && version[0] >= '3') || (extensions && strstr(extensions, "GL_ARB_framebuffer_object"));
+  }
+  return available;
+}
+
+/*
+ *  A depth texture the lights compare against and a cache copied from for
+ *  every cascade, each drawn through its own framebuffer
+ */
+void Shadows::create()
+{
+  GLint bound;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &bound);
+  for (int c = 0; c < CASCADES; c++)
+  {
+    Cascade &cascade = cascades[c];
+    glGenTextures(1, &cascade.map);
+    glBindTexture(GL_TEXTURE_2D, cascade.map);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, SIZE, SIZE, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_R_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    //  The cache is only ever copied, so a renderbuffer does
+    glGenRenderbuffers(1, &cascade.cache);
+    glBindRenderbuffer(GL_RENDERBUFFER, cascade.cache);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, SIZE, SIZE);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &cascade.mapFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, cascade.mapFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, cascade.map, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+      Util::Fatal("Shadow map framebuffer is incomplete\n");
+
+    glGenFramebuffers(1, &cascade.cacheFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, cascade.cacheFbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, cascade.cache);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+      Util::Fatal("Shadow cache framebuffer is incomplete\n");
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, bound);
+  Util::ErrCheck("Shadows::create");
+}
+
+void Shadows::fit(const double direction[3], double at, const double lo[3], const double hi[3])
+{
+  if (!cascades[0].map)
+    create();
+  fitted = true;
+  frame++;
+  distance = at;
+  caches = casters = 0;
+
+  double projection[16];
+  glGetDoublev(GL_MODELVIEW_MATRIX, view);
+  glGetDoublev(GL_PROJECTION_MATRIX, projection);
+
+  //  The maps follow the sun in steps, so the caches outlast small moves
+  double len = sqrt(direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2]);
+  double d[3] = {direction[0] / len, direction[1] / len, direction[2] / len};
+  if (d[0] * sun[0] + d[1] * sun[1] + d[2] * sun[2] < cos(SUN_STEP * 3.14159265 / 180.0))
+  {
+    for (int k = 0; k < 3; k++)
+      sun[k] = d[k];
+    step++;
+  }
+  double rotation[16];
+  lightRotation(sun, rotation);
+
+  //  Eye depths the view sees and the box reaches, the box in light coordinates
+  bool perspective = projection[15] == 0.0;
+  double nearPlane = perspective ? projection[14] / (projection[10] - 1.0) : (projection[14] + 1.0) / projection[10];
+  double farPlane = perspective ? projection[14] / (projection[10] + 1.0) : (projection[14] - 1.0) / projection[10];
+  double nearest = HUGE_VAL, farthest = -HUGE_VAL;
+  double boxLo[3] = {HUGE_VAL, HUGE_VAL, HUGE_VAL}, boxHi[3] = {-HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+  for (int i = 0; i < 8; i++)
+  {
+    double p[3] = {i & 1 ? hi[0] : lo[0], i & 2 ? hi[1] : lo[1], i & 4 ? hi[2] : lo[2]};
+    double depth = -(view[2] * p[0] + view[6] * p[1] + view[10] * p[2] + view[14]);
+    nearest = depth < nearest ? depth : nearest;
+    farthest = depth > farthest ? depth : farthest;
+    p[0] += distance;
+    Matrix::transformPoint(rotation, p, p);
+    grow(boxLo, boxHi, p);
+  }
+  double a = nearest > nearPlane ? nearest : nearPlane;
+  double b = farthest < farPlane ? farthest : farPlane;
+  count = a < b ? CASCADES : 0;
+
+  //  Corners of the near and far planes in world coordinates
+  double inverseView[16], inverseProjection[16], nearCorner[4][3], farCorner[4][3];
+  if (count && (!Matrix::invert(inverseView, view) || !Matrix::invert(inverseProjection, projection)))
+    count = 0;
+  for (int i = 0; i < 4 && count; i++)
+    for (int z = 0; z < 2; z++)
+    {
+      double ndc[4] = {i & 1 ? 1.0 : -1.0, i & 2 ? 1.0 : -1.0, z ? 1.0 : -1.0, 1.0}, eye[4];
+      for (int k = 0; k < 4; k++)
+        eye[k] = inverseProjection[k] * ndc[0] + inverseProjection[4 + k] * ndc[1] + inverseProjection[8 + k] * ndc[2] +
+                 inverseProjection[12 + k];
+      for (int k = 0; k < 3; k++)
+        eye[k] /= eye[3];
+      double *corner = z ? farCorner[i] : nearCorner[i];
+      Matrix::transformPoint(inverseView, eye, corner);
+      corner[0] += distance;
+    }
+
+  double start = a;
+  for (int c = 0; c < count; c++)
+  {
+    Cascade &cascade = cascades[c];
+    double f = (c + 1.0) / CASCADES;
+    double even = a + (b - a) * f;
+    double end = perspective && a > 0.0 ? LAMBDA * a * pow(b / a, f) + (1.0 - LAMBDA) * even : even;
+
+    //  The slice's corners along the frustum edges, in light coordinates, kept to the box
+    double sliceLo[3] = {HUGE_VAL, HUGE_VAL, HUGE_VAL}, sliceHi[3] = {-HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+    for (int i = 0; i < 8; i++)
+    {
+      double t = ((i & 4 ? end : start) - nearPlane) / (farPlane - nearPlane), p[3];
+      for (int k = 0; k < 3; k++)
+        p[k] = nearCorner[i & 3][k] + t * (farCorner[i & 3][k] - nearCorner[i & 3][k]);
+      Matrix::transformPoint(rotation, p, p);
+      grow(sliceLo, sliceHi, p);
+    }
+    for (int k = 0; k < 2; k++)
+    {
+      sliceLo[k] = sliceLo[k] > boxLo[k] ? sliceLo[k] : boxLo[k];
+      sliceHi[k] = sliceHi[k] < boxHi[k] ? sliceHi[k] : boxHi[k];
+      if (sliceHi[k] <= sliceLo[k])
+      {
+        sliceLo[k] = boxLo[k];
+        sliceHi[k] = boxHi[k];
+      }
+    }
+
+    //  Sizes in steps of the square root of two and centers on a grid of an
+    //  eighth of the size - the box covers the slice wherever it falls in its cell
+    double across = sliceHi[0] - sliceLo[0] > sliceHi[1] - sliceLo[1] ? sliceHi[0] - sliceLo[0] : sliceHi[1] - sliceLo[1];
+    long level = (long)ceil(2.0 * log2(across));
+    double size = pow(2.0, 0.5 * level), cell = size / CELLS;
+    long deep = (long)ceil(log2(boxHi[2] - boxLo[2]));
+    long gx = lround(0.5 * (sliceLo[0] + sliceHi[0]) / cell);
+    long gy = lround(0.5 * (sliceLo[1] + sliceHi[1]) / cell);
+    long gz = lround(0.5 * (boxLo[2] + boxHi[2]) / cell);
+    double half = 0.5 * size + 0.5 * cell, halfDepth = 0.5 * pow(2.0, (double)deep) + 0.5 * cell;
+    double projectionLight[16];
+    ortho(projectionLight, gx * cell - half, gx * cell + half, gy * cell - half, gy * cell + half,
+          -(gz * cell + halfDepth), -(gz * cell - halfDepth));
+    Matrix::multiply(cascade.wanted, projectionLight, rotation);
+    long key[6] = {step, level, gx, gy, deep, gz};
+    memcpy(cascade.wantedKey, key, sizeof(key));
+
+    cascade.end = (float)end;
+    cascade.offset = (float)(OFFSET * 2.0 * half / SIZE);
+    bool stale = !cascade.drawn || memcmp(cascade.key, cascade.wantedKey, sizeof(key)) != 0;
+    if (!stale)
+      cascade.staleSince = -1;
+    else if (cascade.staleSince < 0)
+      cascade.staleSince = frame;
+    start = end;
+  }
+
+  //  Caches never drawn are drawn now, of the rest only the one stale longest
+  int oldest = -1;
+  for (int c = 0; c < CASCADES; c++)
+  {
+    Cascade &cascade = cascades[c];
+    cascade.cacheDue = c < count && !cascade.drawn;
+    if (c < count && cascade.drawn && cascade.staleSince >= 0 && (oldest < 0 || cascade.staleSince < cascades[oldest].staleSince))
+      oldest = c;
+  }
+  if (oldest >= 0)
+    cascades[oldest].cacheDue = true;
+  for (int c = 0; c < CASCADES; c++)
+  {
+    Cascade &cascade = cascades[c];
+    cascade.castersDue = cascade.cacheDue || (c < count && cascade.drawn && ((frame + c) & ((1 << c) - 1)) == 0);
+  }
+}
+
+void Shadows::invalidate()
+{
+  for (int c = 0; c < CASCADES; c++)
+    if (cascades[c].staleSince < 0)
+    {
+      cascades[c].key[0] = -1;
+      cascades[c].staleSince = frame;
+    }
+}
+
+bool Shadows::cacheDue(int cascade) const
+{
+  return cascades[cascade].cacheDue;
+}
+
+bool Shadows::castersDue(int cascade) const
+{
+  return cascades[cascade].castersDue;
+}
+
+void Shadows::begin(int c, bool cache)
+{
+  Cascade &cascade = cascades[c];
+  GLint bound;
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &bound);
+  saved = bound;
+
+  if (cache)
+  {
+    memcpy(cascade.light, cascade.wanted, sizeof(cascade.light));
+    memcpy(cascade.key, cascade.wantedKey, sizeof(cascade.key));
+    cascade.drawn = true;
+    cascade.staleSince = -1;
+    glBindFramebuffer(GL_FRAMEBUFFER, cascade.cacheFbo);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    caches++;
+  }
+  else
+  {
+    //  The casters go over the static depth
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, cascade.cacheFbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, cascade.mapFbo);
+    glBlitFramebuffer(0, 0, SIZE, SIZE, 0, 0, SIZE, SIZE, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, cascade.mapFbo);
+    casters++;
+  }
+
+  glPushAttrib(GL_VIEWPORT_BIT | GL_POLYGON_BIT | GL_ENABLE_BIT);
+  glViewport(0, 0, SIZE, SIZE);
+  glEnable(GL_DEPTH_TEST);
+  glEnable(GL_POLYGON_OFFSET_FILL);
+  glPolygonOffset(1.1f, 4.0f);
+  glMatrixMode(GL_PROJECTION);
+  glPushMatrix();
+  glLoadMatrixd(cascade.light);
+  glMatrixMode(GL_MODELVIEW);
+  glPushMatrix();
+  glLoadIdentity();
+  glTranslated(distance, 0, 0);
+}
+
+void Shadows::end()
+{
+  glMatrixMode(GL_PROJECTION);
+  glPopMatrix();
+  glMatrixMode(GL_MODELVIEW);
+  glPopMatrix();
+  glPopAttrib();
+  glBindFramebuffer(GL_FRAMEBUFFER, saved);
+  Util::ErrCheck("Shadows::end");
+}
+
+void Shadows::apply()
+{
+  if (!fitted)
+  {
+    count = caches = casters = 0;
+    Lights::shadow(0, 0, 0, 0, 0.0f);
+    return;
+  }
+  fitted = false;
+
+  //  From the camera's eye coordinates to the world, the light and [0,1] map coordinates
+  double toWorld[16], bias[16];
+  Matrix::invert(toWorld, view);
+  double shift[16];
+  Matrix::identity(shift);
+  Matrix::translate(shift, distance, 0, 0);
+  Matrix::multiply(toWorld, shift, toWorld);
+  Matrix::identity(bias);
+  Matrix::translate(bias, 0.5, 0.5, 0.5);
+  Matrix::scale(bias, 0.5, 0.5, 0.5);
+
+  float ends[CASCADES], offsets[CASCADES], matrices[16 * CASCADES];
+  for (int c = 0; c < count; c++)
+  {
+    const Cascade &cascade = cascades[c];
+    double m[16];
+    Matrix::multiply(m, cascade.light, toWorld);
+    Matrix::multiply(m, bias, m);
+    //  A cascade with no maps yet lights everything, its lookups land outside the map
+    for (int k = 0; k < 16; k++)
+      matrices[16 * c + k] = cascade.drawn ? (float)m[k] : 0.0f;
+    if (!cascade.drawn)
+      matrices[16 * c + 14] = -1.0f;
+    ends[c] = cascade.end;
+    offsets[c] = cascade.offset;
+
+    glActiveTexture(GL_TEXTURE0 + Lights::SHADOW_UNIT + c);
+    glBindTexture(GL_TEXTURE_2D, cascade.map);
+  }
+  glActiveTexture(GL_TEXTURE0);
+  Lights::shadow(count, ends, offsets, matrices, 1.0f / SIZE);
+}
+
+int Shadows::cascadeCount() const
+{
+  return count;
+}
+
+int Shadows::cachesDrawn() const
+{
+  return caches;
+}
+
+int Shadows::castersDrawn() const
+{
+  return casters;
+}
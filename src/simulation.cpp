@@ -0,0 +1,118 @@
+#include <chrono>
+#include "simulation.hpp"
+#include "util.hpp"
+
+const double Simulation::STEP = 1.0 / 60.0;
+const double Simulation::SPEED = 0.28;
+
+Simulation::Simulation() : accumulator(0.0), lastTime(-1.0), middle(1), back(0), front(2), running(false)
+{
+  state.travelled = 0.0;
+  for (int i = 0; i < 3; i++)
+  {
+    buffers[i].previous = buffers[i].current = state;
+    buffers[i].stamp = 0.0;
+  }
+}
+
+Simulation::~Simulation()
+{
+  stop();
+}
+
+/*
+ *  Advance the world by one fixed step
+ */
+void Simulation::step()
+{
+  // Drive forward, the world is drawn moving back past the rover
+  state.travelled += SPEED;
+}
+
+/*
+ *  Hand the newest pair of states to the renderer
+ */
+void Simulation::publish(const State &previous, double stamp)
+{
+  buffers[back].previous = previous;
+  buffers[back].current = state;
+  buffers[back].stamp = stamp;
+  back = middle.exchange(back | FRESH) & 3;
+}
+
+void Simulation::advance(double now)
+{
+  if (lastTime < 0.0)
+    lastTime = now;
+  accumulator += now - lastTime;
+  lastTime = now;
+  // Don't try to catch up after a long stall (window drag, breakpoint)
+  if (accumulator > 0.25)
+    accumulator = 0.25;
+
+  bool stepped = false;
+  State previous = state;
+  while (accumulator >= STEP)
+  {
+    previous = state;
+    step();
+    accumulator -= STEP;
+    stepped = true;
+  }
+  if (stepped)
+    publish(previous, now - accumulator);
+}
+
+void Simulation::start()
+{
+  if (running)
+    return;
+  running = true;
+  worker = std::thread(&Simulation::run, this);
+}
+
+void Simulation::stop()
+{
+  if (!running)
+    return;
+  running = false;
+  worker.join();
+}
+
+bool Simulation::threaded() const
+{
+  return running;
+}
+
+/*
+ *  Simulation thread - step on a fixed schedule so render hitches never slow it down
+ */
+void Simulation::run()
+{
+  lastTime = -1.0;
+  while (running)
+  {
+    advance(Util::seconds());
+    double wait = STEP - accumulator;
+    std::this_thread::sleep_for(std::chrono::duration<double>(wait > 0.0 ? wait : 0.0));
+  }
+}
+
+Simulation::State Simulation::sample(double now)
+{
+  // Take the newest pair if the writer published one
+  if (middle.load() & FRESH)
+    front = middle.exchange(front) & 3;
+  const Snapshot &snapshot = buffers[front];
+
+  // The renderer trails one step behind and blends towards the newest state
+  double alpha = (now - snapshot.stamp) / STEP;
+  if (alpha < 0.0)
+    alpha = 0.0;
+  if (alpha > 1.0)
+    alpha = 1.0;
+
+  State blended = snapshot.current;
+  blended.travelled = snapshot.previous.travelled + alpha * (snapshot.current.travelled - snapshot.previous.travelled);
+  return blended;
+}
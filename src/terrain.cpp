@@ -0,0 +1,547 @@
+#include <cmath>
+#include <cstddef> // For offsetof
+#include <thread>
+#include <stdint.h>
+#include "terrain.hpp"
+#include "lights.hpp"
+#include "frustum.hpp"
+#include "instances.hpp"
+#include "shader.hpp"
+#include "workers.hpp"
+#include "util.hpp"
+#ifdef USEGLEW
+#include <GL/glew.h>
+#endif
+//  OpenGL with prototypes for glext
+#define GL_GLEXT_PROTOTYPES
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+// Tell Xcode IDE to not gripe about OpenGL deprecation
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+// Legacy contexts only have the ARB entry point
+#define glVertexAttribDivisor glVertexAttribDivisorARB
+#else
+#include <GL/glut.h>
+#endif
+
+const double Terrain::SIZE = 60.0;
+const int Terrain::DEPTH = 3;
+const int Terrain::CELLS = 8;
+
+//  Heightmap texels along a chunk edge - one per grid step of the finest level
+static const int TEXELS = Terrain::CELLS << Terrain::DEPTH;
+//  Samples along a chunk edge, the last one is the first of the next chunk
+static const int SAMPLES = TEXELS + 1;
+
+//  Noise shape - the longest wavelength and the height of the hills
+static const double WAVELENGTH = 90.0;
+static const int OCTAVES = 4;
+static const double AMPLITUDE = 12.0;
+//  Half width of the flat track and the distance the hills take to rise
+static const double TRACK = 30.0;
+static const double RAMP = 40.0;
+//  How far the ring reaches behind the rover, as far as the old ground did
+static const double BEHIND = 150.0;
+
+//  Largest error in pixels a node may show before it is split
+static const double THRESHOLD = 12.0;
+//  Morphing into the coarser level starts at this fraction of its distance
+static const double MORPH = 0.7;
+//  Morph distances that are never reached, for levels that do not morph
+static const double NEVER = 1e9;
+
+// Generic attribute locations clear of the ones NVIDIA aliases to
+// gl_Vertex (0), gl_Normal (2), gl_Color (3) and gl_MultiTexCoord0 (8)
+static const int PLACE_LOCATION = 9; // vec4
+static const int MORPH_LOCATION = 10; // vec4
+
+static const char *vertexSource =
+    "#version 120\n"
+    "attribute vec4 nodePlace;\n"
+    "attribute vec4 nodeMorph;\n"
+    "uniform sampler2D heights;\n"
+    "uniform vec2 texels;\n"
+    "uniform float chunkTexels;\n"
+    "uniform float cells;\n"
+    "uniform float spacing;\n"
+    "uniform float amplitude;\n"
+    "uniform vec3 camera;\n"
+    "varying vec4 color;\n"
+    "varying vec3 eye;\n"
+    "varying vec3 normal;\n"
+    "float height(vec2 texel)\n"
+    "{\n"
+    "  return (2.0 * texture2DLod(heights, (texel + 0.5) / texels, 0.0).r - 1.0) * amplitude;\n"
+    "}\n"
+    "void main()\n"
+    "{\n"
+    "  vec2 grid = gl_Vertex.xz * cells;\n"
+    "  float step = nodePlace.z / cells;\n"
+    "  vec2 at = nodePlace.xy + grid * step;\n"
+    "  float d = distance(camera, vec3(at.x, height(nodeMorph.xy + grid * nodePlace.w), at.y));\n"
+    //   Slide odd vertices onto their even neighbor as the coarser level gets near
+    "  float morph = clamp((d - nodeMorph.z) / (nodeMorph.w - nodeMorph.z), 0.0, 1.0);\n"
+    "  grid -= fract(grid * 0.5) * 2.0 * morph;\n"
+    "  at = nodePlace.xy + grid * step;\n"
+    "  vec2 texel = nodeMorph.xy + grid * nodePlace.w;\n"
+    "  vec4 vertex = vec4(at.x, height(texel), at.y, 1.0);\n"
+    "  normal = gl_NormalMatrix * vec3(height(texel - vec2(1.0, 0.0)) - height(texel + vec2(1.0, 0.0)), 2.0 * spacing,\n"
+    "                                  height(texel - vec2(0.0, 1.0)) - height(texel + vec2(0.0, 1.0)));\n"
+    "  eye = (gl_ModelViewMatrix * vertex).xyz;\n"
+    "  color = gl_Color;\n"
+    //   The ground image repeats once per chunk, s across the track and t along it
+    "  gl_TexCoord[0] = vec4(texel.y / chunkTexels, texel.x / chunkTexels, 0.0, 1.0);\n"
+    "  gl_Position = gl_ModelViewProjectionMatrix * vertex;\n"
+    "}\n";
+
+static unsigned int program = 0;
+
+/*
+ *  Build the terrain program the first time it is needed
+ */
+static unsigned int terrainProgram()
+{
+  if (!program)
+  {
+    const char *attributes[] = {"nodePlace", "nodeMorph"};
+    const int locations[] = {PLACE_LOCATION, MORPH_LOCATION};
+    program = Shader::program("Terrain", vertexSource, Lights::fragmentSource().c_str(), 2, attributes, locations);
+  }
+  return program;
+}
+
+/*
+ *  The shader path needs instancing and texture reads in the vertex shader
+ */
+static bool supported()
+{
+  static int available = -1;
+  if (available < 0)
+  {
+    int units = 0;
+    if (Instances::supported())
+      glGetIntegerv(GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS, &units);
+    available = units > 0;
+  }
+  return available;
+}
+
+Terrain::Terrain(unsigned int seed) : seed(seed), travelled(0), first(0), heightmap(0), vbo(0)
+{
+  for (int i = 0; i < COLUMNS; i++)
+    for (int j = 0; j < ROWS; j++)
+    {
+      chunks[i][j].column = 0;
+      chunks[i][j].state = EMPTY;
+    }
+  eye[0] = eye[1] = eye[2] = 0.0f;
+  middle[0] = middle[1] = middle[2] = 0.0f;
+}
+
+int Terrain::slot(long column)
+{
+  return (int)(((column % COLUMNS) + COLUMNS) % COLUMNS);
+}
+
+/*
+ *  Pseudo-random value in [0,1] for a lattice point
+ */
+static double lattice(unsigned int seed, long x, long z)
+{
+  uint32_t h = seed ^ ((uint32_t)x * 0x8da6b343u) ^ ((uint32_t)z * 0xd8163841u);
+  h ^= h >> 16;
+  h *= 0x7feb352du;
+  h ^= h >> 15;
+  h *= 0x846ca68bu;
+  h ^= h >> 16;
+  return h / 4294967295.0;
+}
+
+static double fade(double t)
+{
+  return t * t * t * (t * (6 * t - 15) + 10);
+}
+
+/*
+ *  Octaves of value noise, in [0,1]
+ */
+double Terrain::noise(double x, double z) const
+{
+  double sum = 0, total = 0, amplitude = 1, wavelength = WAVELENGTH;
+  for (int octave = 0; octave < OCTAVES; octave++)
+  {
+    double u = x / wavelength, v = z / wavelength;
+    double fu = floor(u), fv = floor(v);
+    long i = (long)fu, j = (long)fv;
+    double s = fade(u - fu), t = fade(v - fv);
+    unsigned int octaveSeed = seed + 0x9e3779b9u * octave;
+    double a = lattice(octaveSeed, i, j), b = lattice(octaveSeed, i + 1, j);
+    double c = lattice(octaveSeed, i, j + 1), d = lattice(octaveSeed, i + 1, j + 1);
+    sum += amplitude * (a + s * (b - a) + t * (c + s * (d - c) - a - s * (b - a)));
+    total += amplitude;
+    amplitude *= 0.5;
+    wavelength *= 0.5;
+  }
+  return sum / total;
+}
+
+double Terrain::height(double x, double z) const
+{
+  //  Hills rise smoothly away from the track so the rover always drives on the flat
+  double t = (fabs(z) - TRACK) / RAMP;
+  if (t <= 0)
+    return 0;
+  if (t > 1)
+    t = 1;
+  return AMPLITUDE * (2 * noise(x, z) - 1) * t * t * (3 - 2 * t);
+}
+
+//  Heights are stored as 16-bit fractions of -AMPLITUDE to AMPLITUDE
+static unsigned short encode(double h)
+{
+  double q = (0.5 * h / AMPLITUDE + 0.5) * 65535.0 + 0.5;
+  return (unsigned short)(q < 0 ? 0 : q > 65535 ? 65535 : q);
+}
+
+static double decode(unsigned short q)
+{
+  return (2.0 * q / 65535.0 - 1.0) * AMPLITUDE;
+}
+
+//  Index of a node's bounds - the levels follow each other, each row by row
+static int nodeIndex(int depth, int i, int j)
+{
+  return ((1 << (2 * depth)) - 1) / 3 + (j << depth) + i;
+}
+
+/*
+ *  Sample a chunk's heights and the bounds of its quadtree nodes - runs on
+ *  a worker, so no GL
+ */
+void Terrain::build(Chunk &chunk, long column, int row) const
+{
+  double x0 = column * SIZE;
+  double z0 = (row - ROWS / 2) * SIZE;
+  double step = SIZE / TEXELS;
+
+  chunk.heights.resize(SAMPLES * SAMPLES);
+  for (int b = 0; b < SAMPLES; b++)
+    for (int a = 0; a < SAMPLES; a++)
+      chunk.heights[b * SAMPLES + a] = encode(height(x0 + a * step, z0 + b * step));
+
+  chunk.bounds.resize(2 * nodeIndex(DEPTH + 1, 0, 0));
+  for (int depth = 0; depth <= DEPTH; depth++)
+  {
+    int span = TEXELS >> depth;
+    for (int j = 0; j < (1 << depth); j++)
+      for (int i = 0; i < (1 << depth); i++)
+      {
+        unsigned short lo = 65535, hi = 0;
+        for (int b = j * span; b <= (j + 1) * span; b++)
+          for (int a = i * span; a <= (i + 1) * span; a++)
+          {
+            unsigned short q = chunk.heights[b * SAMPLES + a];
+            lo = q < lo ? q : lo;
+            hi = q > hi ? q : hi;
+          }
+        int n = nodeIndex(depth, i, j);
+        chunk.bounds[2 * n] = (float)decode(lo);
+        chunk.bounds[2 * n + 1] = (float)decode(hi);
+      }
+  }
+}
+
+/*
+ *  Copy a chunk into its place in the ring heightmap - the column's last
+ *  samples belong to the next slot along X, its last row overlaps the next
+ *  row with the same values
+ */
+void Terrain::upload(Chunk &chunk, long column, int row)
+{
+  glBindTexture(GL_TEXTURE_2D, heightmap);
+  glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, SAMPLES);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, slot(column) * TEXELS, row * TEXELS, TEXELS, SAMPLES,
+                  GL_LUMINANCE, GL_UNSIGNED_SHORT, chunk.heights.data());
+  glPopClientAttrib();
+  glBindTexture(GL_TEXTURE_2D, 0);
+  Util::ErrCheck("Terrain::upload");
+}
+
+void Terrain::update(double distance)
+{
+  //  The heightmap and node grid are made once, with the first context
+  if (!heightmap)
+  {
+    glGenTextures(1, &heightmap);
+    glBindTexture(GL_TEXTURE_2D, heightmap);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE16, COLUMNS * TEXELS, ROWS * TEXELS + 1, 0, GL_LUMINANCE, GL_UNSIGNED_SHORT, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    //  The ring wraps along X
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    for (int j = 0; j < CELLS; j++)
+    {
+      grid.begin(GL_QUAD_STRIP);
+      for (int i = 0; i <= CELLS; i++)
+      {
+        grid.vertex((double)i / CELLS, 0, (double)j / CELLS);
+        grid.vertex((double)i / CELLS, 0, (double)(j + 1) / CELLS);
+      }
+      grid.end();
+    }
+    grid.upload();
+  }
+
+  //  One column either side of the drawn ones supplies their edge samples and normals
+  travelled = distance;
+  first = (long)floor((distance - BEHIND) / SIZE) - 1;
+
+  for (long column = first; column < first + COLUMNS; column++)
+    for (int row = 0; row < ROWS; row++)
+    {
+      Chunk &chunk = chunks[slot(column)][row];
+      int state = chunk.state.load();
+      if (chunk.column != column || state == EMPTY)
+      {
+        //  The column behind is evicted, unless a worker is still on it
+        if (state == BUILDING)
+          continue;
+        chunk.column = column;
+        chunk.state = BUILDING;
+        Workers::pool().submit([this, &chunk, column, row]()
+                               {
+                                 build(chunk, column, row);
+                                 chunk.state = BUILT; });
+      }
+      else if (state == BUILT)
+      {
+        //  The only upload the chunk gets, over the column it replaced
+        upload(chunk, column, row);
+        chunk.state = UPLOADED;
+      }
+    }
+}
+
+void Terrain::finish()
+{
+  while (residentChunks() < COLUMNS * ROWS)
+  {
+    update(travelled);
+    std::this_thread::yield();
+  }
+}
+
+static double boxDistance(const double p[3], const double lo[3], const double hi[3])
+{
+  double sum = 0;
+  for (int k = 0; k < 3; k++)
+  {
+    double d = p[k] < lo[k] ? lo[k] - p[k] : p[k] > hi[k] ? p[k] - hi[k] : 0;
+    sum += d * d;
+  }
+  return sqrt(sum);
+}
+
+/*
+ *  Distance within which a node splits - where its grid step reaches the
+ *  error threshold, but never so close that levels two apart can touch
+ */
+static double splitDistance(const Frustum &frustum, double size)
+{
+  double distance = frustum.pixels(size / Terrain::CELLS, 1.0) / THRESHOLD;
+  return distance > 2.5 * size ? distance : 2.5 * size;
+}
+
+/*
+ *  Add a node at corner x, z, or its children when it is too coarse for
+ *  this view - culled nodes add nothing
+ */
+void Terrain::visit(const Frustum &frustum, const Chunk &chunk, int row, double x, double z, int depth, int i, int j)
+{
+  double size = SIZE / (1 << depth);
+  int n = nodeIndex(depth, i, j);
+  double lo[3] = {x, chunk.bounds[2 * n], z};
+  double hi[3] = {x + size, chunk.bounds[2 * n + 1], z + size};
+  if (!frustum.intersects(lo, hi))
+    return;
+
+  //  Perspective views split by distance, orthographic ones only by scale
+  bool split;
+  if (frustum.orthographic())
+    split = frustum.pixels(size / CELLS, 0) > THRESHOLD;
+  else
+    split = boxDistance(frustum.eye(), lo, hi) < splitDistance(frustum, size);
+  if (split && depth < DEPTH)
+  {
+    double half = 0.5 * size;
+    for (int c = 0; c < 4; c++)
+      visit(frustum, chunk, row, x + (c & 1) * half, z + (c >> 1) * half, depth + 1, 2 * i + (c & 1), 2 * j + (c >> 1));
+    return;
+  }
+
+  //  Nodes morph into their parent towards the distance the parent takes over
+  Node node;
+  int span = TEXELS >> depth;
+  node.place[0] = (float)x;
+  node.place[1] = (float)z;
+  node.place[2] = (float)size;
+  node.place[3] = (float)(span / CELLS);
+  node.morph[0] = (float)(slot(chunk.column) * TEXELS + i * span);
+  node.morph[1] = (float)(row * TEXELS + j * span);
+  double end = depth > 0 && !frustum.orthographic() ? splitDistance(frustum, 2 * size) : NEVER;
+  node.morph[2] = (float)(end < NEVER ? MORPH * end : NEVER);
+  node.morph[3] = (float)(end < NEVER ? end : 2 * NEVER);
+  nodes.push_back(node);
+}
+
+void Terrain::select(const Frustum &frustum, double distance)
+{
+  nodes.clear();
+  for (long column = first + 1; column < first + COLUMNS - 1; column++)
+    for (int row = 0; row < ROWS; row++)
+    {
+      const Chunk &chunk = chunks[slot(column)][row];
+      if (chunk.column == column && chunk.state.load() == UPLOADED)
+        visit(frustum, chunk, row, column * SIZE - distance, (row - ROWS / 2) * SIZE, 0, 0, 0);
+    }
+  for (int k = 0; k < 3; k++)
+    eye[k] = (float)frustum.eye()[k];
+
+  //  Center of the selected nodes' footprint on the ground plane
+  float lo[2] = {0, 0}, hi[2] = {0, 0};
+  for (size_t n = 0; n < nodes.size(); n++)
+    for (int k = 0; k < 2; k++)
+    {
+      float a = nodes[n].place[k], b = a + nodes[n].place[2];
+      lo[k] = n == 0 || a < lo[k] ? a : lo[k];
+      hi[k] = n == 0 || b > hi[k] ? b : hi[k];
+    }
+  middle[0] = 0.5f * (lo[0] + hi[0]);
+  middle[1] = 0.0f;
+  middle[2] = 0.5f * (lo[1] + hi[1]);
+
+  if (nodes.empty() || !supported())
+    return;
+  if (!vbo)
+    glGenBuffers(1, &vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferData(GL_ARRAY_BUFFER, nodes.size() * sizeof(Node), nodes.data(), GL_STREAM_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  Util::ErrCheck("Terrain::select");
+}
+
+void Terrain::draw() const
+{
+  if (nodes.empty())
+    return;
+  if (!supported())
+  {
+    drawFallback();
+    return;
+  }
+
+  unsigned int prog = terrainProgram();
+  glUseProgram(prog);
+  Shader::setFixedState(prog);
+  glUniform1i(glGetUniformLocation(prog, "heights"), 1);
+  glUniform2f(glGetUniformLocation(prog, "texels"), (float)(COLUMNS * TEXELS), (float)(ROWS * TEXELS + 1));
+  glUniform1f(glGetUniformLocation(prog, "chunkTexels"), (float)TEXELS);
+  glUniform1f(glGetUniformLocation(prog, "cells"), (float)CELLS);
+  glUniform1f(glGetUniformLocation(prog, "spacing"), (float)(SIZE / TEXELS));
+  glUniform1f(glGetUniformLocation(prog, "amplitude"), (float)AMPLITUDE);
+  glUniform3fv(glGetUniformLocation(prog, "camera"), 1, eye);
+
+  //  Heights on the second unit, the ground image stays on the first
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, heightmap);
+  glActiveTexture(GL_TEXTURE0);
+
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glEnableVertexAttribArray(PLACE_LOCATION);
+  glVertexAttribPointer(PLACE_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(Node), (void *)offsetof(Node, place));
+  glVertexAttribDivisor(PLACE_LOCATION, 1);
+  glEnableVertexAttribArray(MORPH_LOCATION);
+  glVertexAttribPointer(MORPH_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(Node), (void *)offsetof(Node, morph));
+  glVertexAttribDivisor(MORPH_LOCATION, 1);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  grid.drawInstanced((int)nodes.size());
+
+  glVertexAttribDivisor(PLACE_LOCATION, 0);
+  glDisableVertexAttribArray(PLACE_LOCATION);
+  glVertexAttribDivisor(MORPH_LOCATION, 0);
+  glDisableVertexAttribArray(MORPH_LOCATION);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+  glUseProgram(0);
+}
+
+/*
+ *  Without the shader path draw each node straight from the chunk's
+ *  samples - the levels still follow the view but do not morph
+ */
+void Terrain::drawFallback() const
+{
+  double step = SIZE / TEXELS;
+  for (size_t n = 0; n < nodes.size(); n++)
+  {
+    const Node &node = nodes[n];
+    int s = (int)node.morph[0], t = (int)node.morph[1], stride = (int)node.place[3];
+    const Chunk &chunk = chunks[s / TEXELS][t / TEXELS];
+    int a0 = s % TEXELS, b0 = t % TEXELS;
+
+    for (int j = 0; j < CELLS; j++)
+    {
+      glBegin(GL_QUAD_STRIP);
+      for (int i = 0; i <= CELLS; i++)
+        for (int e = 0; e < 2; e++)
+        {
+          int a = a0 + i * stride, b = b0 + (j + e) * stride;
+          //  Normal from the neighboring samples, one-sided on the chunk's edges
+          int al = a > 0 ? a - 1 : a, ar = a < TEXELS ? a + 1 : a;
+          int bl = b > 0 ? b - 1 : b, br = b < TEXELS ? b + 1 : b;
+          double dx = (decode(chunk.heights[b * SAMPLES + ar]) - decode(chunk.heights[b * SAMPLES + al])) / (ar - al);
+          double dz = (decode(chunk.heights[br * SAMPLES + a]) - decode(chunk.heights[bl * SAMPLES + a])) / (br - bl);
+          glNormal3d(-dx, step, -dz);
+          glTexCoord2d((double)b / TEXELS, (double)a / TEXELS);
+          glVertex3d(node.place[0] + (a - a0) * step, decode(chunk.heights[b * SAMPLES + a]), node.place[1] + (b - b0) * step);
+        }
+      glEnd();
+    }
+  }
+}
+
+void Terrain::center(double c[3]) const
+{
+  for (int k = 0; k < 3; k++)
+    c[k] = middle[k];
+}
+
+int Terrain::residentChunks() const
+{
+  int count = 0;
+  for (long column = first; column < first + COLUMNS; column++)
+    for (int row = 0; row < ROWS; row++)
+    {
+      const Chunk &chunk = chunks[slot(column)][row];
+      if (chunk.column == column && chunk.state.load() == UPLOADED)
+        count++;
+    }
+  return count;
+}
+
+int Terrain::nodeCount() const
+{
+  return (int)nodes.size();
+}
+
+int Terrain::triangleCount() const
+{
+  return (int)nodes.size() * CELLS * CELLS * 2;
+}
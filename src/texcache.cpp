@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "texcache.hpp"
+#include "util.hpp"
+#ifdef USEGLEW
+#include <GL/glew.h>
+#endif
+//  OpenGL with prototypes for glext
+#define GL_GLEXT_PROTOTYPES
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+// Tell Xcode IDE to not gripe about OpenGL deprecation
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#else
+#include <GL/glut.h>
+#endif
+
+#define CACHE "textures/textures.cache"
+#define VERSION 1
+
+/*
+ *  File layout, host byte order (another byte order fails the magic check
+ *  and the cache is rebuilt): FileHeader, then per texture a RecordHeader,
+ *  the path padded to 8 bytes, a LevelHeader per mip level and the level
+ *  data, each level padded to 8 bytes
+ */
+struct FileHeader
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t count;
+  uint32_t pad;
+};
+
+struct RecordHeader
+{
+  uint64_t sourceSize; // Size of the BMP the levels were baked from
+  int64_t sourceTime;  // and its modification time
+  uint64_t hash;       // Content hash of the BMP pixels
+  uint32_t format;     // GL internal format
+  uint32_t compressed; // Levels are compressed blocks rather than RGB
+  uint32_t levels;
+  uint32_t pathLength;
+};
+
+struct LevelHeader
+{
+  uint32_t width, height, size, pad;
+};
+
+// One level of a mip chain, offset into the record's data
+struct Level
+{
+  unsigned int width, height, size;
+  size_t offset;
+};
+
+// A cached texture - data is in the mapped file or, once baked, in baked
+struct Record
+{
+  std::string path;
+  RecordHeader header;
+  std::vector<Level> levels;
+  const unsigned char *mapped;
+  std::vector<unsigned char> baked;
+
+  const unsigned char *data(const Level &level) const
+  {
+    return (baked.empty() ? mapped : baked.data()) + level.offset;
+  }
+};
+
+static std::vector<Record> records;
+static void *mapping = 0;
+static size_t mappingSize = 0;
+static bool opened = false;
+static bool dirty = false;
+
+static size_t pad8(size_t n)
+{
+  return (n + 7) & ~(size_t)7;
+}
+
+/*
+ *  Size and modification time of a source file - an atlas key lists its
+ *  files separated by '|' and gets their total size and latest time
+ */
+static bool signature(const char *key, uint64_t &size, int64_t &time)
+{
+  size = 0;
+  time = 0;
+  std::string files(key);
+  for (size_t start = 0; start <= files.size();)
+  {
+    size_t end = files.find('|', start);
+    if (end == std::string::npos)
+      end = files.size();
+    struct stat st;
+    if (stat(files.substr(start, end - start).c_str(), &st))
+      return false;
+    size += st.st_size;
+    if (st.st_mtime > time)
+      time = st.st_mtime;
+    start = end + 1;
+  }
+  return true;
+}
+
+/*
+ *  Parse the mapped cache, false if it is truncated or from another version
+ */
+static bool parse(const unsigned char *bytes, size_t length)
+{
+  FileHeader file;
+  if (length < sizeof(file))
+    return false;
+  memcpy(&file, bytes, sizeof(file));
+  if (memcmp(file.magic, "PTXC", 4) || file.version != VERSION)
+    return false;
+
+  size_t at = sizeof(file);
+  for (unsigned int i = 0; i < file.count; i++)
+  {
+    Record record;
+    if (length - at < sizeof(record.header))
+      return false;
+    memcpy(&record.header, bytes + at, sizeof(record.header));
+    at += sizeof(record.header);
+    if (length - at < pad8(record.header.pathLength))
+      return false;
+    record.path.assign((const char *)bytes + at, record.header.pathLength);
+    at += pad8(record.header.pathLength);
+
+    //  Level headers, then the data they describe
+    if ((length - at) / sizeof(LevelHeader) < record.header.levels)
+      return false;
+    size_t offset = at + record.header.levels * sizeof(LevelHeader);
+    for (unsigned int k = 0; k < record.header.levels; k++)
+    {
+      LevelHeader header;
+      memcpy(&header, bytes + at, sizeof(header));
+      at += sizeof(header);
+      if (offset > length || length - offset < header.size)
+        return false;
+      Level level = {header.width, header.height, header.size, offset};
+      record.levels.push_back(level);
+      offset += pad8(header.size);
+    }
+    //  The last level's padding can run past a truncated file
+    at = offset;
+    if (at > length)
+      return false;
+    record.mapped = bytes;
+    records.push_back(record);
+  }
+  return true;
+}
+
+/*
+ *  Map the cache file on first use
+ */
+static void openCache()
+{
+  if (opened)
+    return;
+  opened = true;
+  mapping = Util::MapFile(CACHE, mappingSize);
+  if (mapping && !parse((const unsigned char *)mapping, mappingSize))
+  {
+    fprintf(stderr, "Ignoring stale texture cache %s\n", CACHE);
+    records.clear();
+  }
+}
+
+/*
+ *  Cached record for a path, 0 if there is none
+ */
+static Record *find(const char *file)
+{
+  openCache();
+  for (size_t i = 0; i < records.size(); i++)
+    if (records[i].path == file)
+      return &records[i];
+  return 0;
+}
+
+bool TextureCache::lookup(const char *file, uint64_t &hash)
+{
+  Record *record = find(file);
+  uint64_t size;
+  int64_t time;
+  if (!record || !signature(file, size, time))
+    return false;
+  if (record->header.sourceSize != size || record->header.sourceTime != time)
+    return false;
+  //  Compressed blocks baked on another driver need the BMP here
+  if (record->header.compressed && !Util::CompressTextures())
+    return false;
+  hash = record->header.hash;
+  return true;
+}
+
+size_t TextureCache::upload(const char *file, unsigned int texture)
+{
+  const Record *record = find(file);
+  if (!record)
+    Util::Fatal("%s is not in the texture cache\n", file);
+
+  //  Clear errors left by earlier calls so only this upload's are checked
+  while (glGetError())
+    ;
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  size_t bytes = 0;
+  for (size_t k = 0; k < record->levels.size(); k++)
+  {
+    const Level &level = record->levels[k];
+    if (record->header.compressed)
+      glCompressedTexImage2D(GL_TEXTURE_2D, k, record->header.format, level.width, level.height, 0, level.size, record->data(level));
+    else
+      glTexImage2D(GL_TEXTURE_2D, k, record->header.format, level.width, level.height, 0, GL_RGB, GL_UNSIGNED_BYTE, record->data(level));
+    bytes += level.size;
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  if (glGetError())
+  {
+    fprintf(stderr, "Cannot upload cached texture %s, reading the BMP\n", file);
+    return 0;
+  }
+  //  Trilinear over the whole chain
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, record->levels.size() - 1);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  return bytes;
+}
+
+size_t TextureCache::bake(const char *file, unsigned int texture, uint64_t hash)
+{
+  Record record;
+  record.path = file;
+  record.mapped = 0;
+  record.header.hash = hash;
+
+  glBindTexture(GL_TEXTURE_2D, texture);
+  int format, compressed;
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+  record.header.format = format;
+  record.header.compressed = compressed;
+
+  //  Read back every level down to 1x1 or the texture's last level
+  int last;
+  glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &last);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  for (int k = 0; k <= last; k++)
+  {
+    int width, height, size;
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, k, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, k, GL_TEXTURE_HEIGHT, &height);
+    if (width < 1 || height < 1)
+      break;
+    if (compressed)
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, k, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+    else
+      size = 3 * width * height;
+
+    Level level = {(unsigned int)width, (unsigned int)height, (unsigned int)size, record.baked.size()};
+    record.baked.resize(level.offset + pad8(size));
+    if (compressed)
+      glGetCompressedTexImage(GL_TEXTURE_2D, k, &record.baked[level.offset]);
+    else
+      glGetTexImage(GL_TEXTURE_2D, k, GL_RGB, GL_UNSIGNED_BYTE, &record.baked[level.offset]);
+    record.levels.push_back(level);
+    if (width == 1 && height == 1)
+      break;
+  }
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  record.header.levels = record.levels.size();
+  record.header.pathLength = record.path.size();
+
+  size_t bytes = 0;
+  for (size_t k = 0; k < record.levels.size(); k++)
+    bytes += record.levels[k].size;
+
+  //  Only cache what can be checked against its source later
+  if (!signature(file, record.header.sourceSize, record.header.sourceTime))
+    return bytes;
+  Record *old = find(file);
+  if (old)
+    *old = record;
+  else
+    records.push_back(record);
+  dirty = true;
+  return bytes;
+}
+
+void TextureCache::save()
+{
+  if (!dirty)
+    return;
+  dirty = false;
+
+  //  Write a new file and swap it in - the old one stays mapped until exit
+  std::string temp = std::string(CACHE) + ".tmp";
+  FILE *f = fopen(temp.c_str(), "wb");
+  if (!f)
+  {
+    fprintf(stderr, "Cannot write texture cache %s\n", CACHE);
+    return;
+  }
+  const unsigned char zeros[8] = {0};
+  FileHeader file = {{'P', 'T', 'X', 'C'}, VERSION, (uint32_t)records.size(), 0};
+  bool ok = fwrite(&file, sizeof(file), 1, f) == 1;
+  for (size_t i = 0; i < records.size() && ok; i++)
+  {
+    const Record &record = records[i];
+    size_t pathLength = record.path.size();
+    ok = fwrite(&record.header, sizeof(record.header), 1, f) == 1 &&
+         fwrite(record.path.data(), 1, pathLength, f) == pathLength &&
+         fwrite(zeros, 1, pad8(pathLength) - pathLength, f) == pad8(pathLength) - pathLength;
+    for (size_t k = 0; k < record.levels.size() && ok; k++)
+    {
+      LevelHeader header = {record.levels[k].width, record.levels[k].height, record.levels[k].size, 0};
+      ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    }
+    for (size_t k = 0; k < record.levels.size() && ok; k++)
+    {
+      const Level &level = record.levels[k];
+      ok = fwrite(record.data(level), 1, level.size, f) == level.size &&
+           fwrite(zeros, 1, pad8(level.size) - level.size, f) == pad8(level.size) - level.size;
+    }
+  }
+  if (fclose(f) || !ok)
+  {
+    fprintf(stderr, "Cannot write texture cache %s\n", CACHE);
+    remove(temp.c_str());
+    return;
+  }
+  remove(CACHE);
+  if (rename(temp.c_str(), CACHE))
+    fprintf(stderr, "Cannot write texture cache %s\n", CACHE);
+}
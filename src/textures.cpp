@@ -0,0 +1,421 @@
+#include <string>
+#include <functional>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include <thread>
+#include <stdint.h>
+#include <string.h>
+#include "textures.hpp"
+#include "workers.hpp"
+#include "util.hpp"
+#include "texcache.hpp"
+#ifdef USEGLEW
+#include <GL/glew.h>
+#endif
+//  OpenGL with prototypes for glext
+#define GL_GLEXT_PROTOTYPES
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+// Tell Xcode IDE to not gripe about OpenGL deprecation
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+#else
+#include <GL/glut.h>
+#endif
+
+// One entry per path - entries with the same pixels share a GL texture
+struct Entry
+{
+  std::string path;
+  unsigned int name; // GL texture, the placeholder until the image arrives
+  uint64_t hash;     // Hash of the dimensions and pixels
+  size_t bytes;      // Texture memory of the GL texture
+  int refs;          // Handles given out
+  bool ready;        // Image uploaded
+};
+
+// Decoded images waiting for the main thread
+struct Decoded
+{
+  int handle;
+  uint64_t hash;
+  int levels; // Mip levels to keep, 0 for the whole chain
+  Util::Image image;
+};
+
+static std::vector<Entry> entries; // Main thread only
+static std::mutex mutex;
+static std::vector<Decoded *> decoded;
+static int outstanding = 0; // Loads started but not uploaded
+
+// Edge texels repeated around each atlas image, and cells aligned to the
+// same step, so filtering never reaches a neighbour down to the last of
+// the mip levels kept (one gutter texel left there)
+static const int ATLAS_LEVELS = 5;
+static const int GUTTER = 1 << (ATLAS_LEVELS - 1);
+
+/*
+ *  64-bit FNV-1a over the dimensions and pixels
+ */
+static uint64_t hashImage(const Util::Image &image)
+{
+  uint64_t h = 14695981039346656037ULL;
+  unsigned int dims[2] = {image.width, image.height};
+  const unsigned char *bytes = (const unsigned char *)dims;
+  for (size_t i = 0; i < sizeof(dims); i++)
+    h = (h ^ bytes[i]) * 1099511628211ULL;
+  //  Skip the row padding, it can hold anything
+  for (unsigned int y = 0; y < image.height; y++)
+  {
+    const unsigned char *row = image.data + (size_t)y * image.rowBytes;
+    for (unsigned int x = 0; x < 3 * image.width; x++)
+      h = (h ^ row[x]) * 1099511628211ULL;
+  }
+  return h;
+}
+
+/*
+ *  Number of live entries using a GL texture
+ */
+static int users(unsigned int name)
+{
+  int count = 0;
+  for (size_t i = 0; i < entries.size(); i++)
+    if (entries[i].refs > 0 && entries[i].name == name)
+      count++;
+  return count;
+}
+
+/*
+ *  Take another reference to a live entry with this key, -1 if there is none
+ */
+static int shared(const std::string &key)
+{
+  for (size_t i = 0; i < entries.size(); i++)
+    if (entries[i].refs > 0 && entries[i].path == key)
+    {
+      entries[i].refs++;
+      return (int)i;
+    }
+  return -1;
+}
+
+/*
+ *  New entry for key - from the baked cache if it is current, otherwise a
+ *  placeholder until decode has run on a worker and update() uploads it
+ */
+static int create(const std::string &key, const std::function<Decoded *()> &decode)
+{
+  Entry entry;
+  entry.path = key;
+  entry.refs = 1;
+  int handle = (int)entries.size();
+
+  //  Baked mip chain - ready straight away, shared if the pixels are already resident
+  if (TextureCache::lookup(key.c_str(), entry.hash))
+  {
+    size_t k;
+    for (k = 0; k < entries.size(); k++)
+      if (entries[k].ready && entries[k].refs > 0 && entries[k].hash == entry.hash)
+        break;
+    if (k < entries.size())
+    {
+      entry.name = entries[k].name;
+      entry.bytes = entries[k].bytes;
+    }
+    else
+    {
+      glGenTextures(1, &entry.name);
+      entry.bytes = TextureCache::upload(key.c_str(), entry.name);
+      //  Refused by the driver - the BMP is read and baked again below
+      if (!entry.bytes)
+        glDeleteTextures(1, &entry.name);
+    }
+    if (entry.bytes)
+    {
+      entry.ready = true;
+      entries.push_back(entry);
+      return handle;
+    }
+  }
+
+  //  Placeholder - a single white texel leaves modulated colors untouched
+  const unsigned char white[3] = {255, 255, 255};
+  glGenTextures(1, &entry.name);
+  glBindTexture(GL_TEXTURE_2D, entry.name);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, white);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  entry.hash = 0;
+  entry.bytes = sizeof(white);
+  entry.ready = false;
+  entries.push_back(entry);
+
+  //  Read, convert and hash on a worker
+  outstanding++;
+  Workers::pool().submit([handle, decode]()
+                         {
+                           Decoded *d = decode();
+                           d->handle = handle;
+                           d->hash = hashImage(d->image);
+                           std::lock_guard<std::mutex> lock(mutex);
+                           decoded.push_back(d); });
+  return handle;
+}
+
+int Textures::load(const char *file)
+{
+  //  Same path - share the entry
+  int handle = shared(file);
+  if (handle >= 0)
+    return handle;
+
+  std::string path(file);
+  return create(path, [path]()
+                {
+                  Decoded *d = new Decoded;
+                  d->levels = 0;
+                  Util::ReadBMP(path.c_str(), d->image);
+                  return d; });
+}
+
+// Where an image sits in an atlas
+struct Cell
+{
+  std::string file;
+  unsigned int x, y, width, height;
+};
+
+/*
+ *  Copy an image into the atlas at its cell, repeating the edge texels into the gutter
+ */
+static void blit(Util::Image &atlas, const Cell &cell)
+{
+  Util::Image image;
+  Util::ReadBMP(cell.file.c_str(), image);
+  for (int r = -GUTTER; r < (int)cell.height + GUTTER; r++)
+  {
+    int y = std::min(std::max(r, 0), (int)cell.height - 1);
+    const unsigned char *src = image.data + (size_t)y * image.rowBytes;
+    unsigned char *dst = &atlas.pixels[(size_t)(cell.y + r) * atlas.rowBytes + 3 * (cell.x - GUTTER)];
+    for (int k = 0; k < GUTTER; k++, dst += 3)
+      memcpy(dst, src, 3);
+    memcpy(dst, src, 3 * cell.width);
+    dst += 3 * cell.width;
+    for (int k = 0; k < GUTTER; k++, dst += 3)
+      memcpy(dst, src + 3 * (cell.width - 1), 3);
+  }
+}
+
+static unsigned int powerOfTwo(unsigned int n)
+{
+  unsigned int k = 1;
+  while (k < n)
+    k *= 2;
+  return k;
+}
+
+int Textures::atlas(const char *const files[], int count, float regions[][4])
+{
+  //  One cell per distinct file, sized from its header - the pixels stay on disk
+  std::vector<Cell> cells;
+  std::vector<int> cellOf(count);
+  std::string key;
+  for (int i = 0; i < count; i++)
+  {
+    key += (i ? "|" : "") + std::string(files[i]);
+    int k;
+    for (k = 0; k < (int)cells.size(); k++)
+      if (cells[k].file == files[i])
+        break;
+    if (k == (int)cells.size())
+    {
+      Util::Image image;
+      Util::ReadBMP(files[i], image);
+      Cell cell = {files[i], 0, 0, image.width, image.height};
+      cells.push_back(cell);
+    }
+    cellOf[i] = k;
+  }
+
+  //  Shelf pack tallest first into the narrowest square-ish power of two,
+  //  cells on gutter boundaries so mip texels and compressed blocks hold one image
+  std::vector<int> order(cells.size());
+  unsigned int width = 1;
+  for (size_t k = 0; k < cells.size(); k++)
+  {
+    order[k] = (int)k;
+    width = std::max(width, powerOfTwo((cells[k].width + 3 * GUTTER - 1) & ~(GUTTER - 1u)));
+  }
+  std::sort(order.begin(), order.end(), [&cells](int a, int b)
+            { return cells[a].height > cells[b].height; });
+  unsigned int height;
+  for (;; width *= 2)
+  {
+    unsigned int x = 0, y = 0, shelf = 0;
+    for (size_t k = 0; k < order.size(); k++)
+    {
+      Cell &cell = cells[order[k]];
+      unsigned int w = (cell.width + 3 * GUTTER - 1) & ~(GUTTER - 1u);
+      unsigned int h = (cell.height + 3 * GUTTER - 1) & ~(GUTTER - 1u);
+      if (x + w > width)
+      {
+        y += shelf;
+        x = shelf = 0;
+      }
+      cell.x = x + GUTTER;
+      cell.y = y + GUTTER;
+      x += w;
+      shelf = std::max(shelf, h);
+    }
+    height = y + shelf;
+    if (height <= width)
+      break;
+  }
+  height = powerOfTwo(height);
+
+  for (int i = 0; i < count; i++)
+  {
+    const Cell &cell = cells[cellOf[i]];
+    regions[i][0] = (float)cell.x / width;
+    regions[i][1] = (float)cell.y / height;
+    regions[i][2] = (float)cell.width / width;
+    regions[i][3] = (float)cell.height / height;
+  }
+
+  //  Same set of files - share the entry
+  int handle = shared(key);
+  if (handle >= 0)
+    return handle;
+
+  return create(key, [cells, width, height]()
+                {
+                  Decoded *d = new Decoded;
+                  d->levels = ATLAS_LEVELS;
+                  d->image.width = width;
+                  d->image.height = height;
+                  d->image.rowBytes = 3 * width;
+                  d->image.pixels.assign(d->image.size(), 0);
+                  d->image.data = d->image.pixels.data();
+                  for (size_t k = 0; k < cells.size(); k++)
+                    blit(d->image, cells[k]);
+                  return d; });
+}
+
+void Textures::release(int handle)
+{
+  Entry &entry = entries[handle];
+  if (entry.refs <= 0 || --entry.refs > 0)
+    return;
+  if (!users(entry.name))
+    glDeleteTextures(1, &entry.name);
+  entry.path.clear();
+}
+
+void Textures::bind(int handle)
+{
+  glBindTexture(GL_TEXTURE_2D, entries[handle].name);
+}
+
+unsigned int Textures::name(int handle)
+{
+  return entries[handle].name;
+}
+
+void Textures::update()
+{
+  std::vector<Decoded *> ready;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ready.swap(decoded);
+  }
+
+  for (size_t i = 0; i < ready.size(); i++)
+  {
+    Decoded *d = ready[i];
+    Entry &entry = entries[d->handle];
+    outstanding--;
+    //  Released while loading
+    if (entry.refs <= 0)
+    {
+      delete d;
+      continue;
+    }
+
+    //  Same pixels as a texture already resident - drop the placeholder and share it
+    size_t k;
+    for (k = 0; k < entries.size(); k++)
+      if ((int)k != d->handle && entries[k].ready && entries[k].refs > 0 && entries[k].hash == d->hash)
+        break;
+    if (k < entries.size())
+    {
+      glDeleteTextures(1, &entry.name);
+      entry.name = entries[k].name;
+      entry.bytes = entries[k].bytes;
+    }
+    else
+    {
+      //  Keep the driver's compressed mip chain for the next run
+      Util::UploadTexture(entry.name, entry.path.c_str(), d->image);
+      if (d->levels)
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, d->levels - 1);
+      entry.bytes = TextureCache::bake(entry.path.c_str(), entry.name, d->hash);
+    }
+    entry.hash = d->hash;
+    entry.ready = true;
+    delete d;
+  }
+
+  //  Write the cache once the last image is in
+  if (!ready.empty() && outstanding == 0)
+    TextureCache::save();
+}
+
+void Textures::finish()
+{
+  while (outstanding > 0)
+  {
+    update();
+    std::this_thread::yield();
+  }
+}
+
+int Textures::pending()
+{
+  return outstanding;
+}
+
+size_t Textures::residentBytes()
+{
+  size_t bytes = 0;
+  for (size_t i = 0; i < entries.size(); i++)
+  {
+    if (entries[i].refs <= 0)
+      continue;
+    //  Count each GL texture once, at its first live entry
+    size_t k;
+    for (k = 0; k < i; k++)
+      if (entries[k].refs > 0 && entries[k].name == entries[i].name)
+        break;
+    if (k == i)
+      bytes += entries[i].bytes;
+  }
+  return bytes;
+}
+
+int Textures::residentCount()
+{
+  int count = 0;
+  for (size_t i = 0; i < entries.size(); i++)
+  {
+    if (entries[i].refs <= 0)
+      continue;
+    size_t k;
+    for (k = 0; k < i; k++)
+      if (entries[k].refs > 0 && entries[k].name == entries[i].name)
+        break;
+    if (k == i)
+      count++;
+  }
+  return count;
+}
@@ -1,8 +1,19 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <cmath>
+#include <chrono>
 #include "util.hpp"
+#include "mesh.hpp"
+#include "primitives.hpp"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #ifdef USEGLEW
 #include <GL/glew.h>
 #endif
@@ -28,6 +39,8 @@
 // Constants
 const double Util::PI = 3.14159265358979323846;
 
+bool Util::headless = false;
+
 /*
  *  Check for OpenGL errors
  */
@@ -64,6 +77,9 @@ void Util::Print(const char *format, ...)
   va_start(args, format);
   vsnprintf(buf, LEN, format, args);
   va_end(args);
+  //  Bitmap fonts need a GLUT window
+  if (headless)
+    return;
   //  Display the characters one at a time at the current raster position
   while (*ch)
     glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, *ch++);
@@ -84,64 +100,203 @@ void Util::Vertex(double th, double ph)
   glVertex3d(x, y, z);
 }
 
-static void Reverse(void *x, const int n)
+Util::Image::Image() : width(0), height(0), rowBytes(0), data(0), mapping(0), mappingSize(0)
 {
-  char *ch = (char *)x;
-  for (int k = 0; k < n / 2; k++)
-  {
-    char tmp = ch[k];
-    ch[k] = ch[n - 1 - k];
-    ch[n - 1 - k] = tmp;
-  }
+}
+
+Util::Image::~Image()
+{
+  UnmapFile(mapping, mappingSize);
+}
+
+/*
+ *  Bytes of pixel data including row padding
+ */
+size_t Util::Image::size() const
+{
+  return (size_t)rowBytes * height;
+}
+
+/*
+ *  Little endian fields read in place - works on any host byte order
+ */
+static unsigned int read16(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static unsigned int read32(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
 }
 
 //
-//  Load texture from BMP file
+//  Map a whole file read-only, 0 if it cannot be opened
 //
-int Util::LoadTexBMP(const char *file)
+void *Util::MapFile(const char *file, size_t &length)
 {
-  //  Open file
+#ifdef _WIN32
+  //  No mmap - read the whole file in one go
   FILE *f = fopen(file, "rb");
   if (!f)
+    return 0;
+  fseek(f, 0, SEEK_END);
+  length = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  void *data = malloc(length ? length : 1);
+  if (length && fread(data, length, 1, f) != 1)
+  {
+    free(data);
+    data = 0;
+  }
+  fclose(f);
+  return data;
+#else
+  int fd = open(file, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size == 0)
+  {
+    close(fd);
+    return 0;
+  }
+  length = st.st_size;
+  void *data = mmap(0, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return 0;
+  madvise(data, length, MADV_SEQUENTIAL);
+  return data;
+#endif
+}
+
+void Util::UnmapFile(void *data, size_t length)
+{
+  if (!data)
+    return;
+#ifdef _WIN32
+  free(data);
+#else
+  munmap(data, length);
+#endif
+}
+
+//  Largest BMP side read - the biggest texture any driver takes, checked
+//  on the workers before the pixels are touched
+static const int MAX_BMP_SIZE = 16384;
+
+//
+//  Map a BMP file and point the image at its pixels
+//
+void Util::ReadBMP(const char *file, Image &image)
+{
+  //  Pages are read as the pixels are used
+  size_t length;
+  void *mapping = MapFile(file, length);
+  if (!mapping)
     Fatal("Cannot open file %s\n", file);
+  image.mapping = mapping;
+  image.mappingSize = length;
+  const unsigned char *bytes = (const unsigned char *)mapping;
+
   //  Check image magic
-  unsigned short magic;
-  if (fread(&magic, 2, 1, f) != 1)
-    Fatal("Cannot read magic from %s\n", file);
-  if (magic != 0x4D42 && magic != 0x424D)
-    Fatal("Image magic not BMP in %s\n", file);
-  //  Read header
-  unsigned int dx, dy, off, k; // Image dimensions, offset and compression
-  unsigned short nbp, bpp;     // Planes and bits per pixel
-  if (fseek(f, 8, SEEK_CUR) || fread(&off, 4, 1, f) != 1 ||
-      fseek(f, 4, SEEK_CUR) || fread(&dx, 4, 1, f) != 1 || fread(&dy, 4, 1, f) != 1 ||
-      fread(&nbp, 2, 1, f) != 1 || fread(&bpp, 2, 1, f) != 1 || fread(&k, 4, 1, f) != 1)
+  if (length < 54)
     Fatal("Cannot read header from %s\n", file);
-  //  Reverse bytes on big endian hardware (detected by backwards magic)
-  if (magic == 0x424D)
-  {
-    Reverse(&off, 4);
-    Reverse(&dx, 4);
-    Reverse(&dy, 4);
-    Reverse(&nbp, 2);
-    Reverse(&bpp, 2);
-    Reverse(&k, 4);
-  }
+  if (bytes[0] != 'B' || bytes[1] != 'M')
+    Fatal("Image magic not BMP in %s\n", file);
+  //  Header fields
+  unsigned int off = read32(bytes + 10);
+  int dx = (int)read32(bytes + 18);
+  int dy = (int)read32(bytes + 22); // Negative for rows stored top down
+  unsigned int nbp = read16(bytes + 26);
+  unsigned int bpp = read16(bytes + 28);
+  unsigned int k = read32(bytes + 30);
   //  Check image parameters
-  unsigned int max;
-  glGetIntegerv(GL_MAX_TEXTURE_SIZE, (int *)&max);
-  if (dx < 1 || dx > max)
-    Fatal("%s image width %d out of range 1-%d\n", file, dx, max);
-  if (dy < 1 || dy > max)
-    Fatal("%s image height %d out of range 1-%d\n", file, dy, max);
+  if (dx < 1 || dx > MAX_BMP_SIZE)
+    Fatal("%s image width %d out of range 1-%d\n", file, dx, MAX_BMP_SIZE);
+  if (dy == 0 || dy < -MAX_BMP_SIZE || dy > MAX_BMP_SIZE)
+    Fatal("%s image height %d out of range 1-%d\n", file, dy, MAX_BMP_SIZE);
   if (nbp != 1)
     Fatal("%s bit planes is not 1: %d\n", file, nbp);
   if (bpp != 24)
     Fatal("%s bits per pixel is not 24: %d\n", file, bpp);
   if (k != 0)
     Fatal("%s compressed files not supported\n", file);
+
+  //  Rows are padded to a multiple of 4 bytes - sized in 64 bits before
+  //  anything is compared with the file
+  unsigned int rows = dy < 0 ? -dy : dy;
+  uint64_t rowBytes = (3 * (uint64_t)dx + 3) & ~(uint64_t)3;
+  if (off > length || rowBytes * rows > (uint64_t)(length - off))
+    Fatal("Error reading data from image %s\n", file);
+  image.width = dx;
+  image.height = rows;
+  image.rowBytes = (unsigned int)rowBytes;
+
+  if (dy > 0)
+  {
+    //  Bottom up like OpenGL - use the pixels in place
+    image.data = bytes + off;
+    return;
+  }
+
+  //  Top down - copy the rows in reverse order
+  std::vector<unsigned char> flipped(image.size());
+  for (unsigned int y = 0; y < rows; y++)
+    memcpy(&flipped[(size_t)y * image.rowBytes], bytes + off + (size_t)(rows - 1 - y) * image.rowBytes, image.rowBytes);
+  image.pixels.swap(flipped);
+  image.data = image.pixels.data();
+}
+
+//
+//  Load texture from BMP file
+//
+int Util::LoadTexBMP(const char *file)
+{
+  Image image;
+  ReadBMP(file, image);
+
+  //  Generate 2D texture
+  unsigned int texture;
+  glGenTextures(1, &texture);
+  UploadTexture(texture, file, image);
+  //  Return texture name
+  return texture;
+}
+
+/*
+ *  Driver compresses RGB to DXT1 blocks - a sixth of the memory
+ */
+bool Util::CompressTextures()
+{
+  static int supported = -1;
+  if (supported < 0)
+  {
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+    supported = extensions && strstr(extensions, "GL_EXT_texture_compression_s3tc") ? 1 : 0;
+  }
+  return supported;
+}
+
+//
+//  Copy a decoded image into a texture
+//
+void Util::UploadTexture(unsigned int texture, const char *file, const Image &image)
+{
+  unsigned int dx = image.width;
+  unsigned int dy = image.height;
+
+  //  Check image parameters
+  unsigned int max;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, (int *)&max);
+  if (dx > max)
+    Fatal("%s image width %d out of range 1-%d\n", file, dx, max);
+  if (dy > max)
+    Fatal("%s image height %d out of range 1-%d\n", file, dy, max);
 #ifndef GL_VERSION_2_0
   //  OpenGL 2.0 lifts the restriction that texture size must be a power of two
+  unsigned int k;
   for (k = 1; k < dx; k *= 2)
     ;
   if (k != dx)
@@ -152,41 +307,49 @@ int Util::LoadTexBMP(const char *file)
     Fatal("%s image height not a power of two: %d\n", file, dy);
 #endif
 
-  //  Allocate image memory
-  unsigned int size = 3 * dx * dy;
-  unsigned char *image = (unsigned char *)malloc(size);
-  if (!image)
-    Fatal("Cannot allocate %d bytes of memory for image %s\n", size, file);
-  //  Seek to and read image
-  if (fseek(f, off, SEEK_SET) || fread(image, size, 1, f) != 1)
-    Fatal("Error reading data from image %s\n", file);
-  fclose(f);
-  //  Reverse colors (BGR -> RGB)
-  for (k = 0; k < size; k += 3)
-  {
-    unsigned char temp = image[k];
-    image[k] = image[k + 2];
-    image[k + 2] = temp;
-  }
-
   //  Sanity check
   ErrCheck("LoadTexBMP");
-  //  Generate 2D texture
-  unsigned int texture;
-  glGenTextures(1, &texture);
   glBindTexture(GL_TEXTURE_2D, texture);
-  //  Copy image
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, dx, dy, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
+  //  Copy image straight from the file layout - BGR with rows padded to 4 bytes
+  //  Block compress where the driver can and build the mip chain on the way in
+  GLint format = CompressTextures() ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGB;
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
+  glTexImage2D(GL_TEXTURE_2D, 0, format, dx, dy, 0, GL_BGR, GL_UNSIGNED_BYTE, image.data);
   if (glGetError())
     Fatal("Error in glTexImage2D %s %dx%d\n", file, dx, dy);
-  //  Scale linearly when image size doesn't match
+  //  Trilinear filtering so distant ground does not shimmer
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+}
 
-  //  Free image memory
-  free(image);
-  //  Return texture name
-  return texture;
+/*
+ *  AVX2 needs FMA alongside it - every AVX2 kernel fuses its multiply-adds
+ */
+static Util::Simd detect()
+{
+#ifdef SIMD_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return Util::AVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return Util::SSE;
+#endif
+  return Util::SCALAR;
+}
+
+Util::Simd Util::simd()
+{
+  //  Checked once, by whichever thread gets here first
+  static const Simd level = detect();
+  return level;
+}
+
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+double Util::seconds()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
 }
 
 // Utility function to convert degrees to radians
@@ -256,6 +419,33 @@ void Util::calculateRotation(const double start[3], const double end[3], double
   }
 }
 
+/*
+ *  Set the material used by balls - yellow specular with optional blue emission
+ */
+void Util::material(double shiny, double emissionFactor)
+{
+  float yellow[] = {1.0f, 1.0f, 0.0f, 1.0f};
+  float emission[] = {0.0f, 0.0f, static_cast<float>(0.01 * emissionFactor), 1.0f};
+
+  glMaterialf(GL_FRONT, GL_SHININESS, static_cast<GLfloat>(shiny));
+  glMaterialfv(GL_FRONT, GL_SPECULAR, yellow);
+  glMaterialfv(GL_FRONT, GL_EMISSION, emission);
+}
+
+/*
+ *  Record a sphere into a mesh
+ *     at (x,y,z)
+ *     radius (r)
+ */
+void Util::sphere(Mesh &mesh, double x, double y, double z, double r, double inc)
+{
+  mesh.pushMatrix();
+  mesh.translate(x, y, z);
+  mesh.scale(r, r, r);
+  mesh.append(Primitives::sphere(inc));
+  mesh.popMatrix();
+}
+
 void Util::ball(double x, double y, double z, double r, double inc, double shiny, double emissionFactor)
 {
   // Save transformation
@@ -265,28 +455,13 @@ void Util::ball(double x, double y, double z, double r, double inc, double shiny
   glTranslated(x, y, z);
   glScaled(r, r, r);
 
-  // Set material properties
-  float yellow[] = {1.0f, 1.0f, 0.0f, 1.0f};
-  float emission[] = {0.0f, 0.0f, static_cast<float>(0.01 * emissionFactor), 1.0f};
-
   // glColor3f(1.0f, 1.0f, 1.0f); // White color for the sphere
 
   // Set material properties
-  glMaterialf(GL_FRONT, GL_SHININESS, static_cast<GLfloat>(shiny));
-  glMaterialfv(GL_FRONT, GL_SPECULAR, yellow);
-  glMaterialfv(GL_FRONT, GL_EMISSION, emission);
+  material(shiny, emissionFactor);
 
-  // Draw the sphere using quad strips for latitude bands
-  for (double ph = -90.0; ph < 90.0; ph += inc)
-  {
-    glBegin(GL_QUAD_STRIP);
-    for (double th = 0.0; th <= 360.0; th += 2 * inc)
-    {
-      Util::Vertex(th, ph);
-      Util::Vertex(th, ph + inc);
-    }
-    glEnd();
-  }
+  // Draw the shared unit sphere
+  Primitives::sphere(inc).draw();
 
   // Restore transformation
   glPopMatrix();
@@ -0,0 +1,100 @@
+#include <atomic>
+#include <memory>
+#include "workers.hpp"
+
+//  Indices not yet claimed by a thread and indices finished in one loop -
+//  shared with helpers that start after the loop has returned, which find
+//  nothing left to claim
+struct Claims
+{
+  std::atomic<int> next, done;
+  std::function<void(int)> job;
+};
+
+Workers &Workers::pool()
+{
+  static Workers workers(std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1);
+  return workers;
+}
+
+Workers::Workers(int count) : stopping(false)
+{
+  for (int i = 0; i < count; i++)
+    threads.push_back(std::thread(&Workers::run, this));
+}
+
+Workers::~Workers()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+}
+
+void Workers::submit(const std::function<void()> &job)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.push_back(job);
+  }
+  wake.notify_one();
+}
+
+void Workers::parallelFor(int n, const std::function<void(int)> &job)
+{
+  if (n <= 1)
+  {
+    if (n == 1)
+      job(0);
+    return;
+  }
+
+  std::shared_ptr<Claims> claims = std::make_shared<Claims>();
+  claims->next = 0;
+  claims->done = 0;
+  claims->job = job;
+  auto work = [claims, n]()
+  {
+    for (int i = claims->next++; i < n; i = claims->next++)
+    {
+      claims->job(i);
+      claims->done++;
+    }
+  };
+  Workers &workers = pool();
+  int helpers = workers.size() < n - 1 ? workers.size() : n - 1;
+  for (int h = 0; h < helpers; h++)
+    workers.submit(work);
+  work();
+  while (claims->done < n)
+    std::this_thread::yield();
+}
+
+int Workers::size() const
+{
+  return (int)threads.size();
+}
+
+/*
+ *  Worker loop - take jobs until the pool shuts down
+ */
+void Workers::run()
+{
+  while (true)
+  {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this]()
+                { return stopping || !jobs.empty(); });
+      if (stopping && jobs.empty())
+        return;
+      job = jobs.front();
+      jobs.pop_front();
+    }
+    job();
+  }
+}